@@ -0,0 +1,924 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include "../include/cgame.hpp"
+
+// Headless benchmarks. Runs on SDL's dummy video/audio drivers and the software renderer unless
+// the environment says otherwise, and prints one JSON document with every result.
+//
+//     bench [--quick] [--filter <substring>] [--out <file>]
+
+struct Result
+{
+    std::string name;
+    long long iterations;
+    double totalMs;
+    double nsPerOp;
+};
+
+struct FrameResult
+{
+    std::string name;
+    int frames;
+    cgame::FrameStats stats;
+};
+
+static std::vector<Result> results;
+static std::vector<FrameResult> frameResults;
+static std::string filter;
+static double iterationScale = 1.0;
+static volatile float sink = 0.0f;
+
+static bool selected(const std::string& name)
+{
+    return filter.empty() || name.find(filter) != std::string::npos;
+}
+
+template <typename Fn>
+static void run(const std::string& name, long long iterations, Fn body)
+{
+    if (!selected(name))
+        return;
+
+    iterations = std::max(1LL, static_cast<long long>(iterations * iterationScale));
+    body(std::max(1LL, iterations / 10));
+
+    Uint64 start = cgame::time::now();
+    body(iterations);
+    double seconds = cgame::time::to_seconds(cgame::time::now() - start);
+
+    results.push_back({ name, iterations, seconds * 1000.0, seconds * 1e9 / static_cast<double>(iterations) });
+    std::cerr << std::left << std::setw(40) << name << std::right << std::setw(12) << std::fixed << std::setprecision(1)
+              << results.back().nsPerOp << " ns/op" << std::endl;
+}
+
+static void finish_rendering(SDL_Renderer* renderer)
+{
+    cgame::batch::flush();
+    SDL_RenderFlush(renderer);
+}
+
+static void bench_blits(cgame::Window& screen, cgame::Surface& display, cgame::Surface& sprite, bool batched)
+{
+    SDL_Renderer* renderer = screen.get_renderer();
+    std::string mode = batched ? "batched" : "immediate";
+    if (batched)
+        cgame::batch::begin(renderer);
+
+    const float maxX = std::max(1.0f, display.get_width() - sprite.get_width());
+    const float maxY = std::max(1.0f, display.get_height() - sprite.get_height());
+
+    struct Variant
+    {
+        const char* name;
+        float rotation;
+        bool flip;
+        float alpha;
+    };
+    const Variant variants[] = {
+        { "plain", 0.0f, false, 255.0f },
+        { "rotated", 33.0f, false, 255.0f },
+        { "flipped", 0.0f, true, 255.0f },
+        { "alpha", 0.0f, false, 128.0f },
+    };
+
+    for (const Variant& variant : variants)
+    {
+        sprite.set_rotation(variant.rotation);
+        sprite.set_flip(variant.flip);
+        sprite.set_alpha(variant.alpha);
+
+        run("blit/" + std::string(variant.name) + "/" + mode, 200000, [&](long long n)
+        {
+            for (long long i = 0; i < n; i++)
+                display.blit(sprite, static_cast<float>((i * 37) % static_cast<long long>(maxX)), static_cast<float>((i * 11) % static_cast<long long>(maxY)));
+            finish_rendering(renderer);
+        });
+    }
+
+    sprite.set_rotation(0.0f);
+    sprite.set_flip(false);
+    sprite.set_alpha(255.0f);
+
+    run("draw/fill_rect/" + mode, 200000, [&](long long n)
+    {
+        for (long long i = 0; i < n; i++)
+        {
+            cgame::Rect r(static_cast<float>((i * 13) % 600), static_cast<float>((i * 7) % 340), 16, 16);
+            cgame::draw::fill_rect(display, r, { static_cast<Uint8>(i), 128, 64, 255 });
+        }
+        finish_rendering(renderer);
+    });
+
+    if (batched)
+        cgame::batch::end();
+}
+
+static void bench_primitives(cgame::Window& screen, cgame::Surface& display)
+{
+    SDL_Renderer* renderer = screen.get_renderer();
+    std::vector<cgame::Rect> boxes;
+    for (int i = 0; i < 10000; i++)
+        boxes.push_back({ static_cast<float>((i * 13) % 600), static_cast<float>((i * 7) % 340), 16, 16 });
+
+    run("draw/rect_10k_single_calls", 20, [&](long long n)
+    {
+        for (long long k = 0; k < n; k++)
+        {
+            for (const cgame::Rect& r : boxes)
+                cgame::draw::rect(display, r, { 0, 255, 0, 255 });
+        }
+        finish_rendering(renderer);
+    });
+
+    run("draw/rects_10k_list", 20, [&](long long n)
+    {
+        for (long long k = 0; k < n; k++)
+            cgame::draw::rects(display, boxes, { 0, 255, 0, 255 });
+        finish_rendering(renderer);
+    });
+
+    run("draw/fill_circle_r24_cached", 20000, [&](long long n)
+    {
+        for (long long i = 0; i < n; i++)
+            cgame::draw::fill_circle(display, { static_cast<float>((i * 13) % 600), static_cast<float>((i * 7) % 340) }, 24, { 255, 128, 0, 255 });
+        finish_rendering(renderer);
+    });
+
+    std::vector<cgame::Vec2> star;
+    for (int i = 0; i < 10; i++)
+        star.push_back(cgame::Vec2::from_angle(i * 36.0f, i % 2 ? 12.0f : 30.0f) + cgame::Vec2(40, 40));
+
+    run("draw/polygon_star_w3_batched", 20000, [&](long long n)
+    {
+        cgame::batch::begin(renderer);
+        for (long long i = 0; i < n; i++)
+        {
+            cgame::draw::fill_polygon(display, star, { 80, 80, 255, 255 });
+            cgame::draw::polygon(display, star, { 255, 255, 255, 255 }, 3);
+        }
+        cgame::batch::end();
+        finish_rendering(renderer);
+    });
+}
+
+static void bench_fonts(cgame::Surface& display)
+{
+    cgame::font::Font font("assets/fonts/MedodicaRegular.otf", 24);
+
+    run("font/render", 2000, [&](long long n)
+    {
+        for (long long i = 0; i < n; i++)
+        {
+            cgame::Surface text = font.render("Score: " + std::to_string(i), { 255, 255, 255 });
+            display.blit(text, 10, 10);
+        }
+        finish_rendering(cgame::display::get_renderer());
+    });
+
+    run("font/draw_atlas", 20000, [&](long long n)
+    {
+        for (long long i = 0; i < n; i++)
+            font.draw(display, "Score: " + std::to_string(i), 10, 10, { 255, 255, 255 });
+        finish_rendering(cgame::display::get_renderer());
+    });
+}
+
+// A 500x500 map of 16 px tiles scrolled across a 640x360 view, per frame.
+static void bench_tilemap(cgame::Window& screen, cgame::Surface& display)
+{
+    SDL_Renderer* renderer = screen.get_renderer();
+    cgame::Surface sheet(renderer, 160, 160);
+    sheet.fill({ 90, 140, 60 });
+
+    cgame::tilemap::Tileset tileset(sheet, 16, 16);
+    cgame::tilemap::TileMap map(renderer, tileset, 500, 500);
+    std::vector<int> ids(500 * 500);
+    cgame::random::Rng rng(1234);
+    rng.fill_randint(ids.data(), ids.size(), 1, tileset.get_count());
+    for (int y = 0; y < 500; y++)
+    {
+        for (int x = 0; x < 500; x++)
+            map.set(x, y, static_cast<Uint16>(ids[y * 500 + x]));
+    }
+
+    run("tilemap/per_tile_blits", 200, [&](long long n)
+    {
+        for (long long k = 0; k < n; k++)
+        {
+            float scroll = static_cast<float>(k % 4000);
+            int x0 = static_cast<int>(scroll) / 16, y0 = static_cast<int>(scroll) / 32;
+            for (int y = y0; y < y0 + 24 && y < 500; y++)
+            {
+                for (int x = x0; x < x0 + 41 && x < 500; x++)
+                {
+                    SDL_Rect src;
+                    if (!tileset.get_source(map.get(x, y), src))
+                        continue;
+                    display.blit(sheet, x * 16 - scroll, y * 16 - scroll / 2, { static_cast<float>(src.x), static_cast<float>(src.y), 16, 16 });
+                }
+            }
+        }
+        finish_rendering(renderer);
+    });
+
+    for (bool batched : { false, true })
+    {
+        if (batched)
+            cgame::batch::begin(renderer);
+
+        run(std::string("tilemap/chunked/") + (batched ? "batched" : "immediate"), 2000, [&](long long n)
+        {
+            for (long long k = 0; k < n; k++)
+            {
+                float scroll = static_cast<float>(k % 4000);
+                map.draw(display, { scroll, scroll / 2, display.get_width(), display.get_height() });
+            }
+            finish_rendering(renderer);
+        });
+
+        if (batched)
+            cgame::batch::end();
+    }
+}
+
+// 20000 sprites spread over a world 40x the display; about 2% are on screen at any time.
+static void bench_render_queue(cgame::Window& screen, cgame::Surface& display, cgame::Surface& sprite)
+{
+    SDL_Renderer* renderer = screen.get_renderer();
+    std::vector<float> positions(20000 * 2);
+    cgame::random::Rng rng(99);
+    rng.fill_uniform(positions.data(), positions.size(), 0.0f, 4000.0f);
+
+    cgame::Camera camera(display.get_width(), display.get_height());
+    cgame::RenderQueue queue;
+
+    run("render_queue/submit_cull_20k", 100, [&](long long n)
+    {
+        for (long long k = 0; k < n; k++)
+        {
+            camera.set_position({ 2000.0f + static_cast<float>(k % 100), 2000.0f });
+            for (size_t i = 0; i < positions.size(); i += 2)
+                queue.submit(sprite, positions[i], positions[i + 1], static_cast<int>(i % 3));
+            queue.flush(display, camera);
+        }
+        finish_rendering(renderer);
+    });
+}
+
+// A menu-like screen: a static background with three small widgets changing each frame.
+static void bench_dirty_rects(cgame::Window& screen, cgame::Surface& sprite)
+{
+    cgame::Surface& target = screen.get_screen_surface();
+
+    for (bool dirty : { false, true })
+    {
+        screen.set_dirty_mode(dirty);
+        target.fill({ 40, 40, 60 });
+
+        run(std::string("present/menu/") + (dirty ? "dirty_rects" : "full"), 300, [&](long long n)
+        {
+            for (long long k = 0; k < n; k++)
+            {
+                screen.begin_frame();
+                if (!dirty)
+                    target.fill({ 40, 40, 60 });
+                for (int i = 0; i < 3; i++)
+                {
+                    cgame::Rect widget(100.0f + i * 300.0f, 200.0f, 120.0f, 40.0f);
+                    cgame::draw::fill_rect(target, widget, { static_cast<Uint8>(k * 5 + i * 60), 90, 160, 255 });
+                    target.blit(sprite, widget.x + static_cast<float>(k % 80), widget.y);
+                }
+                screen.end_frame();
+            }
+        });
+    }
+    screen.set_dirty_mode(false);
+}
+
+static void bench_particles(cgame::Window& screen, cgame::Surface& display, cgame::Surface& sprite)
+{
+    cgame::particles::EmitterConfig config;
+    config.rate = 20000.0f;
+    config.lifetimeMin = 0.5f;
+    config.lifetimeMax = 1.0f;
+    config.gravity = { 0.0f, 200.0f };
+    config.drag = 0.5f;
+    config.size = { 6.0f, 1.0f };
+    config.alpha = { 1.0f, 0.0f };
+
+    cgame::particles::ParticleSystem system;
+    cgame::particles::Emitter& emitter = system.add_emitter(config, 20000, &sprite);
+    emitter.set_position({ display.get_width() / 2, display.get_height() / 2 });
+    for (int i = 0; i < 120; i++)
+        system.update(1.0f / 60.0f);
+
+    run("particles/update_20k", 2000, [&](long long n)
+    {
+        for (long long k = 0; k < n; k++)
+            system.update(1.0f / 60.0f);
+    });
+
+    run("particles/draw_20k", 200, [&](long long n)
+    {
+        for (long long k = 0; k < n; k++)
+            system.draw(display);
+        finish_rendering(screen.get_renderer());
+    });
+}
+
+struct BenchVelocity
+{
+    cgame::Vec2 value;
+};
+
+static void bench_pixels(cgame::Window& screen)
+{
+    const size_t count = 512 * 512;
+    std::vector<Uint32> dst(count), src(count);
+    cgame::random::Rng rng(11);
+    for (size_t i = 0; i < count; i++)
+    {
+        dst[i] = static_cast<Uint32>(rng.next());
+        src[i] = static_cast<Uint32>(rng.next());
+    }
+    cgame::pixels::PixelView view{ dst.data(), 512, 512, 512 };
+
+    run("pixels/blend_512x512_scalar", 100, [&](long long n)
+    {
+        for (long long k = 0; k < n; k++)
+            cgame::pixels::blend_scalar(dst.data(), src.data(), count);
+    });
+    run("pixels/blend_512x512_simd", 100, [&](long long n)
+    {
+        for (long long k = 0; k < n; k++)
+            cgame::pixels::blend(dst.data(), src.data(), count);
+    });
+    run("pixels/color_mod_512x512_scalar", 100, [&](long long n)
+    {
+        for (long long k = 0; k < n; k++)
+            cgame::pixels::color_mod_scalar(dst.data(), count, { 250, 240, 230, 255 });
+    });
+    run("pixels/color_mod_512x512_simd", 100, [&](long long n)
+    {
+        for (long long k = 0; k < n; k++)
+            cgame::pixels::color_mod(dst.data(), count, { 250, 240, 230, 255 });
+    });
+    run("pixels/blur_r8_512x512_scalar", 20, [&](long long n)
+    {
+        for (long long k = 0; k < n; k++)
+            cgame::pixels::blur_scalar(view, 8);
+    });
+    run("pixels/blur_r8_512x512_simd", 20, [&](long long n)
+    {
+        for (long long k = 0; k < n; k++)
+            cgame::pixels::blur(view, 8);
+    });
+
+    cgame::Surface canvas(screen.get_renderer(), 512, 512, cgame::SURFACE_STREAMING);
+    run("pixels/streaming_lock_64x64_upload", 1000, [&](long long n)
+    {
+        for (long long k = 0; k < n; k++)
+        {
+            cgame::pixels::PixelView area = canvas.lock({ static_cast<float>(k % 448), 32, 64, 64 });
+            for (int y = 0; y < area.height; y++)
+                cgame::pixels::blend(area.row(y), src.data() + y * 64, area.width);
+            canvas.unlock();
+        }
+        finish_rendering(screen.get_renderer());
+    });
+    sink = static_cast<float>(dst[count / 2] & 0xFF);
+}
+
+static void bench_ecs()
+{
+    cgame::ecs::World world;
+    for (int i = 0; i < 100000; i++)
+    {
+        cgame::ecs::Entity e = world.create(cgame::Vec2(static_cast<float>(i), 0.0f), BenchVelocity{ { 1.0f, 0.5f } });
+        if (i % 2 == 0)
+            world.add(e, cgame::Rect(0.0f, 0.0f, 8.0f, 8.0f));
+    }
+
+    run("ecs/each_100k", 500, [&](long long n)
+    {
+        for (long long k = 0; k < n; k++)
+        {
+            world.each<cgame::Vec2, const BenchVelocity>([](cgame::Vec2& p, const BenchVelocity& v)
+            {
+                p += v.value * (1.0f / 60.0f);
+            });
+        }
+    });
+
+    run("ecs/each_chunk_100k", 500, [&](long long n)
+    {
+        for (long long k = 0; k < n; k++)
+        {
+            world.each_chunk<cgame::Vec2, const BenchVelocity>([](size_t count, const cgame::ecs::Entity*, cgame::Vec2* p, const BenchVelocity* v)
+            {
+                for (size_t i = 0; i < count; i++)
+                    p[i] += v[i].value * (1.0f / 60.0f);
+            });
+        }
+    });
+
+    cgame::ecs::Scheduler scheduler;
+    scheduler.add("move", cgame::ecs::Access().read<BenchVelocity>().write<cgame::Vec2>(), [](cgame::ecs::World& w, float dt)
+    {
+        w.each<cgame::Vec2, const BenchVelocity>([dt](cgame::Vec2& p, const BenchVelocity& v) { p += v.value * dt; });
+    });
+    scheduler.add("damp", cgame::ecs::Access().write<BenchVelocity>(), [](cgame::ecs::World& w, float)
+    {
+        w.each<BenchVelocity>([](BenchVelocity& v) { v.value *= 0.999f; });
+    });
+    scheduler.add("bounds", cgame::ecs::Access().read<cgame::Vec2>().write<cgame::Rect>(), [](cgame::ecs::World& w, float)
+    {
+        w.each<const cgame::Vec2, cgame::Rect>([](const cgame::Vec2& p, cgame::Rect& r) { r.x = p.x; r.y = p.y; });
+    });
+
+    run("ecs/scheduler_3_systems_100k", 500, [&](long long n)
+    {
+        for (long long k = 0; k < n; k++)
+            scheduler.run(world, 1.0f / 60.0f);
+    });
+}
+
+static void bench_jobs()
+{
+    std::vector<float> values(1 << 20);
+    cgame::random::fill_uniform(values.data(), values.size(), 0.0f, 1.0f);
+
+    run("jobs/parallel_for_1m_sqrt", 200, [&](long long n)
+    {
+        for (long long k = 0; k < n; k++)
+        {
+            cgame::jobs::parallel_for(0, values.size(), 16384, [&](size_t first, size_t last)
+            {
+                for (size_t i = first; i < last; i++)
+                    values[i] = std::sqrt(values[i] + 1.0f);
+            });
+        }
+        sink = values[values.size() / 2];
+    });
+
+    run("jobs/run_wait_1k_empty", 200, [&](long long n)
+    {
+        for (long long k = 0; k < n; k++)
+        {
+            cgame::jobs::Counter counter;
+            for (int i = 0; i < 1000; i++)
+                cgame::jobs::run([]() { }, &counter);
+            cgame::jobs::wait(counter);
+        }
+    });
+}
+
+static std::vector<cgame::Rect> random_rects(size_t count, float extent, float maxSize)
+{
+    std::vector<cgame::Rect> rects;
+    rects.reserve(count);
+    for (size_t i = 0; i < count; i++)
+        rects.push_back({ cgame::random::uniform(0, extent), cgame::random::uniform(0, extent), cgame::random::uniform(2, maxSize), cgame::random::uniform(2, maxSize) });
+    return rects;
+}
+
+static void bench_collision()
+{
+    cgame::random::seed(1234);
+    std::vector<cgame::Rect> rects = random_rects(1000, 2000.0f, 24.0f);
+
+    run("rect/colliderect", 2000000, [&](long long n)
+    {
+        int hits = 0;
+        for (long long i = 0; i < n; i++)
+            hits += rects[i % rects.size()].colliderect(rects[(i * 7 + 1) % rects.size()]);
+        sink = static_cast<float>(hits);
+    });
+
+    run("rect/collidepoint", 2000000, [&](long long n)
+    {
+        int hits = 0;
+        for (long long i = 0; i < n; i++)
+            hits += rects[i % rects.size()].collidepoint(static_cast<float>(i % 2000), static_cast<float>((i * 3) % 2000));
+        sink = static_cast<float>(hits);
+    });
+
+    std::vector<cgame::Rect> bullets = random_rects(5000, 4000.0f, 12.0f);
+
+    run("rect/all_pairs_bruteforce_5k", 2, [&](long long n)
+    {
+        size_t pairs = 0;
+        for (long long k = 0; k < n; k++)
+        {
+            for (size_t i = 0; i < bullets.size(); i++)
+            {
+                for (size_t j = i + 1; j < bullets.size(); j++)
+                    pairs += bullets[i].colliderect(bullets[j]);
+            }
+        }
+        sink = static_cast<float>(pairs);
+    });
+
+    run("rect/all_pairs_spatial_hash_5k", 50, [&](long long n)
+    {
+        cgame::collision::SpatialHash grid(32.0f);
+        std::vector<std::pair<int, int>> pairs;
+        for (long long k = 0; k < n; k++)
+        {
+            grid.build(bullets);
+            pairs.clear();
+            grid.query_pairs(pairs);
+        }
+        sink = static_cast<float>(pairs.size());
+    });
+
+    run("rect/all_pairs_spatial_hash_5k_parallel", 50, [&](long long n)
+    {
+        cgame::collision::SpatialHash grid(32.0f);
+        std::vector<std::pair<int, int>> pairs;
+        for (long long k = 0; k < n; k++)
+        {
+            grid.build(bullets);
+            pairs.clear();
+            grid.query_pairs_parallel(pairs);
+        }
+        sink = static_cast<float>(pairs.size());
+    });
+
+    cgame::RectArray array;
+    for (const cgame::Rect& r : random_rects(20000, 4000.0f, 12.0f))
+        array.push_back(r);
+
+    run("rect/rect_array_collide_20k", 2000, [&](long long n)
+    {
+        std::vector<Uint32> mask;
+        for (long long k = 0; k < n; k++)
+            array.collide_rect({ static_cast<float>(k % 4000), 100, 64, 64 }, mask);
+        sink = static_cast<float>(mask.empty() ? 0 : mask[0]);
+    });
+}
+
+static void bench_archive()
+{
+    const std::vector<std::string> files = { "assets/images/player.png", "assets/fonts/COOPBL.TTF", "assets/fonts/MedodicaRegular.otf",
+                                             "assets/sfx/death.wav", "assets/sfx/hurt.wav", "assets/sfx/jump.wav", "assets/music/rosalia.mp3" };
+    const std::string packPath = "bench_assets.pak";
+
+    cgame::archive::Writer writer;
+    for (const std::string& file : files)
+        writer.add_file(file);
+    if (!writer.save(packPath))
+        return;
+
+    run("archive/read_all_from_files", 200, [&](long long n)
+    {
+        for (long long k = 0; k < n; k++)
+        {
+            for (const std::string& file : files)
+                sink = static_cast<float>(cgame::assets::read_file(file).size);
+        }
+    });
+
+    run("archive/open_and_read_all", 200, [&](long long n)
+    {
+        for (long long k = 0; k < n; k++)
+        {
+            cgame::archive::Archive pack;
+            pack.open(packPath);
+            for (const std::string& file : files)
+                sink = static_cast<float>(pack.read(file).size);
+        }
+    });
+
+    std::vector<Uint8> wav;
+    cgame::archive::Blob raw = cgame::assets::read_file("assets/sfx/death.wav");
+    if (raw)
+    {
+        std::vector<Uint8> packed = cgame::archive::lz4_compress(raw.data, raw.size);
+        wav.resize(raw.size);
+        run("archive/lz4_decompress_wav", 2000, [&](long long n)
+        {
+            for (long long k = 0; k < n; k++)
+                cgame::archive::lz4_decompress(packed.data(), packed.size(), wav.data(), wav.size());
+            sink = wav[wav.size() / 2];
+        });
+    }
+
+    std::remove(packPath.c_str());
+}
+
+static void bench_random()
+{
+    run("random/random", 5000000, [](long long n)
+    {
+        float sum = 0.0f;
+        for (long long i = 0; i < n; i++)
+            sum += cgame::random::random();
+        sink = sum;
+    });
+
+    run("random/uniform", 5000000, [](long long n)
+    {
+        float sum = 0.0f;
+        for (long long i = 0; i < n; i++)
+            sum += cgame::random::uniform(-5.0f, 5.0f);
+        sink = sum;
+    });
+
+    run("random/randint", 5000000, [](long long n)
+    {
+        long long sum = 0;
+        for (long long i = 0; i < n; i++)
+            sum += cgame::random::randint(0, 100);
+        sink = static_cast<float>(sum);
+    });
+
+    // Per 1024 values.
+    std::vector<float> floats(1024);
+    std::vector<int> ints(1024);
+    cgame::random::Rng rng(1234);
+
+    run("random/fill_uniform_1k_scalar", 200000, [&](long long n)
+    {
+        for (long long k = 0; k < n; k++)
+            rng.fill_uniform_scalar(floats.data(), floats.size(), -5.0f, 5.0f);
+        sink = floats[3];
+    });
+
+    run("random/fill_uniform_1k", 200000, [&](long long n)
+    {
+        for (long long k = 0; k < n; k++)
+            rng.fill_uniform(floats.data(), floats.size(), -5.0f, 5.0f);
+        sink = floats[3];
+    });
+
+    run("random/fill_randint_1k", 200000, [&](long long n)
+    {
+        for (long long k = 0; k < n; k++)
+            rng.fill_randint(ints.data(), ints.size(), 0, 100);
+        sink = static_cast<float>(ints[3]);
+    });
+
+    cgame::random::Noise noise(1234);
+    run("random/noise_perlin", 5000000, [&](long long n)
+    {
+        float sum = 0.0f;
+        for (long long i = 0; i < n; i++)
+            sum += noise.perlin(static_cast<float>(i & 1023) * 0.13f, static_cast<float>(i >> 10) * 0.13f);
+        sink = sum;
+    });
+
+    run("random/noise_simplex", 5000000, [&](long long n)
+    {
+        float sum = 0.0f;
+        for (long long i = 0; i < n; i++)
+            sum += noise.simplex(static_cast<float>(i & 1023) * 0.13f, static_cast<float>(i >> 10) * 0.13f);
+        sink = sum;
+    });
+}
+
+// One 1024-frame stereo block per op: the per-voice and format-conversion kernels of mixer::Engine.
+static void bench_audio()
+{
+    const size_t samples = 2048;
+    std::vector<float> src(samples), dst(samples);
+    std::vector<Sint16> pcm(samples);
+    for (size_t i = 0; i < samples; i++)
+    {
+        src[i] = std::sin(static_cast<float>(i) * 0.05f);
+        pcm[i] = static_cast<Sint16>(src[i] * 20000.0f);
+    }
+
+    run("audio/mix_voice_scalar", 200000, [&](long long n)
+    {
+        for (long long k = 0; k < n; k++)
+            cgame::mixer::mix_scaled_scalar(dst.data(), src.data(), samples, 0.5f, 0.25f);
+        sink = dst[7];
+    });
+
+    run("audio/mix_voice", 200000, [&](long long n)
+    {
+        for (long long k = 0; k < n; k++)
+            cgame::mixer::mix_scaled(dst.data(), src.data(), samples, 0.5f, 0.25f);
+        sink = dst[7];
+    });
+
+    run("audio/s16_roundtrip_scalar", 200000, [&](long long n)
+    {
+        for (long long k = 0; k < n; k++)
+        {
+            cgame::mixer::s16_to_float_scalar(pcm.data(), dst.data(), samples);
+            cgame::mixer::float_to_s16_scalar(dst.data(), pcm.data(), samples);
+        }
+        sink = static_cast<float>(pcm[7]);
+    });
+
+    run("audio/s16_roundtrip", 200000, [&](long long n)
+    {
+        for (long long k = 0; k < n; k++)
+        {
+            cgame::mixer::s16_to_float(pcm.data(), dst.data(), samples);
+            cgame::mixer::float_to_s16(dst.data(), pcm.data(), samples);
+        }
+        sink = static_cast<float>(pcm[7]);
+    });
+}
+
+static void push_key(Uint32 type, SDL_Keycode key)
+{
+    cgame::Event e{};
+    e.type = type == SDL_KEYDOWN ? cgame::KEYDOWN : cgame::KEYUP;
+    e.key = key;
+    e.scancode = SDL_GetScancodeFromKey(key);
+    SDL_Event sdlEvent = cgame::to_sdl_event(e);
+    SDL_PushEvent(&sdlEvent);
+}
+
+// The src/main.cpp frame with scripted input and no frame cap.
+static void bench_demo_frame(cgame::Window& screen, bool batched)
+{
+    std::string name = std::string("frame/demo/") + (batched ? "batched" : "immediate");
+    if (!selected(name))
+        return;
+
+    if (batched)
+        cgame::batch::begin(screen.get_renderer());
+
+    cgame::Surface display(screen.get_renderer(), screen.get_width() / 2, screen.get_height() / 2);
+    cgame::Surface playerImage = cgame::image::load(screen.get_renderer(), "assets/images/player.png");
+    playerImage.set_color({ 0, 0, 255 });
+    cgame::Rect playerRect = playerImage.get_rect(100, 150);
+
+    cgame::Surface blueBox(screen.get_renderer(), 50, 100);
+    blueBox.fill({ 0, 0, 255 });
+    cgame::Rect blueBoxRect = blueBox.get_rect(400, 80);
+
+    cgame::font::Font testFont("assets/fonts/MedodicaRegular.otf", 24);
+
+    int frames = std::max(30, static_cast<int>(600 * iterationScale));
+    int movement[2] = { 0, 0 };
+    float rot = 0.0f;
+    cgame::FrameScheduler scheduler(0);
+
+    for (int frame = 0; frame <= frames; frame++)
+    {
+        scheduler.begin_frame();
+
+        if (frame % 60 == 0)
+            push_key(SDL_KEYDOWN, SDLK_d);
+        if (frame % 60 == 30)
+            push_key(SDL_KEYUP, SDLK_d);
+
+        cgame::Event e;
+        while (cgame::get_events(e))
+        {
+            if (e.type == cgame::KEYDOWN && e.key == SDLK_d)
+                movement[1] = 1;
+            if (e.type == cgame::KEYUP && e.key == SDLK_d)
+                movement[1] = 0;
+        }
+
+        screen.begin_frame();
+        display.fill({ 0, 255, 0 });
+
+        playerRect.set_left(playerRect.left() + (movement[1] - movement[0]) * 3);
+        sink = static_cast<float>(playerRect.colliderect(blueBoxRect));
+
+        cgame::draw::rect(display, playerRect, { 255, 0, 0 });
+        cgame::Vec2 centeredTextSize = testFont.get_text_size("Centered Text");
+
+        playerImage.set_alpha(std::max(0.0f, 100.0f + playerRect.x));
+        rot++;
+        display.blit(cgame::transform::rotate(cgame::transform::flip(playerImage, true), rot), playerRect);
+        display.blit(blueBox, blueBoxRect);
+        testFont.draw(display, "Hello World!", 50, 50, { 255, 255, 255 });
+        testFont.draw(display, "Centered Text", (display.get_width() / 2 - centeredTextSize.x) / 2, (display.get_height() / 2 - centeredTextSize.y) / 2, { 255, 0, 0 });
+
+        screen.blit(cgame::transform::scale(display, screen.get_width(), screen.get_height()), 0, 0);
+        screen.end_frame();
+        scheduler.end_frame();
+    }
+
+    frameResults.push_back({ name, frames, scheduler.get_stats() });
+    std::cerr << std::left << std::setw(40) << name << std::right << std::setw(12) << std::fixed << std::setprecision(3)
+              << frameResults.back().stats.mean << " ms/frame" << std::endl;
+
+    if (batched)
+        cgame::batch::end();
+}
+
+static std::string escape(const std::string& text)
+{
+    std::string out;
+    for (char c : text)
+    {
+        if (c == '"' || c == '\\')
+            out += '\\';
+        out += c;
+    }
+    return out;
+}
+
+static std::string to_json(const std::string& videoDriver, const std::string& renderDriver)
+{
+    std::ostringstream ss;
+    ss << std::fixed << std::setprecision(3);
+    ss << "{\n";
+    ss << "  \"version\": 1,\n";
+    ss << "  \"video_driver\": \"" << escape(videoDriver) << "\",\n";
+    ss << "  \"render_driver\": \"" << escape(renderDriver) << "\",\n";
+    ss << "  \"iteration_scale\": " << iterationScale << ",\n";
+    ss << "  \"benchmarks\": [";
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        const Result& r = results[i];
+        ss << (i ? "," : "") << "\n    { \"name\": \"" << escape(r.name) << "\", \"iterations\": " << r.iterations
+           << ", \"total_ms\": " << r.totalMs << ", \"ns_per_op\": " << r.nsPerOp << " }";
+    }
+    ss << "\n  ],\n";
+    ss << "  \"frames\": [";
+    for (size_t i = 0; i < frameResults.size(); i++)
+    {
+        const FrameResult& r = frameResults[i];
+        ss << (i ? "," : "") << "\n    { \"name\": \"" << escape(r.name) << "\", \"frames\": " << r.frames
+           << ", \"mean_ms\": " << r.stats.mean << ", \"p50_ms\": " << r.stats.p50 << ", \"p99_ms\": " << r.stats.p99
+           << ", \"max_ms\": " << r.stats.max << " }";
+    }
+    ss << "\n  ]\n";
+    ss << "}\n";
+    return ss.str();
+}
+
+int main(int argc, char* argv[])
+{
+    std::string outPath;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg == "--quick")
+            iterationScale = 0.1;
+        else if (arg == "--filter" && i + 1 < argc)
+            filter = argv[++i];
+        else if (arg == "--out" && i + 1 < argc)
+            outPath = argv[++i];
+        else
+        {
+            std::cerr << "usage: " << argv[0] << " [--quick] [--filter <substring>] [--out <file>]" << std::endl;
+            return 1;
+        }
+    }
+
+    SDL_setenv("SDL_VIDEODRIVER", "dummy", 0);
+    SDL_setenv("SDL_AUDIODRIVER", "dummy", 0);
+    SDL_setenv("SDL_RENDER_DRIVER", "software", 0);
+
+    cgame::init();
+
+    std::string json;
+    {
+        cgame::Window& screen = cgame::display::set_mode(1280, 720);
+        cgame::Surface display(screen.get_renderer(), screen.get_width() / 2, screen.get_height() / 2);
+        cgame::Surface sprite = cgame::image::load(screen.get_renderer(), "assets/images/player.png");
+
+        bench_blits(screen, display, sprite, false);
+        bench_blits(screen, display, sprite, true);
+        bench_primitives(screen, display);
+        bench_fonts(display);
+        bench_tilemap(screen, display);
+        bench_render_queue(screen, display, sprite);
+        bench_dirty_rects(screen, sprite);
+        bench_particles(screen, display, sprite);
+        bench_pixels(screen);
+        bench_collision();
+        bench_ecs();
+        bench_jobs();
+        bench_archive();
+        bench_random();
+        bench_audio();
+        bench_demo_frame(screen, false);
+        bench_demo_frame(screen, true);
+
+        json = to_json(SDL_getenv("SDL_VIDEODRIVER") ? SDL_getenv("SDL_VIDEODRIVER") : "", SDL_getenv("SDL_RENDER_DRIVER") ? SDL_getenv("SDL_RENDER_DRIVER") : "");
+    }
+
+    cgame::quit();
+
+    if (outPath.empty())
+    {
+        std::cout << json;
+    }
+    else
+    {
+        std::ofstream out(outPath);
+        out << json;
+        std::cerr << "wrote " << outPath << std::endl;
+    }
+
+    return 0;
+}
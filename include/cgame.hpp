@@ -5,6 +5,43 @@
 #include <random>
 #include <vector>
 #include <algorithm>
+#include <cmath>
+#include <unordered_set>
+#include <unordered_map>
+#include <memory>
+#include <functional>
+#include <string>
+#include <deque>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstring>
+#include <cstdio>
+#include <new>
+
+#if defined(_WIN32)
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#if !defined(CGAME_NO_SIMD) && defined(__AVX2__)
+#define CGAME_AVX2 1
+#include <immintrin.h>
+#elif !defined(CGAME_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define CGAME_SSE2 1
+#include <emmintrin.h>
+#endif
 
 #include <SDL.h>
 #include <SDL_image.h>
@@ -26,20 +63,88 @@ namespace cgame
         }
     };
 
+    namespace math
+    {
+        constexpr float PI = 3.14159265358979323846f;
+
+        constexpr float radians(float degrees) { return degrees * (PI / 180.0f); }
+        constexpr float degrees(float radians) { return radians * (180.0f / PI); }
+        constexpr float lerp(float a, float b, float t) { return a + (b - a) * t; }
+        constexpr float clamp(float v, float lo, float hi) { return v < lo ? lo : (v > hi ? hi : v); }
+
+        // Wraps an angle in degrees to (-180, 180].
+        inline float wrap_angle(float degrees)
+        {
+            degrees = std::fmod(degrees + 180.0f, 360.0f);
+            if (degrees <= 0.0f)
+                degrees += 360.0f;
+            return degrees - 180.0f;
+        }
+    }
+
     struct Vec2
     {
         float x, y;
 
-        Vec2() : x(0), y(0) { }
-        Vec2(float _x, float _y) : x(_x), y(_y) { }
+        constexpr Vec2() : x(0), y(0) { }
+        constexpr Vec2(float _x, float _y) : x(_x), y(_y) { }
+
+        constexpr Vec2 operator+(const Vec2& o) const { return { x + o.x, y + o.y }; }
+        constexpr Vec2 operator-(const Vec2& o) const { return { x - o.x, y - o.y }; }
+        constexpr Vec2 operator*(float s) const { return { x * s, y * s }; }
+        constexpr Vec2 operator/(float s) const { return { x / s, y / s }; }
+        constexpr Vec2 operator*(const Vec2& o) const { return { x * o.x, y * o.y }; }
+        constexpr Vec2 operator-() const { return { -x, -y }; }
+        constexpr bool operator==(const Vec2& o) const { return x == o.x && y == o.y; }
+        constexpr bool operator!=(const Vec2& o) const { return !(*this == o); }
+
+        Vec2& operator+=(const Vec2& o) { x += o.x; y += o.y; return *this; }
+        Vec2& operator-=(const Vec2& o) { x -= o.x; y -= o.y; return *this; }
+        Vec2& operator*=(float s) { x *= s; y *= s; return *this; }
+        Vec2& operator/=(float s) { x /= s; y /= s; return *this; }
+
+        constexpr float dot(const Vec2& o) const { return x * o.x + y * o.y; }
+        constexpr float cross(const Vec2& o) const { return x * o.y - y * o.x; }
+        constexpr float length_squared() const { return x * x + y * y; }
+        constexpr Vec2 lerp(const Vec2& o, float t) const { return { math::lerp(x, o.x, t), math::lerp(y, o.y, t) }; }
+        constexpr Vec2 perpendicular() const { return { -y, x }; }
+
+        float length() const { return std::sqrt(length_squared()); }
+        float distance_to(const Vec2& o) const { return (o - *this).length(); }
+
+        Vec2 normalize() const
+        {
+            float len = length();
+            return len > 0.0f ? Vec2(x / len, y / len) : Vec2();
+        }
+
+        // Angles are in degrees, like SDL's rotation and pygame's Vector2.
+        float angle() const { return math::degrees(std::atan2(y, x)); }
+        float angle_to(const Vec2& o) const { return math::wrap_angle(o.angle() - angle()); }
+
+        Vec2 rotate(float degrees) const
+        {
+            float rad = math::radians(degrees);
+            float c = std::cos(rad), s = std::sin(rad);
+            return { x * c - y * s, x * s + y * c };
+        }
+
+        static Vec2 from_angle(float degrees, float length = 1.0f)
+        {
+            float rad = math::radians(degrees);
+            return { std::cos(rad) * length, std::sin(rad) * length };
+        }
     };
 
+    constexpr Vec2 operator*(float s, const Vec2& v) { return v * s; }
+
     struct Rect
     {
         float x, y, w, h;
 
         Rect() : x(0), y(0), w(0), h(0) { }
         Rect(float _x, float _y, float _w, float _h) : x(_x), y(_y), w(_w), h(_h) { } 
+        Rect(Vec2 pos, Vec2 size) : x(pos.x), y(pos.y), w(size.x), h(size.y) { }
 
         Rect copy()
         {
@@ -62,16 +167,37 @@ namespace cgame
             };
         }
 
-        bool colliderect(const Rect &other)
+        bool colliderect(const Rect &other) const
         {
             return !(x + w <= other.x || other.x + other.w <= x || y + h <= other.y || other.y + other.h <= y);
         }
 
-        bool collidepoint(float px, float py)
+        bool collidepoint(float px, float py) const
         {
             return (px >= x && px <= x + w && py >= y && py <= y + h);
         }
 
+        int collidelist(const std::vector<Rect>& rects) const
+        {
+            for (size_t i = 0; i < rects.size(); i++)
+            {
+                if (colliderect(rects[i]))
+                    return static_cast<int>(i);
+            }
+            return -1;
+        }
+
+        std::vector<int> collidelistall(const std::vector<Rect>& rects) const
+        {
+            std::vector<int> result;
+            for (size_t i = 0; i < rects.size(); i++)
+            {
+                if (colliderect(rects[i]))
+                    result.push_back(static_cast<int>(i));
+            }
+            return result;
+        }
+
         float left() const { return x; }
         float right() const { return x + w; }
         float top() const { return y; }
@@ -79,6 +205,9 @@ namespace cgame
         float centerx() const { return x + w / 2; }
         float centery() const { return y + h / 2; }
         std::pair<float, float> center() const { return {centerx(), centery()}; }
+        Vec2 get_pos() const { return { x, y }; }
+        Vec2 get_size() const { return { w, h }; }
+        Vec2 get_center() const { return { centerx(), centery() }; }
 
         void set_left(float val) { x = val; }
         void set_right(float val) { x = val - w; }
@@ -91,8 +220,171 @@ namespace cgame
             set_centerx(cx);
             set_centery(cy);
         }
+        void move(Vec2 offset) { x += offset.x; y += offset.y; }
     };
 
+    namespace math
+    {
+        // 2D affine transform: x' = a * x + c * y + tx, y' = b * x + d * y + ty.
+        struct Transform
+        {
+            float a = 1, b = 0, c = 0, d = 1, tx = 0, ty = 0;
+
+            constexpr Transform() = default;
+            constexpr Transform(float _a, float _b, float _c, float _d, float _tx, float _ty)
+                : a(_a), b(_b), c(_c), d(_d), tx(_tx), ty(_ty) { }
+
+            static constexpr Transform identity() { return {}; }
+            static constexpr Transform translation(float x, float y) { return { 1, 0, 0, 1, x, y }; }
+            static constexpr Transform translation(Vec2 v) { return translation(v.x, v.y); }
+            static constexpr Transform scaling(float sx, float sy) { return { sx, 0, 0, sy, 0, 0 }; }
+
+            static Transform rotation(float degrees)
+            {
+                float rad = radians(degrees);
+                float cs = std::cos(rad), sn = std::sin(rad);
+                return { cs, sn, -sn, cs, 0, 0 };
+            }
+
+            // Scale, then rotate around the origin, then translate -- the usual sprite order.
+            static Transform compose(Vec2 position, float degrees, Vec2 scale = { 1, 1 })
+            {
+                return translation(position) * rotation(degrees) * scaling(scale.x, scale.y);
+            }
+
+            // (this * o) applies o first.
+            constexpr Transform operator*(const Transform& o) const
+            {
+                return {
+                    a * o.a + c * o.b, b * o.a + d * o.b,
+                    a * o.c + c * o.d, b * o.c + d * o.d,
+                    a * o.tx + c * o.ty + tx, b * o.tx + d * o.ty + ty
+                };
+            }
+
+            constexpr Vec2 apply(Vec2 p) const { return { a * p.x + c * p.y + tx, b * p.x + d * p.y + ty }; }
+            constexpr Vec2 apply_vector(Vec2 v) const { return { a * v.x + c * v.y, b * v.x + d * v.y }; }
+            constexpr float determinant() const { return a * d - b * c; }
+
+            constexpr Transform inverse() const
+            {
+                float det = determinant();
+                if (det == 0.0f)
+                    return {};
+
+                float ia = d / det, ib = -b / det, ic = -c / det, id = a / det;
+                return { ia, ib, ic, id, -(ia * tx + ic * ty), -(ib * tx + id * ty) };
+            }
+
+            void corners(const Rect& r, Vec2* out) const
+            {
+                out[0] = apply({ r.x, r.y });
+                out[1] = apply({ r.x + r.w, r.y });
+                out[2] = apply({ r.x + r.w, r.y + r.h });
+                out[3] = apply({ r.x, r.y + r.h });
+            }
+
+            // Axis-aligned bounds of the transformed rect.
+            Rect apply_rect(const Rect& r) const
+            {
+                Vec2 p[4];
+                corners(r, p);
+                float x0 = std::min(std::min(p[0].x, p[1].x), std::min(p[2].x, p[3].x));
+                float y0 = std::min(std::min(p[0].y, p[1].y), std::min(p[2].y, p[3].y));
+                float x1 = std::max(std::max(p[0].x, p[1].x), std::max(p[2].x, p[3].x));
+                float y1 = std::max(std::max(p[0].y, p[1].y), std::max(p[2].y, p[3].y));
+                return { x0, y0, x1 - x0, y1 - y0 };
+            }
+        };
+
+        static_assert(sizeof(Vec2) == 2 * sizeof(float), "Vec2 arrays are processed as packed floats");
+
+        inline void transform_points_scalar(const Transform& t, const Vec2* in, Vec2* out, size_t count)
+        {
+            for (size_t i = 0; i < count; i++)
+                out[i] = t.apply(in[i]);
+        }
+
+        // in and out may alias.
+        inline void transform_points(const Transform& t, const Vec2* in, Vec2* out, size_t count)
+        {
+            size_t i = 0;
+            const float* src = reinterpret_cast<const float*>(in);
+            float* dst = reinterpret_cast<float*>(out);
+#if defined(CGAME_AVX2)
+            const __m256 ab = _mm256_setr_ps(t.a, t.b, t.a, t.b, t.a, t.b, t.a, t.b);
+            const __m256 cd = _mm256_setr_ps(t.c, t.d, t.c, t.d, t.c, t.d, t.c, t.d);
+            const __m256 tt = _mm256_setr_ps(t.tx, t.ty, t.tx, t.ty, t.tx, t.ty, t.tx, t.ty);
+            for (; i + 4 <= count; i += 4)
+            {
+                __m256 p = _mm256_loadu_ps(src + i * 2);
+                __m256 xx = _mm256_permute_ps(p, _MM_SHUFFLE(2, 2, 0, 0));
+                __m256 yy = _mm256_permute_ps(p, _MM_SHUFFLE(3, 3, 1, 1));
+                _mm256_storeu_ps(dst + i * 2, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(xx, ab), _mm256_mul_ps(yy, cd)), tt));
+            }
+#elif defined(CGAME_SSE2)
+            const __m128 ab = _mm_setr_ps(t.a, t.b, t.a, t.b);
+            const __m128 cd = _mm_setr_ps(t.c, t.d, t.c, t.d);
+            const __m128 tt = _mm_setr_ps(t.tx, t.ty, t.tx, t.ty);
+            for (; i + 2 <= count; i += 2)
+            {
+                __m128 p = _mm_loadu_ps(src + i * 2);
+                __m128 xx = _mm_shuffle_ps(p, p, _MM_SHUFFLE(2, 2, 0, 0));
+                __m128 yy = _mm_shuffle_ps(p, p, _MM_SHUFFLE(3, 3, 1, 1));
+                _mm_storeu_ps(dst + i * 2, _mm_add_ps(_mm_add_ps(_mm_mul_ps(xx, ab), _mm_mul_ps(yy, cd)), tt));
+            }
+#endif
+            (void)src;
+            (void)dst;
+            transform_points_scalar(t, in + i, out + i, count - i);
+        }
+
+        // Structure-of-arrays variant, e.g. for RectArray positions.
+        inline void transform_points(const Transform& t, const float* xs, const float* ys, float* outX, float* outY, size_t count)
+        {
+            size_t i = 0;
+#if defined(CGAME_AVX2)
+            const __m256 va = _mm256_set1_ps(t.a), vb = _mm256_set1_ps(t.b), vc = _mm256_set1_ps(t.c);
+            const __m256 vd = _mm256_set1_ps(t.d), vtx = _mm256_set1_ps(t.tx), vty = _mm256_set1_ps(t.ty);
+            for (; i + 8 <= count; i += 8)
+            {
+                __m256 x = _mm256_loadu_ps(xs + i), y = _mm256_loadu_ps(ys + i);
+                _mm256_storeu_ps(outX + i, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(va, x), _mm256_mul_ps(vc, y)), vtx));
+                _mm256_storeu_ps(outY + i, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(vb, x), _mm256_mul_ps(vd, y)), vty));
+            }
+#elif defined(CGAME_SSE2)
+            const __m128 va = _mm_set1_ps(t.a), vb = _mm_set1_ps(t.b), vc = _mm_set1_ps(t.c);
+            const __m128 vd = _mm_set1_ps(t.d), vtx = _mm_set1_ps(t.tx), vty = _mm_set1_ps(t.ty);
+            for (; i + 4 <= count; i += 4)
+            {
+                __m128 x = _mm_loadu_ps(xs + i), y = _mm_loadu_ps(ys + i);
+                _mm_storeu_ps(outX + i, _mm_add_ps(_mm_add_ps(_mm_mul_ps(va, x), _mm_mul_ps(vc, y)), vtx));
+                _mm_storeu_ps(outY + i, _mm_add_ps(_mm_add_ps(_mm_mul_ps(vb, x), _mm_mul_ps(vd, y)), vty));
+            }
+#endif
+            for (; i < count; i++)
+            {
+                float x = xs[i], y = ys[i];
+                outX[i] = t.a * x + t.c * y + t.tx;
+                outY[i] = t.b * x + t.d * y + t.ty;
+            }
+        }
+
+        // Four corners per rect (top-left, top-right, bottom-right, bottom-left), ready for geometry submission.
+        inline void transform_corners(const Transform& t, const Rect* rects, size_t count, Vec2* out)
+        {
+            for (size_t i = 0; i < count; i++)
+            {
+                const Rect& r = rects[i];
+                out[i * 4 + 0] = { r.x, r.y };
+                out[i * 4 + 1] = { r.x + r.w, r.y };
+                out[i * 4 + 2] = { r.x + r.w, r.y + r.h };
+                out[i * 4 + 3] = { r.x, r.y + r.h };
+            }
+            transform_points(t, out, out, count * 4);
+        }
+    }
+
     inline void init()
     {
         if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO) < 0)
@@ -111,547 +403,9004 @@ namespace cgame
             std::cerr << "Mix_OpenAudio failed: " << Mix_GetError() << std::endl;
     }
 
-    class Surface
+    // Zones are compiled in only with CGAME_PROFILE defined; otherwise CGAME_PROFILE_ZONE expands to nothing.
+    namespace profiler
     {
-    public:
-        Surface(SDL_Renderer* _renderer, float _width, float _height)
-            : renderer(_renderer), width(_width), height(_height), x(0), y(0)
-        {
-            surfaceTex = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_TARGET, width, height);
-            rect = { x, y, width, height };
-        }
-
-        Surface(SDL_Renderer* _renderer, SDL_Texture* _existing)
-            : renderer(_renderer), surfaceTex(_existing), x(0), y(0)
+        struct ZoneEvent
         {
-            int texW = 0, texH = 0;
-            SDL_QueryTexture(_existing, nullptr, nullptr, &texW, &texH);
-            width = static_cast<float>(texW);
-            height = static_cast<float>(texH);
-            rect = { x, y, width, height };
-        }
+            const char* name;
+            Uint64 start;
+            Uint64 end;
+        };
 
-        ~Surface()
+        // Written only by its own thread; a full ring overwrites its oldest events.
+        class ThreadBuffer
         {
-            SDL_DestroyTexture(surfaceTex);
-        }
+        public:
+            static constexpr size_t CAPACITY = 1 << 16;
 
-        void fill(Color color = { 0, 0, 0, 255 })
-        {
-            SDL_Texture* oldTarget = SDL_GetRenderTarget(renderer);
-            SDL_SetRenderTarget(renderer, surfaceTex);
-            SDL_SetRenderDrawColor(renderer, color.r, color.g, color.b, color.a);
-            SDL_RenderClear(renderer);
-            SDL_SetRenderTarget(renderer, oldTarget);
-        }
+            explicit ThreadBuffer(int _threadId)
+                : threadId(_threadId), events(new ZoneEvent[CAPACITY]) { }
 
-        void blit(Surface& surface, float _x, float _y, Rect srcRect)
-        {
-            x = _x;
-            y = _y;
+            void push(const char* name, Uint64 start, Uint64 end)
+            {
+                Uint64 h = head.load(std::memory_order_relaxed);
+                events[h & (CAPACITY - 1)] = { name, start, end };
+                head.store(h + 1, std::memory_order_release);
+            }
 
-            SDL_FPoint center = { width / 2, height / 2 };
-            SDL_FRect dst = { _x, _y, srcRect.w, srcRect.h };
-            SDL_RendererFlip flipMode = surface.is_flip() ? SDL_FLIP_HORIZONTAL : SDL_FLIP_NONE;
-            SDL_Rect src = { (int)srcRect.x, (int)srcRect.y, (int)srcRect.w, (int)srcRect.h };
+            template <typename Fn>
+            void for_each(Fn fn) const
+            {
+                Uint64 h = head.load(std::memory_order_acquire);
+                Uint64 first = h > CAPACITY ? h - CAPACITY : 0;
+                for (Uint64 i = first; i < h; i++)
+                    fn(events[i & (CAPACITY - 1)]);
+            }
 
-            SDL_Texture* previousTarget = SDL_GetRenderTarget(renderer);
-            SDL_SetRenderTarget(renderer, surfaceTex);   
-            SDL_SetTextureScaleMode(surface.get_surface(), SDL_ScaleModeNearest);
-            SDL_RenderCopyExF(renderer, surface.get_surface(), &src, &dst, surface.get_rotation(), NULL, flipMode);
-            SDL_SetRenderTarget(renderer, previousTarget);
-        }
+            int get_thread_id() const { return threadId; }
 
-        void blit(Surface& surface, float _x, float _y)
-        {   
-            blit(surface, _x, _y, {0, 0, surface.get_width(), surface.get_height()});
-        }
+        private:
+            int threadId;
+            std::unique_ptr<ZoneEvent[]> events;
+            std::atomic<Uint64> head{ 0 };
+        };
 
-        void blit(Surface& surface, Rect _rect)
+        struct State
         {
-            blit(surface, _rect.x, _rect.y);
-        }
+            std::mutex mutex;
+            std::vector<std::shared_ptr<ThreadBuffer>> buffers;
+            std::atomic<bool> capturing{ false };
+            Uint64 captureStart = 0;
+            Uint64 captureEnd = 0;
+        };
 
-        void set_alpha(float alpha)
-        {
-            alpha = std::clamp(alpha, 0.0f, 255.0f) / 255.0f;
-            SDL_SetTextureAlphaMod(surfaceTex, static_cast<Uint8>(alpha * 255.0f + 0.5f));
-        }
+        static State state;
 
-        void set_color(Color color = { 255, 255, 255 })
+        inline ThreadBuffer& local_buffer()
         {
-            SDL_SetTextureColorMod(surfaceTex, color.r, color.g, color.b);
+            thread_local std::shared_ptr<ThreadBuffer> buffer;
+            if (!buffer)
+            {
+                std::lock_guard<std::mutex> lock(state.mutex);
+                buffer = std::make_shared<ThreadBuffer>(static_cast<int>(state.buffers.size()));
+                state.buffers.push_back(buffer);
+            }
+            return *buffer;
         }
 
-        void set_width(float _width) { rect.w = _width; }
-        void set_height(float _height) { rect.h = _height; }
-        void set_rotation(float _rotation) { rotation = _rotation; }
-        void set_flip(bool _flip) { flip = _flip; }
-
-        SDL_Texture* get_surface() const { return surfaceTex; }
-        float get_width() const { return rect.w; }
-        float get_height() const { return rect.h; }
-        float get_rotation() const { return rotation; }
-        bool is_flip() const { return flip; }
-        Rect get_rect(float _x = 0, float _y = 0)
+        inline bool is_capturing()
         {
-            rect.x = _x;
-            rect.y = _y;
-            return rect;
+            return state.capturing.load(std::memory_order_relaxed);
         }
 
-    private:
-        SDL_Renderer* renderer; 
-        SDL_Texture* surfaceTex; 
-        
-        float x, y;
-        float width, height;      
-        float rotation = 0.0f;
-        bool flip = false;
-        Rect rect; 
-    };
-
-    namespace transform
-    {
-        inline Surface& scale(Surface& surface, float newWidth, float newHeight)
+        inline void begin_capture()
         {
-            surface.set_width(newWidth);
-            surface.set_height(newHeight);
-            return surface;
+            state.captureStart = SDL_GetPerformanceCounter();
+            state.captureEnd = 0;
+            state.capturing.store(true, std::memory_order_release);
         }
 
-        inline Surface& rotate(Surface& surface, float newRotation)
+        inline void end_capture()
         {
-            surface.set_rotation(newRotation);
-            return surface;
+            state.capturing.store(false, std::memory_order_release);
+            state.captureEnd = SDL_GetPerformanceCounter();
         }
 
-        inline Surface& flip(Surface& surface, bool flip)
+        class Zone
         {
-            surface.set_flip(flip);
-            return surface;
-        }
-    }
+        public:
+            explicit Zone(const char* _name)
+                : name(_name), start(is_capturing() ? SDL_GetPerformanceCounter() : 0) { }
 
-    namespace image
-    {
-        inline Surface load(SDL_Renderer* renderer, std::string filePath)
-        {
-            SDL_Texture* imgTex = IMG_LoadTexture(renderer, filePath.c_str());
-            if (imgTex == NULL)
+            ~Zone()
             {
-                std::cerr << "Failed to load image " << filePath << " Error: " << IMG_GetError() << std::endl;
+                if (start != 0)
+                    local_buffer().push(name, start, SDL_GetPerformanceCounter());
             }
-    
-            return Surface(renderer, imgTex);
-        }
-    }
 
-    class Window
-    {
-    public:
-        Window(int width, int height, std::string title)
-            : m_width(width), m_height(height), m_title(title)
+            Zone(const Zone&) = delete;
+            Zone& operator=(const Zone&) = delete;
+
+        private:
+            const char* name;
+            Uint64 start;
+        };
+
+        // Writes the last capture as Chrome trace-event JSON (chrome://tracing, Perfetto).
+        // Call after end_capture().
+        inline bool export_chrome_trace(const std::string& filePath)
         {
-            m_window = SDL_CreateWindow(title.c_str(), SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, width, height, SDL_WINDOW_SHOWN);
-            if (m_window == NULL)
+            FILE* file = std::fopen(filePath.c_str(), "w");
+            if (!file)
             {
-                std::cerr << "Failed to create window. Error: " << SDL_GetError() << std::endl;
+                std::cerr << "Failed to open trace file " << filePath << std::endl;
+                return false;
             }
 
-            m_renderer = SDL_CreateRenderer(m_window, -1, SDL_RENDERER_ACCELERATED);
-            if (m_renderer == NULL)
+            double toMicros = 1000000.0 / static_cast<double>(SDL_GetPerformanceFrequency());
+            Uint64 from = state.captureStart;
+            Uint64 to = state.captureEnd ? state.captureEnd : SDL_GetPerformanceCounter();
+
+            std::vector<std::shared_ptr<ThreadBuffer>> buffers;
             {
-                std::cerr << "Failed to create renderer. Error: " << SDL_GetError() << std::endl;
+                std::lock_guard<std::mutex> lock(state.mutex);
+                buffers = state.buffers;
             }
 
-            SDL_SetRenderDrawBlendMode(m_renderer, SDL_BLENDMODE_BLEND);
+            std::fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[", file);
+            bool first = true;
+            for (const auto& buffer : buffers)
+            {
+                int tid = buffer->get_thread_id();
+                buffer->for_each([&](const ZoneEvent& e)
+                {
+                    if (e.start < from || e.end > to)
+                        return;
 
-            screenSurface = new Surface(m_renderer, m_width, m_height);
+                    std::string name;
+                    for (const char* c = e.name; *c; c++)
+                    {
+                        if (*c == '"' || *c == '\\')
+                            name += '\\';
+                        name += *c;
+                    }
+
+                    std::fprintf(file, "%s\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+                                 first ? "" : ",", name.c_str(), tid, (e.start - from) * toMicros, (e.end - e.start) * toMicros);
+                    first = false;
+                });
+            }
+            std::fputs("\n]}\n", file);
+            std::fclose(file);
+            return true;
         }
+    }
 
-        ~Window()
+#define CGAME_PROFILE_CONCAT_INNER(a, b) a##b
+#define CGAME_PROFILE_CONCAT(a, b) CGAME_PROFILE_CONCAT_INNER(a, b)
+#if defined(CGAME_PROFILE)
+#define CGAME_PROFILE_ZONE(name) ::cgame::profiler::Zone CGAME_PROFILE_CONCAT(cgameProfileZone, __LINE__)(name)
+#else
+#define CGAME_PROFILE_ZONE(name) ((void)0)
+#endif
+
+    // A shared worker pool. Each worker owns a deque: it pushes and pops at the back, idle workers
+    // steal from the front of the others. Threads that aren't workers submit through a shared
+    // queue and help run jobs while they wait.
+    namespace jobs
+    {
+        class Counter;
+
+        struct Job
         {
-            delete screenSurface;
-            SDL_DestroyRenderer(m_renderer);
-            SDL_DestroyWindow(m_window);
-        }
+            std::function<void()> fn;
+            Counter* counter = NULL;
+        };
 
-        void begin_frame(Color color = { 0, 0, 0, 255 })
+        // Counts unfinished jobs. Jobs queued with run_after start once it drops to zero.
+        class Counter
         {
-            SDL_SetRenderDrawColor(m_renderer, color.r, color.g, color.b, color.a);
-            SDL_RenderClear(m_renderer);
+        public:
+            Counter() = default;
+            Counter(const Counter&) = delete;
+            Counter& operator=(const Counter&) = delete;
 
-            SDL_FRect dst = { 0, 0, screenSurface->get_width(), screenSurface->get_height() };
-            SDL_RenderCopyF(m_renderer, screenSurface->get_surface(), NULL, &dst);
-        }
+            void add(int n = 1) { value.fetch_add(n, std::memory_order_relaxed); }
+            int get() const { return value.load(std::memory_order_acquire); }
+            bool is_done() const { return get() == 0; }
 
-        void blit(Surface& surface, float x, float y)
-        {
-            screenSurface->blit(surface, x, y);
-        }
+        private:
+            friend class JobSystem;
 
-        void end_frame()
+            std::atomic<int> value{ 0 };
+            std::mutex mutex;
+            std::vector<Job> continuations;
+        };
+
+        // Static initialization runs on the thread that enters main().
+        static const std::thread::id mainThread = std::this_thread::get_id();
+
+        inline bool is_main_thread()
         {
-            SDL_RenderPresent(m_renderer);
+            return std::this_thread::get_id() == mainThread;
         }
 
-        void set_title(std::string title)
+        class JobSystem
         {
-            SDL_SetWindowTitle(m_window, title.c_str());
-        }
+        public:
+            JobSystem() = default;
+            JobSystem(const JobSystem&) = delete;
+            JobSystem& operator=(const JobSystem&) = delete;
 
-        SDL_Renderer* get_renderer() { return m_renderer; }
-        SDL_Window* get_window() { return m_window; }
-        int get_width() { return m_width; }
-        int get_height() { return m_height; }
-        std::string get_title() { return m_title; }
+            ~JobSystem()
+            {
+                stop();
+            }
 
-    private:
-        SDL_Renderer* m_renderer;
-        SDL_Window* m_window;
-        Surface* screenSurface;
+            // Starts threadCount workers, or one per core but the caller's when 0. Called
+            // implicitly by the first submission.
+            void start(int threadCount = 0)
+            {
+                std::lock_guard<std::mutex> lock(lifecycle);
+                if (running.load(std::memory_order_acquire))
+                    return;
 
-        int m_width, m_height;
-        std::string m_title;
-    };
+                if (threadCount <= 0)
+                    threadCount = std::max(1, static_cast<int>(std::thread::hardware_concurrency()) - 1);
 
-    namespace display
-    {
-        static Window* window = nullptr;
+                stopping = false;
+                queues.clear();
+                for (int i = 0; i <= threadCount; i++)
+                    queues.push_back(std::make_unique<Queue>());
 
-        inline Window& set_mode(int width, int height)
+                for (int i = 0; i < threadCount; i++)
+                    threads.emplace_back([this, i]() { work(i); });
+                running.store(true, std::memory_order_release);
+            }
+
+            // Finishes queued jobs, then joins the workers.
+            void stop()
+            {
+                std::lock_guard<std::mutex> lock(lifecycle);
+                if (!running.load(std::memory_order_acquire))
+                    return;
+
+                {
+                    std::lock_guard<std::mutex> sleepLock(sleepMutex);
+                    stopping = true;
+                }
+                sleep.notify_all();
+                for (std::thread& thread : threads)
+                    thread.join();
+                threads.clear();
+                running.store(false, std::memory_order_release);
+            }
+
+            int get_worker_count()
+            {
+                ensure_started();
+                return static_cast<int>(threads.size());
+            }
+
+            void run(std::function<void()> fn, Counter* counter = NULL)
+            {
+                if (counter)
+                    counter->add();
+                push({ std::move(fn), counter });
+            }
+
+            // Runs fn once dependency reaches zero. counter counts it from now, not from when it starts.
+            void run_after(Counter& dependency, std::function<void()> fn, Counter* counter = NULL)
+            {
+                if (counter)
+                    counter->add();
+
+                {
+                    std::lock_guard<std::mutex> lock(dependency.mutex);
+                    if (!dependency.is_done())
+                    {
+                        dependency.continuations.push_back({ std::move(fn), counter });
+                        return;
+                    }
+                }
+                push({ std::move(fn), counter });
+            }
+
+            // Runs other jobs (and main-thread jobs, on the main thread) until counter is done.
+            void wait(Counter& counter)
+            {
+                CGAME_PROFILE_ZONE("jobs::wait");
+                bool onMain = is_main_thread();
+                int self = worker_index();
+                while (!counter.is_done())
+                {
+                    if (onMain)
+                        pump_main();
+
+                    Job job;
+                    if (running.load(std::memory_order_acquire) && pop(self, job))
+                        execute(job);
+                    else
+                        std::this_thread::yield();
+                }
+                std::lock_guard<std::mutex> lock(counter.mutex);
+            }
+
+            // Calls fn(first, last) over [begin, end) in chunks of at least grain indices, including
+            // on the calling thread, and returns when all chunks are done.
+            template<typename Fn>
+            void parallel_for(size_t begin, size_t end, size_t grain, Fn&& fn)
+            {
+                if (end <= begin)
+                    return;
+
+                size_t count = end - begin;
+                size_t workers = static_cast<size_t>(get_worker_count());
+                size_t chunk = std::max<size_t>(std::max<size_t>(grain, 1), (count + workers * 4 - 1) / (workers * 4));
+                if (count <= chunk)
+                {
+                    fn(begin, end);
+                    return;
+                }
+
+                Counter counter;
+                for (size_t first = begin + chunk; first < end; first += chunk)
+                {
+                    size_t last = std::min(first + chunk, end);
+                    run([&fn, first, last]() { fn(first, last); }, &counter);
+                }
+                fn(begin, begin + chunk);
+                wait(counter);
+            }
+
+            // Queues fn for the main thread; it runs in pump_main(), which Window::end_frame calls.
+            void run_on_main(std::function<void()> fn, Counter* counter = NULL)
+            {
+                if (counter)
+                    counter->add();
+
+                std::lock_guard<std::mutex> lock(mainMutex);
+                mainJobs.push_back({ std::move(fn), counter });
+            }
+
+            int pump_main()
+            {
+                if (!is_main_thread())
+                    return 0;
+
+                // A local batch: a job that waits pumps again, which must not touch this one.
+                std::vector<Job> running;
+                {
+                    std::lock_guard<std::mutex> lock(mainMutex);
+                    if (mainJobs.empty())
+                        return 0;
+                    running.swap(mainJobs);
+                }
+
+                for (Job& job : running)
+                    execute(job);
+                return static_cast<int>(running.size());
+            }
+
+        private:
+            struct Queue
+            {
+                std::mutex mutex;
+                std::deque<Job> jobs;
+            };
+
+            void ensure_started()
+            {
+                if (!running.load(std::memory_order_acquire))
+                    start();
+            }
+
+            // This thread's own queue, or the shared one (the last) for threads outside the pool.
+            int worker_index() const
+            {
+                return currentSystem == this ? currentWorker : static_cast<int>(queues.size()) - 1;
+            }
+
+            void push(Job job)
+            {
+                ensure_started();
+                Queue& queue = *queues[worker_index()];
+                {
+                    std::lock_guard<std::mutex> lock(queue.mutex);
+                    queue.jobs.push_back(std::move(job));
+                }
+                queued.fetch_add(1, std::memory_order_release);
+
+                {
+                    std::lock_guard<std::mutex> sleepLock(sleepMutex);
+                }
+                sleep.notify_one();
+            }
+
+            // Own queue newest-first, then the shared queue, then the oldest job of another worker.
+            bool pop(int self, Job& out)
+            {
+                if (queued.load(std::memory_order_acquire) == 0)
+                    return false;
+
+                int count = static_cast<int>(queues.size());
+                int shared = count - 1;
+                if (self != shared && take(*queues[self], out, true))
+                    return true;
+                if (take(*queues[shared], out, false))
+                    return true;
+
+                int start = static_cast<int>(stealSeed.fetch_add(1, std::memory_order_relaxed) % static_cast<unsigned>(shared));
+                for (int k = 0; k < shared; k++)
+                {
+                    int victim = (start + k) % shared;
+                    if (victim != self && take(*queues[victim], out, false))
+                        return true;
+                }
+                return false;
+            }
+
+            bool take(Queue& queue, Job& out, bool newest)
+            {
+                std::lock_guard<std::mutex> lock(queue.mutex);
+                if (queue.jobs.empty())
+                    return false;
+
+                if (newest)
+                {
+                    out = std::move(queue.jobs.back());
+                    queue.jobs.pop_back();
+                }
+                else
+                {
+                    out = std::move(queue.jobs.front());
+                    queue.jobs.pop_front();
+                }
+                queued.fetch_sub(1, std::memory_order_acq_rel);
+                return true;
+            }
+
+            void execute(Job& job)
+            {
+                job.fn();
+                if (job.counter)
+                    finish(*job.counter);
+            }
+
+            // The decrement happens under the counter's lock so a waiter that sees zero (and then
+            // takes the lock) knows nothing touches the counter afterwards and may destroy it.
+            void finish(Counter& counter)
+            {
+                std::vector<Job> ready;
+                {
+                    std::lock_guard<std::mutex> lock(counter.mutex);
+                    if (counter.value.fetch_sub(1, std::memory_order_acq_rel) == 1)
+                        ready.swap(counter.continuations);
+                }
+                for (Job& job : ready)
+                    push(std::move(job));
+            }
+
+            void work(int index)
+            {
+                currentSystem = this;
+                currentWorker = index;
+
+                while (true)
+                {
+                    Job job;
+                    if (pop(index, job))
+                    {
+                        execute(job);
+                        continue;
+                    }
+
+                    std::unique_lock<std::mutex> lock(sleepMutex);
+                    sleep.wait(lock, [this]() { return stopping || queued.load(std::memory_order_acquire) > 0; });
+                    if (stopping && queued.load(std::memory_order_acquire) == 0)
+                        return;
+                }
+            }
+
+            static inline thread_local JobSystem* currentSystem = NULL;
+            static inline thread_local int currentWorker = 0;
+
+            std::mutex lifecycle;
+            std::atomic<bool> running{ false };
+            std::vector<std::unique_ptr<Queue>> queues;
+            std::vector<std::thread> threads;
+            std::atomic<int> queued{ 0 };
+            std::atomic<unsigned> stealSeed{ 0 };
+
+            std::mutex sleepMutex;
+            std::condition_variable sleep;
+            bool stopping = false;
+
+            std::mutex mainMutex;
+            std::vector<Job> mainJobs;
+        };
+
+        static JobSystem jobSystem;
+
+        inline void start(int threadCount = 0)
         {
-            window = new Window(width, height, "cgame window");
-            return *window;
+            jobSystem.start(threadCount);
         }
 
-        inline void set_caption(std::string caption)
+        inline void stop()
         {
-            if (window)
-            {
-                window->set_title(caption);
-            }
+            jobSystem.stop();
         }
 
-        inline int get_width()
+        inline int get_worker_count()
         {
-            return window->get_width();
+            return jobSystem.get_worker_count();
         }
 
-        inline int get_height()
+        inline void run(std::function<void()> fn, Counter* counter = NULL)
         {
-            return window->get_height();
+            jobSystem.run(std::move(fn), counter);
         }
 
-        inline Vec2 get_size()
+        inline void run_after(Counter& dependency, std::function<void()> fn, Counter* counter = NULL)
         {
-            return { (float)window->get_width(), (float)window->get_height() };
+            jobSystem.run_after(dependency, std::move(fn), counter);
         }
 
-        inline SDL_Renderer* get_renderer()
+        inline void wait(Counter& counter)
         {
-            return window->get_renderer();
+            jobSystem.wait(counter);
         }
-    }
 
-    namespace draw
-    {
-        inline void rect(Surface& surface, Rect rect, Color color = { 0, 0, 0, 255 })
+        template<typename Fn>
+        void parallel_for(size_t begin, size_t end, size_t grain, Fn&& fn)
         {
-            SDL_Texture* prevTarget = SDL_GetRenderTarget(display::get_renderer());
-            SDL_SetRenderTarget(display::get_renderer(), surface.get_surface());
-            SDL_SetRenderDrawColor(display::get_renderer(), color.r, color.g, color.b, color.a);
-            SDL_FRect sdlRect = rect.to_sdl_frect();
-            SDL_RenderDrawRectF(display::get_renderer(), &sdlRect);
-            SDL_SetRenderTarget(display::get_renderer(), prevTarget);
+            jobSystem.parallel_for(begin, end, grain, std::forward<Fn>(fn));
         }
 
-        inline void fill_rect(Surface& surface, Rect rect, Color color = { 0, 0, 0, 255 })
+        inline void run_on_main(std::function<void()> fn, Counter* counter = NULL)
         {
-            SDL_Texture* prevTarget = SDL_GetRenderTarget(display::get_renderer());
-            SDL_SetRenderTarget(display::get_renderer(), surface.get_surface());
-            SDL_SetRenderDrawColor(display::get_renderer(), color.r, color.g, color.b, color.a);
-            SDL_FRect sdlRect = rect.to_sdl_frect();
-            SDL_RenderFillRectF(display::get_renderer(), &sdlRect);
-            SDL_SetRenderTarget(display::get_renderer(), prevTarget);
+            jobSystem.run_on_main(std::move(fn), counter);
+        }
+
+        inline int pump_main()
+        {
+            return jobSystem.pump_main();
         }
     }
 
-    namespace font
+    namespace batch
     {
-        struct Font
+        enum SortMode
         {
-            std::string filePath;
-            float size;
-            TTF_Font* font;
+            SORT_SUBMISSION,
+            SORT_TEXTURE
+        };
 
-            Font(std::string _filePath, float _size = 12.0f)
-                : filePath(_filePath), size(_size)
+        struct Stats
+        {
+            int quads = 0;
+            int drawCalls = 0;
+            int flushes = 0;
+        };
+
+        class SpriteBatch
+        {
+        public:
+            static constexpr size_t MAX_QUADS = 16384;
+
+            void begin(SDL_Renderer* _renderer, SortMode _sortMode = SORT_SUBMISSION)
             {
-                font = TTF_OpenFont(filePath.c_str(), size);
-                if (!font)
-                {
-                    std::cerr << "Failed to load font " << filePath << " " << TTF_GetError() << std::endl;
-                }
+                flush();
+                renderer = _renderer;
+                sortMode = _sortMode;
+                active = true;
             }
 
-            ~Font()
+            void end()
             {
-                if (font)
-                    TTF_CloseFont(font);
+                flush();
+                active = false;
             }
 
-            Surface render(std::string content, Color color = { 0, 0, 0, 255 })
+            bool is_active() const { return active; }
+
+            bool is_pending(SDL_Texture* texture) const
             {
-                SDL_Surface* fontSurface = TTF_RenderText_Solid(font, content.c_str(), color.to_sdl());
-                if (!fontSurface)
+                if (commands.empty())
+                    return false;
+
+                return is_pending_target(texture) || sources.count(texture) != 0;
+            }
+
+            void quad(SDL_Renderer* _renderer, SDL_Texture* target, SDL_Texture* texture, const SDL_Vertex* quadVertices)
+            {
+                if (_renderer != renderer)
                 {
-                    std::cerr << "Failed to render text surface: " << TTF_GetError() << std::endl;
-                    return Surface(display::get_renderer(), (SDL_Texture*)NULL);
+                    flush();
+                    renderer = _renderer;
                 }
 
-                SDL_Texture* tex = SDL_CreateTextureFromSurface(display::get_renderer(), fontSurface);
-                if (tex == NULL)
+                // Reading a texture that still has queued draws, or drawing into one that queued
+                // draws still read from, needs everything before it on the GPU first.
+                if (texture != NULL && texture != lastSource && is_pending_target(texture))
+                    flush();
+                if (target != lastTarget && sources.count(target) != 0)
+                    flush();
+
+                if (target != lastTarget)
                 {
-                    std::cerr << "Failed to create texture from font surface: " << TTF_GetError() << std::endl;
-                    return Surface(display::get_renderer(), (SDL_Texture*)NULL);
+                    if (!is_pending_target(target))
+                        targets.push_back(target);
+                    lastTarget = target;
+                }
+                if (texture != lastSource)
+                {
+                    sources.insert(texture);
+                    lastSource = texture;
                 }
-                SDL_FreeSurface(fontSurface);
 
-                return Surface(display::get_renderer(), tex);
+                commands.push_back({ target, texture, static_cast<Uint32>(vertices.size()) });
+                vertices.insert(vertices.end(), quadVertices, quadVertices + 4);
+                stats.quads++;
+
+                if (commands.size() >= MAX_QUADS)
+                    flush();
             }
 
-            void set_font_size(float _size)
+            void flush()
             {
-                TTF_SetFontSize(font, static_cast<int>(_size));
-            }
-        };
-    }
+                if (commands.empty())
+                    return;
 
-    namespace mixer
-    {
-        enum LoopMode
-        {
-            LOOP_INFINITE = -1,
-            LOOP_NONE = 0
-        };
+                CGAME_PROFILE_ZONE("batch::flush");
 
-        class Sound
-        {
-        public:
-            Sound(const std::string& filename)
-            {
-                sound = Mix_LoadWAV(filename.c_str());
-                if (!sound)
+                if (sortMode == SORT_TEXTURE)
                 {
-                    std::cerr << "Failed to load sound: " << filename << " Error: " << Mix_GetError() << std::endl;
+                    std::stable_sort(commands.begin(), commands.end(), [](const Command& a, const Command& b)
+                    {
+                        if (a.target != b.target)
+                            return a.target < b.target;
+                        return a.texture < b.texture;
+                    });
+                }
+                else
+                {
+                    std::stable_sort(commands.begin(), commands.end(), [](const Command& a, const Command& b)
+                    {
+                        return a.target < b.target;
+                    });
+                }
+
+                SDL_Texture* previousTarget = SDL_GetRenderTarget(renderer);
+                SDL_Texture* currentTarget = previousTarget;
+
+                size_t runStart = 0;
+                while (runStart < commands.size())
+                {
+                    SDL_Texture* target = commands[runStart].target;
+                    SDL_Texture* texture = commands[runStart].texture;
+
+                    size_t runEnd = runStart + 1;
+                    while (runEnd < commands.size() && commands[runEnd].target == target && commands[runEnd].texture == texture)
+                        runEnd++;
+
+                    int quadCount = static_cast<int>(runEnd - runStart);
+                    runVertices.clear();
+                    for (size_t i = runStart; i < runEnd; i++)
+                    {
+                        const SDL_Vertex* v = &vertices[commands[i].firstVertex];
+                        runVertices.insert(runVertices.end(), v, v + 4);
+                    }
+
+                    while (indices.size() < static_cast<size_t>(quadCount) * 6)
+                    {
+                        int base = static_cast<int>(indices.size() / 6) * 4;
+                        indices.insert(indices.end(), { base, base + 1, base + 2, base + 2, base + 3, base });
+                    }
+
+                    if (target != currentTarget)
+                    {
+                        SDL_SetRenderTarget(renderer, target);
+                        currentTarget = target;
+                    }
+                    if (texture != NULL)
+                        SDL_SetTextureScaleMode(texture, SDL_ScaleModeNearest);
+
+                    SDL_RenderGeometry(renderer, texture, runVertices.data(), quadCount * 4, indices.data(), quadCount * 6);
+                    stats.drawCalls++;
+
+                    runStart = runEnd;
                 }
+
+                if (currentTarget != previousTarget)
+                    SDL_SetRenderTarget(renderer, previousTarget);
+
+                commands.clear();
+                vertices.clear();
+                targets.clear();
+                sources.clear();
+                lastTarget = NULL;
+                lastSource = NULL;
+                stats.flushes++;
             }
 
-            ~Sound()
+            const Stats& get_stats() const { return stats; }
+            void reset_stats() { stats = Stats(); }
+
+        private:
+            struct Command
             {
-                if (sound)
-                    Mix_FreeChunk(sound);
-            }
+                SDL_Texture* target;
+                SDL_Texture* texture;
+                Uint32 firstVertex;
+            };
 
-            void play(LoopMode loop = LOOP_NONE)
+            bool is_pending_target(SDL_Texture* texture) const
             {
-                Mix_PlayChannel(-1, sound, loop);
+                return std::find(targets.begin(), targets.end(), texture) != targets.end();
             }
 
-            void set_volume(float volume)
+            SDL_Renderer* renderer = NULL;
+            SortMode sortMode = SORT_SUBMISSION;
+            bool active = false;
+
+            std::vector<Command> commands;
+            std::vector<SDL_Vertex> vertices;
+            std::vector<SDL_Vertex> runVertices;
+            std::vector<int> indices;
+            std::vector<SDL_Texture*> targets;
+            std::unordered_set<SDL_Texture*> sources;
+            SDL_Texture* lastTarget = NULL;
+            SDL_Texture* lastSource = NULL;
+
+            Stats stats;
+        };
+
+        static SpriteBatch spriteBatch;
+
+        inline void begin(SDL_Renderer* renderer, SortMode sortMode = SORT_SUBMISSION)
+        {
+            spriteBatch.begin(renderer, sortMode);
+        }
+
+        inline void end()
+        {
+            spriteBatch.end();
+        }
+
+        inline void flush()
+        {
+            spriteBatch.flush();
+        }
+
+        inline bool is_active()
+        {
+            return spriteBatch.is_active();
+        }
+
+        inline void flush_if_pending(SDL_Texture* texture)
+        {
+            if (spriteBatch.is_pending(texture))
+                spriteBatch.flush();
+        }
+
+        inline const Stats& get_stats()
+        {
+            return spriteBatch.get_stats();
+        }
+
+        inline void reset_stats()
+        {
+            spriteBatch.reset_stats();
+        }
+
+        inline void set_quad(SDL_Vertex* v, SDL_FRect dst, float u0, float v0, float u1, float v1, double angle, SDL_Color color)
+        {
+            float hw = dst.w / 2, hh = dst.h / 2;
+            float cx = dst.x + hw, cy = dst.y + hh;
+            float corners[4][2] = { { -hw, -hh }, { hw, -hh }, { hw, hh }, { -hw, hh } };
+            float uvs[4][2] = { { u0, v0 }, { u1, v0 }, { u1, v1 }, { u0, v1 } };
+
+            float c = 1.0f, s = 0.0f;
+            if (angle != 0.0)
+            {
+                double rad = angle * M_PI / 180.0;
+                c = static_cast<float>(std::cos(rad));
+                s = static_cast<float>(std::sin(rad));
+            }
+
+            for (int i = 0; i < 4; i++)
+            {
+                v[i].position = { cx + corners[i][0] * c - corners[i][1] * s, cy + corners[i][0] * s + corners[i][1] * c };
+                v[i].color = color;
+                v[i].tex_coord = { uvs[i][0], uvs[i][1] };
+            }
+        }
+
+        inline void sprite(SDL_Renderer* renderer, SDL_Texture* target, SDL_Texture* texture, int texWidth, int texHeight,
+                           SDL_Rect src, SDL_FRect dst, double angle, SDL_RendererFlip flip, SDL_Color color)
+        {
+            // Same clipping SDL_RenderCopyEx applies: the source is clipped, the destination is not.
+            int x0 = std::max(src.x, 0), y0 = std::max(src.y, 0);
+            int x1 = std::min(src.x + src.w, texWidth), y1 = std::min(src.y + src.h, texHeight);
+            if (x1 <= x0 || y1 <= y0)
+                return;
+
+            float u0 = static_cast<float>(x0) / texWidth, u1 = static_cast<float>(x1) / texWidth;
+            float v0 = static_cast<float>(y0) / texHeight, v1 = static_cast<float>(y1) / texHeight;
+            if (flip & SDL_FLIP_HORIZONTAL)
+                std::swap(u0, u1);
+            if (flip & SDL_FLIP_VERTICAL)
+                std::swap(v0, v1);
+
+            SDL_Vertex v[4];
+            set_quad(v, dst, u0, v0, u1, v1, angle, color);
+            spriteBatch.quad(renderer, target, texture, v);
+        }
+
+        inline void quad(SDL_Renderer* renderer, SDL_Texture* target, SDL_Texture* texture, const SDL_Vertex* v)
+        {
+            spriteBatch.quad(renderer, target, texture, v);
+        }
+
+        inline void fill_rect(SDL_Renderer* renderer, SDL_Texture* target, SDL_FRect rect, SDL_Color color)
+        {
+            SDL_Vertex v[4];
+            set_quad(v, rect, 0, 0, 0, 0, 0.0, color);
+            spriteBatch.quad(renderer, target, NULL, v);
+        }
+
+        inline void rect(SDL_Renderer* renderer, SDL_Texture* target, SDL_FRect rect, SDL_Color color)
+        {
+            if (rect.w <= 0 || rect.h <= 0)
+                return;
+
+            fill_rect(renderer, target, { rect.x, rect.y, rect.w, 1 }, color);
+            if (rect.h > 1)
+                fill_rect(renderer, target, { rect.x, rect.y + rect.h - 1, rect.w, 1 }, color);
+            if (rect.h > 2)
+            {
+                fill_rect(renderer, target, { rect.x, rect.y + 1, 1, rect.h - 2 }, color);
+                if (rect.w > 1)
+                    fill_rect(renderer, target, { rect.x + rect.w - 1, rect.y + 1, 1, rect.h - 2 }, color);
+            }
+        }
+    }
+
+    // Kernels over packed SDL_PIXELFORMAT_RGBA8888 pixels (alpha in the low byte), used by
+    // streaming surfaces. Each has a _scalar reference that produces identical results.
+    namespace pixels
+    {
+        struct PixelView
+        {
+            Uint32* pixels = NULL;
+            int width = 0;
+            int height = 0;
+            int pitch = 0;   // in pixels
+
+            Uint32* row(int y) const { return pixels + static_cast<size_t>(y) * pitch; }
+            Uint32& at(int x, int y) const { return row(y)[x]; }
+        };
+
+        inline Uint32 map(Color c)
+        {
+            return (static_cast<Uint32>(c.r) << 24) | (static_cast<Uint32>(c.g) << 16) | (static_cast<Uint32>(c.b) << 8) | c.a;
+        }
+
+        inline Color unmap(Uint32 p)
+        {
+            return { static_cast<Uint8>(p >> 24), static_cast<Uint8>(p >> 16), static_cast<Uint8>(p >> 8), static_cast<Uint8>(p) };
+        }
+
+        // x / 255 rounded, exact for x in [0, 65025].
+        inline Uint32 div255(Uint32 x)
+        {
+            return (x + 128 + ((x + 128) >> 8)) >> 8;
+        }
+
+#if defined(CGAME_AVX2) || defined(CGAME_SSE2)
+        inline __m128i div255_epi16(__m128i x)
+        {
+            x = _mm_add_epi16(x, _mm_set1_epi16(128));
+            return _mm_srli_epi16(_mm_add_epi16(x, _mm_srli_epi16(x, 8)), 8);
+        }
+#endif
+
+        inline void fill_scalar(Uint32* dst, size_t count, Uint32 color)
+        {
+            for (size_t i = 0; i < count; i++)
+                dst[i] = color;
+        }
+
+        inline void fill(Uint32* dst, size_t count, Uint32 color)
+        {
+            size_t i = 0;
+#if defined(CGAME_AVX2)
+            __m256i c = _mm256_set1_epi32(static_cast<int>(color));
+            for (; i + 8 <= count; i += 8)
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), c);
+#elif defined(CGAME_SSE2)
+            __m128i c = _mm_set1_epi32(static_cast<int>(color));
+            for (; i + 4 <= count; i += 4)
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), c);
+#endif
+            fill_scalar(dst + i, count - i, color);
+        }
+
+        // Source-over with straight alpha: colors mix by the source alpha, alphas combine as
+        // sa + da * (1 - sa).
+        inline void blend_scalar(Uint32* dst, const Uint32* src, size_t count)
+        {
+            for (size_t i = 0; i < count; i++)
+            {
+                Uint32 s = src[i], d = dst[i];
+                Uint32 sa = s & 0xFF, inv = 255 - sa;
+                Uint32 out = sa + div255((d & 0xFF) * inv);
+                for (int shift = 8; shift < 32; shift += 8)
+                    out |= div255(((s >> shift) & 0xFF) * sa + ((d >> shift) & 0xFF) * inv) << shift;
+                dst[i] = out;
+            }
+        }
+
+        inline void blend(Uint32* dst, const Uint32* src, size_t count)
+        {
+            size_t i = 0;
+#if defined(CGAME_AVX2) || defined(CGAME_SSE2)
+            const __m128i zero = _mm_setzero_si128(), full = _mm_set1_epi16(255);
+            const __m128i alphaLanes = _mm_setr_epi16(-1, 0, 0, 0, -1, 0, 0, 0);
+            for (; i + 2 <= count; i += 2)
+            {
+                __m128i s = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(src + i)), zero);
+                __m128i d = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(dst + i)), zero);
+                __m128i sa = _mm_shufflehi_epi16(_mm_shufflelo_epi16(s, 0), 0);
+                __m128i inv = _mm_sub_epi16(full, sa);
+
+                __m128i dInv = _mm_mullo_epi16(d, inv);
+                __m128i color = div255_epi16(_mm_add_epi16(_mm_mullo_epi16(s, sa), dInv));
+                __m128i alpha = _mm_add_epi16(sa, div255_epi16(dInv));
+                __m128i out = _mm_or_si128(_mm_andnot_si128(alphaLanes, color), _mm_and_si128(alphaLanes, alpha));
+                _mm_storel_epi64(reinterpret_cast<__m128i*>(dst + i), _mm_packus_epi16(out, zero));
+            }
+#endif
+            blend_scalar(dst + i, src + i, count - i);
+        }
+
+        // Multiplies every channel, alpha included, by mod / 255.
+        inline void color_mod_scalar(Uint32* dst, size_t count, Color mod)
+        {
+            Uint32 m[4] = { mod.a, mod.b, mod.g, mod.r };
+            for (size_t i = 0; i < count; i++)
+            {
+                Uint32 p = dst[i], out = 0;
+                for (int c = 0; c < 4; c++)
+                    out |= div255(((p >> (c * 8)) & 0xFF) * m[c]) << (c * 8);
+                dst[i] = out;
+            }
+        }
+
+        inline void color_mod(Uint32* dst, size_t count, Color mod)
+        {
+            size_t i = 0;
+#if defined(CGAME_AVX2) || defined(CGAME_SSE2)
+            const __m128i zero = _mm_setzero_si128();
+            const __m128i m = _mm_setr_epi16(mod.a, mod.b, mod.g, mod.r, mod.a, mod.b, mod.g, mod.r);
+            for (; i + 4 <= count; i += 4)
+            {
+                __m128i p = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dst + i));
+                __m128i lo = div255_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(p, zero), m));
+                __m128i hi = div255_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(p, zero), m));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_packus_epi16(lo, hi));
+            }
+#endif
+            color_mod_scalar(dst + i, count - i, mod);
+        }
+
+        // Replaces pixels equal to from[k] with to[k]; the first matching entry wins.
+        inline void palette_swap_scalar(Uint32* dst, size_t count, const Uint32* from, const Uint32* to, size_t entries)
+        {
+            for (size_t i = 0; i < count; i++)
+            {
+                for (size_t k = 0; k < entries; k++)
+                {
+                    if (dst[i] == from[k])
+                    {
+                        dst[i] = to[k];
+                        break;
+                    }
+                }
+            }
+        }
+
+        inline void palette_swap(Uint32* dst, size_t count, const Uint32* from, const Uint32* to, size_t entries)
+        {
+            size_t i = 0;
+#if defined(CGAME_AVX2) || defined(CGAME_SSE2)
+            for (; i + 4 <= count; i += 4)
+            {
+                __m128i p = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dst + i));
+                __m128i out = p, done = _mm_setzero_si128();
+                for (size_t k = 0; k < entries; k++)
+                {
+                    __m128i hit = _mm_andnot_si128(done, _mm_cmpeq_epi32(p, _mm_set1_epi32(static_cast<int>(from[k]))));
+                    out = _mm_or_si128(_mm_andnot_si128(hit, out), _mm_and_si128(hit, _mm_set1_epi32(static_cast<int>(to[k]))));
+                    done = _mm_or_si128(done, hit);
+                }
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), out);
+            }
+#endif
+            palette_swap_scalar(dst + i, count - i, from, to, entries);
+        }
+
+        static constexpr int MAX_BLUR_RADIUS = 127;
+
+        // One pass of a box filter with clamped edges over count pixels. Sums stay in 16 bits,
+        // which is what limits the radius; out = (sum + n / 2) * (65536 / n) >> 16.
+        inline void box_line_scalar(const Uint32* src, size_t srcStride, Uint32* dst, size_t dstStride, int count, int radius)
+        {
+            Uint32 n = static_cast<Uint32>(radius * 2 + 1), mul = 65536 / n;
+            Uint32 sum[4] = { 0, 0, 0, 0 };
+            for (int k = -radius; k <= radius; k++)
+            {
+                Uint32 p = src[std::clamp(k, 0, count - 1) * srcStride];
+                for (int c = 0; c < 4; c++)
+                    sum[c] += (p >> (c * 8)) & 0xFF;
+            }
+
+            for (int x = 0; x < count; x++)
+            {
+                Uint32 out = 0;
+                for (int c = 0; c < 4; c++)
+                    out |= (((sum[c] + n / 2) * mul) >> 16) << (c * 8);
+                dst[x * dstStride] = out;
+
+                Uint32 add = src[std::min(x + radius + 1, count - 1) * srcStride];
+                Uint32 sub = src[std::max(x - radius, 0) * srcStride];
+                for (int c = 0; c < 4; c++)
+                    sum[c] += ((add >> (c * 8)) & 0xFF) - ((sub >> (c * 8)) & 0xFF);
+            }
+        }
+
+        // The same pass with the four channels of a pixel in one vector.
+        inline void box_line(const Uint32* src, size_t srcStride, Uint32* dst, size_t dstStride, int count, int radius)
+        {
+#if defined(CGAME_AVX2) || defined(CGAME_SSE2)
+            const __m128i zero = _mm_setzero_si128();
+            int n = radius * 2 + 1;
+            const __m128i half = _mm_set1_epi16(static_cast<short>(n / 2));
+            const __m128i mul = _mm_set1_epi16(static_cast<short>(65536 / n));
+            auto load = [&](int x)
+            {
+                return _mm_unpacklo_epi8(_mm_cvtsi32_si128(static_cast<int>(src[x * srcStride])), zero);
+            };
+
+            __m128i sum = zero;
+            for (int k = -radius; k <= radius; k++)
+                sum = _mm_add_epi16(sum, load(std::clamp(k, 0, count - 1)));
+
+            for (int x = 0; x < count; x++)
+            {
+                __m128i out = _mm_mulhi_epu16(_mm_add_epi16(sum, half), mul);
+                dst[x * dstStride] = static_cast<Uint32>(_mm_cvtsi128_si32(_mm_packus_epi16(out, zero)));
+                sum = _mm_sub_epi16(_mm_add_epi16(sum, load(std::min(x + radius + 1, count - 1))), load(std::max(x - radius, 0)));
+            }
+#else
+            box_line_scalar(src, srcStride, dst, dstStride, count, radius);
+#endif
+        }
+
+        // Separable box blur, horizontal then vertical, radius up to MAX_BLUR_RADIUS.
+        template<typename Line>
+        void box_blur(const PixelView& view, int radius, Line line)
+        {
+            radius = std::min(radius, MAX_BLUR_RADIUS);
+            if (radius <= 0 || view.width <= 0 || view.height <= 0)
+                return;
+
+            static thread_local std::vector<Uint32> temp;
+            size_t width = static_cast<size_t>(view.width), pitch = static_cast<size_t>(view.pitch);
+            temp.resize(width * view.height);
+
+            for (int y = 0; y < view.height; y++)
+                line(view.row(y), 1, temp.data() + y * width, 1, view.width, radius);
+            for (int x = 0; x < view.width; x++)
+                line(temp.data() + x, width, view.pixels + x, pitch, view.height, radius);
+        }
+
+        inline void blur_scalar(const PixelView& view, int radius)
+        {
+            box_blur(view, radius, box_line_scalar);
+        }
+
+        inline void blur(const PixelView& view, int radius)
+        {
+            box_blur(view, radius, box_line);
+        }
+    }
+
+    // Changed areas of a surface as a short list of non-overlapping pixel rects. Rects that touch or
+    // overlap are merged; once the list grows long or covers most of the surface it collapses to
+    // the whole surface, which is cheaper to redraw than many fragments.
+    class DirtyRegion
+    {
+    public:
+        static constexpr size_t MAX_RECTS = 32;
+
+        void set_bounds(int _width, int _height)
+        {
+            width = _width;
+            height = _height;
+            clear();
+        }
+
+        void add(const Rect& rect)
+        {
+            if (full)
+                return;
+
+            int x0 = std::max(static_cast<int>(std::floor(rect.x)), 0);
+            int y0 = std::max(static_cast<int>(std::floor(rect.y)), 0);
+            int x1 = std::min(static_cast<int>(std::ceil(rect.x + rect.w)), width);
+            int y1 = std::min(static_cast<int>(std::ceil(rect.y + rect.h)), height);
+            if (x1 <= x0 || y1 <= y0)
+                return;
+
+            SDL_Rect merged = { x0, y0, x1 - x0, y1 - y0 };
+            size_t i = 0;
+            while (i < rects.size())
+            {
+                const SDL_Rect& r = rects[i];
+                if (merged.x <= r.x + r.w && r.x <= merged.x + merged.w && merged.y <= r.y + r.h && r.y <= merged.y + merged.h)
+                {
+                    SDL_UnionRect(&merged, &r, &merged);
+                    rects[i] = rects.back();
+                    rects.pop_back();
+                    i = 0;
+                    continue;
+                }
+                i++;
+            }
+            rects.push_back(merged);
+
+            long long area = 0;
+            for (const SDL_Rect& r : rects)
+                area += static_cast<long long>(r.w) * r.h;
+            if (rects.size() > MAX_RECTS || area * 2 > static_cast<long long>(width) * height)
+                add_all();
+        }
+
+        void add_all()
+        {
+            rects.assign(1, { 0, 0, width, height });
+            full = width > 0 && height > 0;
+            if (!full)
+                rects.clear();
+        }
+
+        void clear()
+        {
+            rects.clear();
+            full = false;
+        }
+
+        bool is_empty() const { return rects.empty(); }
+        bool is_full() const { return full; }
+        const std::vector<SDL_Rect>& get_rects() const { return rects; }
+
+    private:
+        std::vector<SDL_Rect> rects;
+        int width = 0, height = 0;
+        bool full = false;
+    };
+
+    enum SurfaceAccess
+    {
+        SURFACE_TARGET,
+        SURFACE_STREAMING
+    };
+
+    class Surface
+    {
+    public:
+        Surface(SDL_Renderer* _renderer, float _width, float _height)
+            : renderer(_renderer), width(_width), height(_height), x(0), y(0)
+        {
+            surfaceTex = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_TARGET, width, height);
+            rect = { x, y, width, height };
+            region = { 0, 0, static_cast<int>(width), static_cast<int>(height) };
+        }
+
+        // Streaming surfaces keep their pixels in memory: lock() hands them out directly and unlock()
+        // uploads only the locked areas. They can be blitted like any surface but not rendered into.
+        Surface(SDL_Renderer* _renderer, float _width, float _height, SurfaceAccess access)
+            : Surface(_renderer, _width, _height, access == SURFACE_STREAMING ? SDL_TEXTUREACCESS_STREAMING : SDL_TEXTUREACCESS_TARGET)
+        {
+        }
+
+        Surface(SDL_Renderer* _renderer, SDL_Texture* _existing)
+            : renderer(_renderer), surfaceTex(_existing), x(0), y(0)
+        {
+            int texW = 0, texH = 0;
+            SDL_QueryTexture(_existing, nullptr, nullptr, &texW, &texH);
+            width = static_cast<float>(texW);
+            height = static_cast<float>(texH);
+            rect = { x, y, width, height };
+            region = { 0, 0, texW, texH };
+        }
+
+        Surface(SDL_Renderer* _renderer, SDL_Texture* _existing, SDL_Rect _region)
+            : Surface(_renderer, _existing)
+        {
+            region = _region;
+            rect = { x, y, static_cast<float>(region.w), static_cast<float>(region.h) };
+            owned = false;
+        }
+
+        ~Surface()
+        {
+            if (!owned)
+                return;
+
+            batch::flush_if_pending(surfaceTex);
+            SDL_DestroyTexture(surfaceTex);
+        }
+
+        void fill(Color color = { 0, 0, 0, 255 })
+        {
+            CGAME_PROFILE_ZONE("Surface::fill");
+            if (streaming)
+            {
+                pixels::PixelView view = lock();
+                pixels::fill(view.pixels, cpuPixels.size(), pixels::map(color));
+                unlock();
+                return;
+            }
+
+            batch::flush_if_pending(surfaceTex);
+            if (trackDirty)
+                dirty.add_all();
+
+            SDL_Texture* oldTarget = SDL_GetRenderTarget(renderer);
+            SDL_SetRenderTarget(renderer, surfaceTex);
+            SDL_SetRenderDrawColor(renderer, color.r, color.g, color.b, color.a);
+            SDL_RenderClear(renderer);
+            SDL_SetRenderTarget(renderer, oldTarget);
+        }
+
+        void blit(Surface& surface, float _x, float _y, Rect srcRect)
+        {
+            x = _x;
+            y = _y;
+
+            blit_ex(surface, srcRect, { _x, _y, srcRect.w, srcRect.h }, surface.get_rotation(), surface.is_flip());
+        }
+
+        void blit(Surface& surface, float _x, float _y)
+        {   
+            blit(surface, _x, _y, {0, 0, surface.get_width(), surface.get_height()});
+        }
+
+        void blit(Surface& surface, Rect _rect)
+        {
+            blit(surface, _rect.x, _rect.y);
+        }
+
+        // Copies srcRect of surface stretched into dstRect, rotated around its center. Destinations
+        // entirely outside this surface are dropped before they reach SDL or the batch.
+        void blit_ex(Surface& surface, Rect srcRect, Rect dstRect, float angle, bool flipped)
+        {
+            CGAME_PROFILE_ZONE("Surface::blit");
+            SDL_FRect dst = dstRect.to_sdl_frect();
+            if (is_outside(dst, angle))
+                return;
+            if (streaming)
+            {
+                std::cerr << "Can't blit into a streaming surface; write its pixels through lock()" << std::endl;
+                return;
+            }
+
+            SDL_RendererFlip flipMode = flipped ? SDL_FLIP_HORIZONTAL : SDL_FLIP_NONE;
+            SDL_Rect src = { (int)srcRect.x, (int)srcRect.y, (int)srcRect.w, (int)srcRect.h };
+            if (!surface.to_texture_rect(src))
+                return;
+
+            if (trackDirty)
+                mark_dirty(bounds(dst, angle));
+
+            if (batch::is_active())
+            {
+                if (surface.get_surface() != NULL)
+                {
+                    batch::sprite(renderer, surfaceTex, surface.get_surface(), (int)surface.width, (int)surface.height,
+                                  src, dst, angle, flipMode, surface.tint.to_sdl());
+                }
+                return;
+            }
+
+            SDL_Texture* previousTarget = SDL_GetRenderTarget(renderer);
+            SDL_SetRenderTarget(renderer, surfaceTex);   
+            SDL_SetTextureScaleMode(surface.get_surface(), SDL_ScaleModeNearest);
+            // Atlas views share their page's texture, so its mods may hold another view's tint.
+            SDL_SetTextureColorMod(surface.get_surface(), surface.tint.r, surface.tint.g, surface.tint.b);
+            SDL_SetTextureAlphaMod(surface.get_surface(), surface.tint.a);
+            SDL_RenderCopyExF(renderer, surface.get_surface(), &src, &dst, angle, NULL, flipMode);
+            SDL_SetRenderTarget(renderer, previousTarget);
+        }
+
+        void set_alpha(float alpha)
+        {
+            alpha = std::clamp(alpha, 0.0f, 255.0f) / 255.0f;
+            tint.a = static_cast<Uint8>(alpha * 255.0f + 0.5f);
+            SDL_SetTextureAlphaMod(surfaceTex, tint.a);
+        }
+
+        void set_color(Color color = { 255, 255, 255 })
+        {
+            tint = { color.r, color.g, color.b, tint.a };
+            SDL_SetTextureColorMod(surfaceTex, color.r, color.g, color.b);
+        }
+
+        bool is_streaming() const { return streaming; }
+
+        // The pixels of a streaming surface, row by row (pitch == width); the area is uploaded on
+        // unlock(). Views stay valid for the surface's lifetime. Empty for target surfaces.
+        pixels::PixelView lock()
+        {
+            return lock({ 0, 0, width, height });
+        }
+
+        pixels::PixelView lock(const Rect& area)
+        {
+            if (!streaming)
+                return {};
+
+            int w = static_cast<int>(width), h = static_cast<int>(height);
+            int x0 = std::clamp(static_cast<int>(std::floor(area.x)), 0, w);
+            int y0 = std::clamp(static_cast<int>(std::floor(area.y)), 0, h);
+            int x1 = std::clamp(static_cast<int>(std::ceil(area.x + area.w)), x0, w);
+            int y1 = std::clamp(static_cast<int>(std::ceil(area.y + area.h)), y0, h);
+
+            uploads.add({ static_cast<float>(x0), static_cast<float>(y0), static_cast<float>(x1 - x0), static_cast<float>(y1 - y0) });
+            return { cpuPixels.data() + static_cast<size_t>(y0) * w + x0, x1 - x0, y1 - y0, w };
+        }
+
+        // Uploads every area locked since the last unlock.
+        void unlock()
+        {
+            if (!streaming || uploads.is_empty())
+                return;
+
+            CGAME_PROFILE_ZONE("Surface::unlock");
+            batch::flush_if_pending(surfaceTex);
+            int w = static_cast<int>(width);
+            for (const SDL_Rect& r : uploads.get_rects())
+            {
+                SDL_UpdateTexture(surfaceTex, &r, cpuPixels.data() + static_cast<size_t>(r.y) * w + r.x, w * static_cast<int>(sizeof(Uint32)));
+                mark_dirty({ (float)r.x, (float)r.y, (float)r.w, (float)r.h });
+            }
+            uploads.clear();
+        }
+
+        // Off by default. When on, fills and draws into this surface record the pixels they touch,
+        // which Window::update uses to present only what changed.
+        void set_dirty_tracking(bool enabled)
+        {
+            trackDirty = enabled;
+            dirty.set_bounds(static_cast<int>(width), static_cast<int>(height));
+            if (enabled)
+                dirty.add_all();
+        }
+
+        void mark_dirty(const Rect& area)
+        {
+            if (trackDirty)
+                dirty.add(area);
+        }
+
+        void mark_dirty()
+        {
+            if (trackDirty)
+                dirty.add_all();
+        }
+
+        bool is_dirty_tracking() const { return trackDirty; }
+        const DirtyRegion& get_dirty() const { return dirty; }
+        void clear_dirty() { dirty.clear(); }
+
+        void set_width(float _width) { rect.w = _width; }
+        void set_height(float _height) { rect.h = _height; }
+        void set_rotation(float _rotation) { rotation = _rotation; }
+        void set_flip(bool _flip) { flip = _flip; }
+
+        SDL_Texture* get_surface() const { return surfaceTex; }
+        float get_width() const { return rect.w; }
+        float get_height() const { return rect.h; }
+        float get_rotation() const { return rotation; }
+        bool is_flip() const { return flip; }
+        SDL_Rect get_region() const { return region; }
+        bool is_view() const { return !owned; }
+        Rect get_rect(float _x = 0, float _y = 0)
+        {
+            rect.x = _x;
+            rect.y = _y;
+            return rect;
+        }
+
+    private:
+        Surface(SDL_Renderer* _renderer, float _width, float _height, int textureAccess)
+            : renderer(_renderer), x(0), y(0), width(_width), height(_height)
+        {
+            surfaceTex = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA8888, textureAccess, width, height);
+            rect = { x, y, width, height };
+            region = { 0, 0, static_cast<int>(width), static_cast<int>(height) };
+
+            if (textureAccess == SDL_TEXTUREACCESS_STREAMING)
+            {
+                streaming = true;
+                SDL_SetTextureBlendMode(surfaceTex, SDL_BLENDMODE_BLEND);
+                cpuPixels.assign(static_cast<size_t>(region.w) * region.h, 0);
+                uploads.set_bounds(region.w, region.h);
+                lock();
+                unlock();
+            }
+        }
+
+        static Rect bounds(const SDL_FRect& dst, float angle)
+        {
+            if (angle == 0.0f)
+                return { dst.x, dst.y, dst.w, dst.h };
+
+            // Any rotation of the quad stays inside the circle through its corners.
+            float radius = 0.5f * std::sqrt(dst.w * dst.w + dst.h * dst.h);
+            return { dst.x + dst.w / 2 - radius, dst.y + dst.h / 2 - radius, radius * 2, radius * 2 };
+        }
+
+        bool is_outside(const SDL_FRect& dst, float angle) const
+        {
+            Rect b = bounds(dst, angle);
+            return b.right() <= 0 || b.bottom() <= 0 || b.x >= width || b.y >= height;
+        }
+
+        bool to_texture_rect(SDL_Rect& src) const
+        {
+            int x0 = std::max(region.x + src.x, region.x);
+            int y0 = std::max(region.y + src.y, region.y);
+            int x1 = std::min(region.x + src.x + src.w, region.x + region.w);
+            int y1 = std::min(region.y + src.y + src.h, region.y + region.h);
+            src = { x0, y0, x1 - x0, y1 - y0 };
+            return x1 > x0 && y1 > y0;
+        }
+
+        SDL_Renderer* renderer; 
+        SDL_Texture* surfaceTex; 
+        
+        float x, y;
+        float width, height;      
+        float rotation = 0.0f;
+        bool flip = false;
+        Color tint = { 255, 255, 255, 255 };
+        Rect rect; 
+        SDL_Rect region;
+        bool owned = true;
+
+        bool trackDirty = false;
+        DirtyRegion dirty;
+
+        bool streaming = false;
+        std::vector<Uint32> cpuPixels;
+        DirtyRegion uploads;
+    };
+
+    namespace transform
+    {
+        inline Surface& scale(Surface& surface, float newWidth, float newHeight)
+        {
+            surface.set_width(newWidth);
+            surface.set_height(newHeight);
+            return surface;
+        }
+
+        inline Surface& rotate(Surface& surface, float newRotation)
+        {
+            surface.set_rotation(newRotation);
+            return surface;
+        }
+
+        inline Surface& flip(Surface& surface, bool flip)
+        {
+            surface.set_flip(flip);
+            return surface;
+        }
+    }
+
+    // Maps world space onto a viewport rect of the target: position is the world point shown at the
+    // viewport center, zoom scales world units to pixels and rotation turns the view clockwise.
+    class Camera
+    {
+    public:
+        Camera() = default;
+        Camera(float _width, float _height) : viewport(0, 0, _width, _height), position(_width / 2, _height / 2) { }
+        Camera(const Rect& _viewport) : viewport(_viewport), position(_viewport.w / 2, _viewport.h / 2) { }
+
+        void set_viewport(const Rect& _viewport) { viewport = _viewport; }
+        void set_position(Vec2 _position) { position = _position; }
+        void move(Vec2 offset) { position += offset; }
+        void set_zoom(float _zoom) { zoom = std::max(_zoom, 0.0001f); }
+        void set_rotation(float degrees) { rotation = degrees; }
+
+        const Rect& get_viewport() const { return viewport; }
+        Vec2 get_position() const { return position; }
+        float get_zoom() const { return zoom; }
+        float get_rotation() const { return rotation; }
+
+        // Keeps the visible area inside bounds, centering on them when the view is larger.
+        void clamp_to(const Rect& bounds)
+        {
+            Rect view = get_view();
+            float halfW = view.w / 2, halfH = view.h / 2;
+
+            if (view.w >= bounds.w)
+                position.x = bounds.centerx();
+            else
+                position.x = std::clamp(position.x, bounds.x + halfW, bounds.right() - halfW);
+
+            if (view.h >= bounds.h)
+                position.y = bounds.centery();
+            else
+                position.y = std::clamp(position.y, bounds.y + halfH, bounds.bottom() - halfH);
+        }
+
+        math::Transform get_transform() const
+        {
+            return math::Transform::translation(viewport.get_center()) * math::Transform::rotation(-rotation) *
+                   math::Transform::scaling(zoom, zoom) * math::Transform::translation(-position);
+        }
+
+        Vec2 world_to_screen(Vec2 point) const { return get_transform().apply(point); }
+        Vec2 screen_to_world(Vec2 point) const { return get_transform().inverse().apply(point); }
+        Rect world_to_screen(const Rect& rect) const { return get_transform().apply_rect(rect); }
+
+        // World-space bounds of everything the viewport shows.
+        Rect get_view() const { return get_transform().inverse().apply_rect(viewport); }
+
+        bool is_visible(const Rect& rect) const { return get_view().colliderect(rect); }
+
+    private:
+        Rect viewport;
+        Vec2 position;
+        float zoom = 1.0f;
+        float rotation = 0.0f;
+    };
+
+    // Collects sprites in world space and draws them on flush: culled against the camera view,
+    // ordered by layer, and by submission order within a layer. Surfaces must stay alive until the
+    // flush; their tint and alpha are read then, rotation and flip when submitted.
+    class RenderQueue
+    {
+    public:
+        struct Stats
+        {
+            size_t submitted = 0;
+            size_t culled = 0;
+            size_t drawn = 0;
+        };
+
+        void submit(Surface& surface, float _x, float _y, int layer = 0)
+        {
+            float w = surface.get_width(), h = surface.get_height();
+            submit(surface, { 0, 0, w, h }, { _x, _y, w, h }, layer, surface.get_rotation());
+        }
+
+        void submit(Surface& surface, const Rect& rect, int layer = 0)
+        {
+            submit(surface, rect.x, rect.y, layer);
+        }
+
+        void submit(Surface& surface, const Rect& srcRect, const Rect& dstRect, int layer, float rotation = 0.0f)
+        {
+            items.push_back({ &surface, srcRect, dstRect, rotation, surface.is_flip(), layer });
+            stats.submitted++;
+        }
+
+        void flush(Surface& target, const Camera& camera)
+        {
+            CGAME_PROFILE_ZONE("RenderQueue::flush");
+            Rect view = camera.get_view();
+
+            keys.clear();
+            for (size_t i = 0; i < items.size(); i++)
+            {
+                if (!bounds(items[i]).colliderect(view))
+                {
+                    stats.culled++;
+                    continue;
+                }
+
+                // Layer in the high half, flipped to sort negative layers first; index keeps it stable.
+                Uint32 layerKey = static_cast<Uint32>(items[i].layer) ^ 0x80000000u;
+                keys.push_back((static_cast<Uint64>(layerKey) << 32) | static_cast<Uint64>(i));
+            }
+            std::sort(keys.begin(), keys.end());
+
+            math::Transform toScreen = camera.get_transform();
+            float zoom = camera.get_zoom();
+            for (Uint64 key : keys)
+            {
+                const Item& item = items[static_cast<size_t>(key & 0xFFFFFFFFu)];
+                Vec2 center = toScreen.apply(item.dst.get_center());
+                float w = item.dst.w * zoom, h = item.dst.h * zoom;
+                target.blit_ex(*item.surface, item.src, { center.x - w / 2, center.y - h / 2, w, h },
+                               item.rotation - camera.get_rotation(), item.flip);
+            }
+            stats.drawn += keys.size();
+
+            items.clear();
+        }
+
+        // Screen-space flush: world units are target pixels.
+        void flush(Surface& target)
+        {
+            SDL_Rect size = target.get_region();
+            flush(target, Camera(static_cast<float>(size.w), static_cast<float>(size.h)));
+        }
+
+        void clear() { items.clear(); }
+        size_t size() const { return items.size(); }
+
+        const Stats& get_stats() const { return stats; }
+        void reset_stats() { stats = Stats(); }
+
+    private:
+        struct Item
+        {
+            Surface* surface;
+            Rect src;
+            Rect dst;
+            float rotation;
+            bool flip;
+            int layer;
+        };
+
+        static Rect bounds(const Item& item)
+        {
+            if (item.rotation == 0.0f)
+                return item.dst;
+
+            float radius = 0.5f * std::sqrt(item.dst.w * item.dst.w + item.dst.h * item.dst.h);
+            return { item.dst.centerx() - radius, item.dst.centery() - radius, radius * 2, radius * 2 };
+        }
+
+        std::vector<Item> items;
+        std::vector<Uint64> keys;
+        Stats stats;
+    };
+
+    namespace image
+    {
+        inline Surface load(SDL_Renderer* renderer, std::string filePath)
+        {
+            SDL_Texture* imgTex = IMG_LoadTexture(renderer, filePath.c_str());
+            if (imgTex == NULL)
+            {
+                std::cerr << "Failed to load image " << filePath << " Error: " << IMG_GetError() << std::endl;
+            }
+    
+            return Surface(renderer, imgTex);
+        }
+
+        class SkylinePacker
+        {
+        public:
+            SkylinePacker(int _width, int _height)
+                : width(_width), height(_height)
+            {
+                skyline.push_back({ 0, 0, width });
+            }
+
+            bool pack(int w, int h, SDL_Rect& out)
+            {
+                int bestIndex = -1, bestBottom = height + 1, bestWidth = width + 1, bestY = 0;
+                for (size_t i = 0; i < skyline.size(); i++)
+                {
+                    int y = 0;
+                    if (!fits(i, w, h, y))
+                        continue;
+
+                    if (y + h < bestBottom || (y + h == bestBottom && skyline[i].w < bestWidth))
+                    {
+                        bestIndex = static_cast<int>(i);
+                        bestBottom = y + h;
+                        bestWidth = skyline[i].w;
+                        bestY = y;
+                    }
+                }
+
+                if (bestIndex < 0)
+                    return false;
+
+                out = { skyline[bestIndex].x, bestY, w, h };
+                insert(bestIndex, out);
+                return true;
+            }
+
+        private:
+            struct Segment
+            {
+                int x, y, w;
+            };
+
+            bool fits(size_t index, int w, int h, int& y) const
+            {
+                if (skyline[index].x + w > width)
+                    return false;
+
+                y = 0;
+                int remaining = w;
+                for (size_t i = index; remaining > 0 && i < skyline.size(); i++)
+                {
+                    y = std::max(y, skyline[i].y);
+                    if (y + h > height)
+                        return false;
+                    remaining -= skyline[i].w;
+                }
+                return true;
+            }
+
+            void insert(int index, const SDL_Rect& placed)
+            {
+                skyline.insert(skyline.begin() + index, { placed.x, placed.y + placed.h, placed.w });
+
+                int right = placed.x + placed.w;
+                for (size_t i = index + 1; i < skyline.size();)
+                {
+                    if (skyline[i].x >= right)
+                        break;
+
+                    int shrink = right - skyline[i].x;
+                    if (skyline[i].w <= shrink)
+                    {
+                        skyline.erase(skyline.begin() + i);
+                        continue;
+                    }
+                    skyline[i].x += shrink;
+                    skyline[i].w -= shrink;
+                    break;
+                }
+
+                for (size_t i = 0; i + 1 < skyline.size();)
+                {
+                    if (skyline[i].y == skyline[i + 1].y)
+                    {
+                        skyline[i].w += skyline[i + 1].w;
+                        skyline.erase(skyline.begin() + i + 1);
+                    }
+                    else
+                    {
+                        i++;
+                    }
+                }
+            }
+
+            int width, height;
+            std::vector<Segment> skyline;
+        };
+
+        class Atlas
+        {
+        public:
+            Atlas() = default;
+
+            Atlas(Atlas&& other) noexcept
+                : renderer(other.renderer), pages(std::move(other.pages)), frames(std::move(other.frames))
+            {
+                other.pages.clear();
+            }
+
+            Atlas& operator=(Atlas&& other) noexcept
+            {
+                if (this != &other)
+                {
+                    destroy();
+                    renderer = other.renderer;
+                    pages = std::move(other.pages);
+                    frames = std::move(other.frames);
+                    other.pages.clear();
+                }
+                return *this;
+            }
+
+            Atlas(const Atlas&) = delete;
+            Atlas& operator=(const Atlas&) = delete;
+
+            ~Atlas()
+            {
+                destroy();
+            }
+
+            Surface get(const std::string& name, size_t frame = 0) const
+            {
+                auto it = frames.find(name);
+                if (it == frames.end() || frame >= it->second.size())
+                {
+                    std::cerr << "Atlas has no frame " << frame << " of " << name << std::endl;
+                    return Surface(renderer, (SDL_Texture*)NULL, SDL_Rect{ 0, 0, 0, 0 });
+                }
+
+                const Frame& f = it->second[frame];
+                return Surface(renderer, pages[f.page], f.rect);
+            }
+
+            std::vector<Surface> get_frames(const std::string& name) const
+            {
+                std::vector<Surface> result;
+                auto it = frames.find(name);
+                if (it == frames.end())
+                    return result;
+
+                result.reserve(it->second.size());
+                for (const Frame& f : it->second)
+                    result.emplace_back(renderer, pages[f.page], f.rect);
+                return result;
+            }
+
+            bool has(const std::string& name) const { return frames.count(name) != 0; }
+            size_t get_frame_count(const std::string& name) const
+            {
+                auto it = frames.find(name);
+                return it == frames.end() ? 0 : it->second.size();
+            }
+            size_t get_page_count() const { return pages.size(); }
+            SDL_Texture* get_page(size_t index) const { return pages[index]; }
+
+        private:
+            friend class AtlasBuilder;
+
+            struct Frame
+            {
+                size_t page;
+                SDL_Rect rect;
+            };
+
+            void destroy()
+            {
+                for (SDL_Texture* page : pages)
+                {
+                    batch::flush_if_pending(page);
+                    SDL_DestroyTexture(page);
+                }
+                pages.clear();
+            }
+
+            SDL_Renderer* renderer = NULL;
+            std::vector<SDL_Texture*> pages;
+            std::unordered_map<std::string, std::vector<Frame>> frames;
+        };
+
+        class AtlasBuilder
+        {
+        public:
+            AtlasBuilder(int _pageSize = 2048, int _padding = 1)
+                : pageSize(_pageSize), padding(_padding) { }
+
+            ~AtlasBuilder()
+            {
+                for (SDL_Surface* image : images)
+                    SDL_FreeSurface(image);
+            }
+
+            AtlasBuilder(const AtlasBuilder&) = delete;
+            AtlasBuilder& operator=(const AtlasBuilder&) = delete;
+
+            bool add(const std::string& name, const std::string& filePath)
+            {
+                SDL_Surface* image = load_rgba(filePath);
+                if (!image)
+                    return false;
+
+                entries.push_back({ name, images.size(), { 0, 0, image->w, image->h } });
+                images.push_back(image);
+                return true;
+            }
+
+            bool add_sheet(const std::string& name, const std::string& filePath, int frameWidth, int frameHeight)
+            {
+                if (frameWidth <= 0 || frameHeight <= 0)
+                    return false;
+
+                SDL_Surface* image = load_rgba(filePath);
+                if (!image)
+                    return false;
+
+                for (int fy = 0; fy + frameHeight <= image->h; fy += frameHeight)
+                {
+                    for (int fx = 0; fx + frameWidth <= image->w; fx += frameWidth)
+                        entries.push_back({ name, images.size(), { fx, fy, frameWidth, frameHeight } });
+                }
+                images.push_back(image);
+                return true;
+            }
+
+            Atlas build(SDL_Renderer* renderer)
+            {
+                Atlas atlas;
+                atlas.renderer = renderer;
+
+                std::vector<size_t> order(entries.size());
+                for (size_t i = 0; i < order.size(); i++)
+                    order[i] = i;
+                std::stable_sort(order.begin(), order.end(), [this](size_t a, size_t b)
+                {
+                    return entries[a].src.h > entries[b].src.h;
+                });
+
+                std::vector<SkylinePacker> packers;
+                std::vector<Atlas::Frame> placed(entries.size());
+                for (size_t index : order)
+                {
+                    const Entry& entry = entries[index];
+                    int w = entry.src.w + padding, h = entry.src.h + padding;
+                    if (w > pageSize || h > pageSize)
+                    {
+                        std::cerr << "Image " << entry.name << " does not fit in a " << pageSize << "px atlas page" << std::endl;
+                        placed[index].page = SIZE_MAX;
+                        continue;
+                    }
+
+                    SDL_Rect spot;
+                    size_t page = 0;
+                    while (page < packers.size() && !packers[page].pack(w, h, spot))
+                        page++;
+                    if (page == packers.size())
+                    {
+                        packers.emplace_back(pageSize, pageSize);
+                        packers.back().pack(w, h, spot);
+                    }
+
+                    placed[index] = { page, { spot.x, spot.y, entry.src.w, entry.src.h } };
+                }
+
+                for (size_t page = 0; page < packers.size(); page++)
+                {
+                    SDL_Surface* pageSurface = SDL_CreateRGBSurfaceWithFormat(0, pageSize, pageSize, 32, SDL_PIXELFORMAT_RGBA32);
+                    if (!pageSurface)
+                    {
+                        std::cerr << "Failed to create atlas page: " << SDL_GetError() << std::endl;
+                        atlas.pages.push_back(NULL);
+                        continue;
+                    }
+
+                    for (size_t i = 0; i < entries.size(); i++)
+                    {
+                        if (placed[i].page != page)
+                            continue;
+
+                        SDL_Rect src = entries[i].src;
+                        SDL_Rect dst = placed[i].rect;
+                        SDL_BlitSurface(images[entries[i].image], &src, pageSurface, &dst);
+                    }
+
+                    SDL_Texture* texture = SDL_CreateTextureFromSurface(renderer, pageSurface);
+                    SDL_FreeSurface(pageSurface);
+                    if (texture == NULL)
+                        std::cerr << "Failed to upload atlas page: " << SDL_GetError() << std::endl;
+                    else
+                        SDL_SetTextureBlendMode(texture, SDL_BLENDMODE_BLEND);
+
+                    atlas.pages.push_back(texture);
+                }
+
+                for (size_t i = 0; i < entries.size(); i++)
+                {
+                    if (placed[i].page != SIZE_MAX)
+                        atlas.frames[entries[i].name].push_back(placed[i]);
+                }
+
+                return atlas;
+            }
+
+        private:
+            struct Entry
+            {
+                std::string name;
+                size_t image;
+                SDL_Rect src;
+            };
+
+            SDL_Surface* load_rgba(const std::string& filePath)
+            {
+                SDL_Surface* loaded = IMG_Load(filePath.c_str());
+                if (!loaded)
+                {
+                    std::cerr << "Failed to load image " << filePath << " Error: " << IMG_GetError() << std::endl;
+                    return NULL;
+                }
+
+                SDL_Surface* converted = SDL_ConvertSurfaceFormat(loaded, SDL_PIXELFORMAT_RGBA32, 0);
+                SDL_FreeSurface(loaded);
+                if (converted)
+                    SDL_SetSurfaceBlendMode(converted, SDL_BLENDMODE_NONE);
+                return converted;
+            }
+
+            int pageSize, padding;
+            std::vector<SDL_Surface*> images;
+            std::vector<Entry> entries;
+        };
+    }
+
+    class Window
+    {
+    public:
+        Window(int width, int height, std::string title)
+            : m_width(width), m_height(height), m_title(title)
+        {
+            m_window = SDL_CreateWindow(title.c_str(), SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, width, height, SDL_WINDOW_SHOWN);
+            if (m_window == NULL)
+            {
+                std::cerr << "Failed to create window. Error: " << SDL_GetError() << std::endl;
+            }
+
+            m_renderer = SDL_CreateRenderer(m_window, -1, SDL_RENDERER_ACCELERATED);
+            if (m_renderer == NULL)
+            {
+                std::cerr << "Failed to create renderer. Error: " << SDL_GetError() << std::endl;
+            }
+
+            SDL_SetRenderDrawBlendMode(m_renderer, SDL_BLENDMODE_BLEND);
+
+            // Only the software renderer keeps the window's pixels between presents.
+            SDL_RendererInfo info;
+            softwareRenderer = m_renderer != NULL && SDL_GetRendererInfo(m_renderer, &info) == 0 && (info.flags & SDL_RENDERER_SOFTWARE) != 0;
+
+            screenSurface = new Surface(m_renderer, m_width, m_height);
+        }
+
+        ~Window()
+        {
+            delete screenSurface;
+            SDL_DestroyRenderer(m_renderer);
+            SDL_DestroyWindow(m_window);
+        }
+
+        void begin_frame(Color color = { 0, 0, 0, 255 })
+        {
+            batch::flush();
+            if (dirtyMode)
+                return;
+
+            SDL_SetRenderDrawColor(m_renderer, color.r, color.g, color.b, color.a);
+            SDL_RenderClear(m_renderer);
+
+            SDL_FRect dst = { 0, 0, screenSurface->get_width(), screenSurface->get_height() };
+            SDL_RenderCopyF(m_renderer, screenSurface->get_surface(), NULL, &dst);
+        }
+
+        void blit(Surface& surface, float x, float y)
+        {
+            screenSurface->blit(surface, x, y);
+        }
+
+        void end_frame()
+        {
+            CGAME_PROFILE_ZONE("Window::end_frame");
+            jobs::pump_main();
+            if (dirtyMode)
+            {
+                update();
+                return;
+            }
+
+            batch::flush();
+            SDL_RenderPresent(m_renderer);
+        }
+
+        // In dirty-rect mode the screen surface keeps its pixels between frames, begin_frame no
+        // longer clears, and end_frame presents only the areas drawn since the last update.
+        void set_dirty_mode(bool enabled)
+        {
+            dirtyMode = enabled;
+            screenSurface->set_dirty_tracking(enabled);
+            pending.set_bounds(m_width, m_height);
+        }
+
+        // Presents the areas of the screen surface drawn since the last update plus the given rects,
+        // or the whole frame outside dirty-rect mode. Nothing is presented when nothing changed.
+        void update(const std::vector<Rect>& rects = {})
+        {
+            CGAME_PROFILE_ZONE("Window::update");
+            batch::flush();
+
+            if (!dirtyMode)
+            {
+                SDL_RenderPresent(m_renderer);
+                return;
+            }
+
+            pending.clear();
+            if (screenSurface->get_dirty().is_full())
+                pending.add_all();
+            for (const SDL_Rect& r : screenSurface->get_dirty().get_rects())
+                pending.add({ (float)r.x, (float)r.y, (float)r.w, (float)r.h });
+            for (const Rect& r : rects)
+                pending.add(r);
+            screenSurface->clear_dirty();
+
+            if (pending.is_empty())
+                return;
+            if (!softwareRenderer)
+                pending.add_all();
+
+            // The backbuffer isn't cleared in dirty mode, so blending would stack translucent
+            // pixels on whatever the last present left there.
+            SDL_Texture* screenTex = screenSurface->get_surface();
+            SDL_BlendMode blendMode = SDL_BLENDMODE_BLEND;
+            SDL_GetTextureBlendMode(screenTex, &blendMode);
+            SDL_SetTextureBlendMode(screenTex, SDL_BLENDMODE_NONE);
+            for (const SDL_Rect& r : pending.get_rects())
+                SDL_RenderCopy(m_renderer, screenTex, &r, &r);
+            SDL_SetTextureBlendMode(screenTex, blendMode);
+
+            if (softwareRenderer && !pending.is_full())
+            {
+                SDL_RenderFlush(m_renderer);
+                SDL_UpdateWindowSurfaceRects(m_window, pending.get_rects().data(), static_cast<int>(pending.get_rects().size()));
+            }
+            else
+            {
+                SDL_RenderPresent(m_renderer);
+            }
+        }
+
+        void set_title(std::string title)
+        {
+            SDL_SetWindowTitle(m_window, title.c_str());
+        }
+
+        SDL_Renderer* get_renderer() { return m_renderer; }
+        SDL_Window* get_window() { return m_window; }
+        Surface& get_screen_surface() { return *screenSurface; }
+        bool is_dirty_mode() const { return dirtyMode; }
+        int get_width() { return m_width; }
+        int get_height() { return m_height; }
+        std::string get_title() { return m_title; }
+
+    private:
+        SDL_Renderer* m_renderer;
+        SDL_Window* m_window;
+        Surface* screenSurface;
+
+        int m_width, m_height;
+        std::string m_title;
+
+        bool dirtyMode = false;
+        bool softwareRenderer = false;
+        DirtyRegion pending;
+    };
+
+    namespace display
+    {
+        static Window* window = nullptr;
+
+        inline Window& set_mode(int width, int height)
+        {
+            window = new Window(width, height, "cgame window");
+            return *window;
+        }
+
+        inline void set_caption(std::string caption)
+        {
+            if (window)
+            {
+                window->set_title(caption);
+            }
+        }
+
+        inline int get_width()
+        {
+            return window->get_width();
+        }
+
+        inline int get_height()
+        {
+            return window->get_height();
+        }
+
+        inline Vec2 get_size()
+        {
+            return { (float)window->get_width(), (float)window->get_height() };
+        }
+
+        inline SDL_Renderer* get_renderer()
+        {
+            return window->get_renderer();
+        }
+
+        inline void set_dirty_mode(bool enabled)
+        {
+            window->set_dirty_mode(enabled);
+        }
+
+        inline void update(const std::vector<Rect>& rects)
+        {
+            window->update(rects);
+        }
+
+        inline void update()
+        {
+            window->update();
+        }
+
+        // Redraws and presents the whole screen surface, even in dirty-rect mode.
+        inline void flip()
+        {
+            window->get_screen_surface().mark_dirty();
+            window->update();
+        }
+    }
+
+    namespace draw
+    {
+        static constexpr int MIN_CIRCLE_SEGMENTS = 8;
+        static constexpr int MAX_CIRCLE_SEGMENTS = 256;
+        static constexpr float MITER_LIMIT = 4.0f;
+
+        // Enough segments to keep every chord within a quarter pixel of the curve.
+        inline int circle_segments(float radius)
+        {
+            if (radius <= 1.0f)
+                return MIN_CIRCLE_SEGMENTS;
+
+            int n = static_cast<int>(std::ceil(math::PI / std::acos(1.0f - 0.25f / radius)));
+            return std::clamp(n, MIN_CIRCLE_SEGMENTS, MAX_CIRCLE_SEGMENTS);
+        }
+
+        // Tessellated shapes are lists of quads, four corners each, relative to an anchor point so a
+        // shape drawn somewhere else reuses the same entry. Keys are the exact shape parameters.
+        class ShapeCache
+        {
+        public:
+            static constexpr size_t MAX_SHAPES = 512;
+
+            struct Stats
+            {
+                int hits = 0;
+                int misses = 0;
+            };
+
+            template <typename Fn>
+            const std::vector<SDL_FPoint>& get(const std::vector<float>& key, Fn tessellate)
+            {
+                Uint64 hash = 14695981039346656037ull;
+                for (float value : key)
+                {
+                    Uint32 bits;
+                    std::memcpy(&bits, &value, sizeof(bits));
+                    for (int i = 0; i < 4; i++)
+                    {
+                        hash ^= (bits >> (i * 8)) & 0xFF;
+                        hash *= 1099511628211ull;
+                    }
+                }
+
+                auto it = shapes.find(hash);
+                if (it != shapes.end() && it->second.key == key)
+                {
+                    stats.hits++;
+                    return it->second.quads;
+                }
+
+                if (it == shapes.end())
+                {
+                    if (shapes.size() >= MAX_SHAPES)
+                        shapes.clear();
+                    it = shapes.emplace(hash, Shape()).first;
+                }
+
+                it->second.key = key;
+                it->second.quads.clear();
+                tessellate(it->second.quads);
+                stats.misses++;
+                return it->second.quads;
+            }
+
+            void clear() { shapes.clear(); }
+            size_t size() const { return shapes.size(); }
+            const Stats& get_stats() const { return stats; }
+            void reset_stats() { stats = Stats(); }
+
+        private:
+            struct Shape
+            {
+                std::vector<float> key;
+                std::vector<SDL_FPoint> quads;
+            };
+
+            std::unordered_map<Uint64, Shape> shapes;
+            Stats stats;
+        };
+
+        static ShapeCache shapeCache;
+        static std::vector<float> shapeKey;
+        static std::vector<Vec2> pathScratch;
+        static std::vector<SDL_FRect> rectScratch;
+        static std::vector<SDL_FPoint> pointScratch;
+        static std::vector<SDL_Vertex> geometryVertices;
+        static std::vector<int> geometryIndices;
+
+        enum ShapeKind
+        {
+            SHAPE_ELLIPSE = 1,
+            SHAPE_FILLED_ELLIPSE,
+            SHAPE_STROKE,
+            SHAPE_CLOSED_STROKE,
+            SHAPE_FILLED_POLYGON
+        };
+
+        inline void push_quad(std::vector<SDL_FPoint>& out, Vec2 a, Vec2 b, Vec2 c, Vec2 d)
+        {
+            out.push_back({ a.x, a.y });
+            out.push_back({ b.x, b.y });
+            out.push_back({ c.x, c.y });
+            out.push_back({ d.x, d.y });
+        }
+
+        inline void tessellate_ellipse(std::vector<SDL_FPoint>& out, float rx, float ry, float width)
+        {
+            int segments = circle_segments(std::max(rx, ry));
+            float innerX = std::max(rx - width, 0.0f), innerY = std::max(ry - width, 0.0f);
+            auto point = [&](int i, float x, float y)
+            {
+                float angle = 2.0f * math::PI * (i % segments) / segments;
+                return Vec2(x * std::cos(angle), y * std::sin(angle));
+            };
+
+            // Filled: a fan from the centre, two triangles per quad.
+            if (width <= 0.0f || innerX <= 0.0f || innerY <= 0.0f)
+            {
+                for (int i = 0; i < segments; i += 2)
+                    push_quad(out, Vec2(), point(i, rx, ry), point(i + 1, rx, ry), point(std::min(i + 2, segments), rx, ry));
+                return;
+            }
+
+            for (int i = 0; i < segments; i++)
+                push_quad(out, point(i, rx, ry), point(i + 1, rx, ry), point(i + 1, innerX, innerY), point(i, innerX, innerY));
+        }
+
+        // Quads along a path, width centred on it. Joins are mitred up to MITER_LIMIT times the half width.
+        inline void tessellate_stroke(std::vector<SDL_FPoint>& out, const Vec2* points, size_t count, bool closed, float width)
+        {
+            if (count < 2)
+                return;
+
+            float half = width / 2;
+            size_t segments = closed ? count : count - 1;
+            auto offset = [&](size_t i)
+            {
+                bool hasIn = closed || i > 0, hasOut = closed || i + 1 < count;
+                Vec2 normalIn = hasIn ? (points[i] - points[(i + count - 1) % count]).normalize().perpendicular() : Vec2();
+                Vec2 normalOut = hasOut ? (points[(i + 1) % count] - points[i]).normalize().perpendicular() : Vec2();
+                if (!hasIn)
+                    return normalOut * half;
+                if (!hasOut)
+                    return normalIn * half;
+
+                Vec2 miter = (normalIn + normalOut).normalize();
+                float cosine = miter.dot(normalOut);
+                if (cosine < 1.0f / MITER_LIMIT)
+                    return normalOut * half;
+                return miter * (half / cosine);
+            };
+
+            Vec2 first = offset(0), start = first;
+            for (size_t i = 0; i < segments; i++)
+            {
+                size_t next = (i + 1) % count;
+                Vec2 end = next == 0 ? first : offset(next);
+                push_quad(out, points[i] + start, points[next] + end, points[next] - end, points[i] - start);
+                start = end;
+            }
+        }
+
+        // Ear clipping, so concave polygons fill correctly. Self-intersecting ones fall back to a fan.
+        inline void tessellate_polygon(std::vector<SDL_FPoint>& out, const Vec2* points, size_t count)
+        {
+            if (count < 3)
+                return;
+
+            float area = 0.0f;
+            for (size_t i = 0; i < count; i++)
+                area += points[i].cross(points[(i + 1) % count]);
+            float winding = area < 0.0f ? -1.0f : 1.0f;
+
+            std::vector<int> remaining(count);
+            for (size_t i = 0; i < count; i++)
+                remaining[i] = static_cast<int>(i);
+
+            auto inside = [](Vec2 p, Vec2 a, Vec2 b, Vec2 c, float w)
+            {
+                return (b - a).cross(p - a) * w >= 0.0f && (c - b).cross(p - b) * w >= 0.0f && (a - c).cross(p - c) * w >= 0.0f;
+            };
+
+            size_t misses = 0;
+            size_t i = 0;
+            while (remaining.size() > 3 && misses < remaining.size())
+            {
+                size_t n = remaining.size();
+                Vec2 a = points[remaining[(i + n - 1) % n]], b = points[remaining[i % n]], c = points[remaining[(i + 1) % n]];
+
+                bool ear = (b - a).cross(c - b) * winding > 0.0f;
+                for (size_t k = 0; ear && k < n; k++)
+                {
+                    Vec2 p = points[remaining[k]];
+                    if (k != (i + n - 1) % n && k != i % n && k != (i + 1) % n && inside(p, a, b, c, winding))
+                        ear = false;
+                }
+
+                if (ear)
+                {
+                    push_quad(out, a, b, c, c);
+                    remaining.erase(remaining.begin() + i % n);
+                    misses = 0;
+                }
+                else
+                {
+                    i++;
+                    misses++;
+                }
+                i %= remaining.size();
+            }
+
+            for (size_t k = 1; k + 1 < remaining.size(); k++)
+                push_quad(out, points[remaining[0]], points[remaining[k]], points[remaining[k + 1]], points[remaining[k + 1]]);
+        }
+
+        // One SDL_RenderGeometry call for every quad, or straight into the batch while it's active.
+        inline void fill_quads(Surface& surface, const SDL_FPoint* corners, size_t quadCount, Vec2 origin, Color color)
+        {
+            if (quadCount == 0)
+                return;
+
+            float x0 = corners[0].x, y0 = corners[0].y, x1 = x0, y1 = y0;
+            for (size_t i = 1; i < quadCount * 4; i++)
+            {
+                x0 = std::min(x0, corners[i].x);
+                y0 = std::min(y0, corners[i].y);
+                x1 = std::max(x1, corners[i].x);
+                y1 = std::max(y1, corners[i].y);
+            }
+            surface.mark_dirty({ origin.x + x0, origin.y + y0, x1 - x0 + 1, y1 - y0 + 1 });
+
+            SDL_Renderer* renderer = display::get_renderer();
+            SDL_Color sdlColor = color.to_sdl();
+            if (batch::is_active())
+            {
+                SDL_Vertex v[4];
+                for (size_t q = 0; q < quadCount; q++)
+                {
+                    for (int k = 0; k < 4; k++)
+                    {
+                        const SDL_FPoint& p = corners[q * 4 + k];
+                        v[k] = { { origin.x + p.x, origin.y + p.y }, sdlColor, { 0, 0 } };
+                    }
+                    batch::quad(renderer, surface.get_surface(), NULL, v);
+                }
+                return;
+            }
+
+            geometryVertices.clear();
+            for (size_t i = 0; i < quadCount * 4; i++)
+                geometryVertices.push_back({ { origin.x + corners[i].x, origin.y + corners[i].y }, sdlColor, { 0, 0 } });
+            while (geometryIndices.size() < quadCount * 6)
+            {
+                int base = static_cast<int>(geometryIndices.size() / 6) * 4;
+                geometryIndices.insert(geometryIndices.end(), { base, base + 1, base + 2, base + 2, base + 3, base });
+            }
+
+            SDL_Texture* prevTarget = SDL_GetRenderTarget(renderer);
+            SDL_SetRenderTarget(renderer, surface.get_surface());
+            SDL_RenderGeometry(renderer, NULL, geometryVertices.data(), static_cast<int>(quadCount * 4),
+                               geometryIndices.data(), static_cast<int>(quadCount * 6));
+            SDL_SetRenderTarget(renderer, prevTarget);
+        }
+
+        inline void fill_quads(Surface& surface, const std::vector<SDL_FPoint>& corners, Vec2 origin, Color color)
+        {
+            fill_quads(surface, corners.data(), corners.size() / 4, origin, color);
+        }
+
+        inline void rect(Surface& surface, Rect rect, Color color = { 0, 0, 0, 255 })
+        {
+            CGAME_PROFILE_ZONE("draw::rect");
+            surface.mark_dirty(rect);
+            if (batch::is_active())
+            {
+                batch::rect(display::get_renderer(), surface.get_surface(), rect.to_sdl_frect(), color.to_sdl());
+                return;
+            }
+
+            SDL_Texture* prevTarget = SDL_GetRenderTarget(display::get_renderer());
+            SDL_SetRenderTarget(display::get_renderer(), surface.get_surface());
+            SDL_SetRenderDrawColor(display::get_renderer(), color.r, color.g, color.b, color.a);
+            SDL_FRect sdlRect = rect.to_sdl_frect();
+            SDL_RenderDrawRectF(display::get_renderer(), &sdlRect);
+            SDL_SetRenderTarget(display::get_renderer(), prevTarget);
+        }
+
+        inline void fill_rect(Surface& surface, Rect rect, Color color = { 0, 0, 0, 255 })
+        {
+            CGAME_PROFILE_ZONE("draw::fill_rect");
+            surface.mark_dirty(rect);
+            if (batch::is_active())
+            {
+                batch::fill_rect(display::get_renderer(), surface.get_surface(), rect.to_sdl_frect(), color.to_sdl());
+                return;
+            }
+
+            SDL_Texture* prevTarget = SDL_GetRenderTarget(display::get_renderer());
+            SDL_SetRenderTarget(display::get_renderer(), surface.get_surface());
+            SDL_SetRenderDrawColor(display::get_renderer(), color.r, color.g, color.b, color.a);
+            SDL_FRect sdlRect = rect.to_sdl_frect();
+            SDL_RenderFillRectF(display::get_renderer(), &sdlRect);
+            SDL_SetRenderTarget(display::get_renderer(), prevTarget);
+        }
+
+        // Outlines every rect with one target switch and one SDL call.
+        inline void rects(Surface& surface, const std::vector<Rect>& rects, Color color = { 0, 0, 0, 255 })
+        {
+            CGAME_PROFILE_ZONE("draw::rects");
+            if (rects.empty())
+                return;
+
+            for (const Rect& r : rects)
+                surface.mark_dirty(r);
+
+            if (batch::is_active())
+            {
+                for (const Rect& r : rects)
+                    batch::rect(display::get_renderer(), surface.get_surface(), r.to_sdl_frect(), color.to_sdl());
+                return;
+            }
+
+            rectScratch.clear();
+            for (const Rect& r : rects)
+                rectScratch.push_back(r.to_sdl_frect());
+
+            SDL_Texture* prevTarget = SDL_GetRenderTarget(display::get_renderer());
+            SDL_SetRenderTarget(display::get_renderer(), surface.get_surface());
+            SDL_SetRenderDrawColor(display::get_renderer(), color.r, color.g, color.b, color.a);
+            SDL_RenderDrawRectsF(display::get_renderer(), rectScratch.data(), static_cast<int>(rectScratch.size()));
+            SDL_SetRenderTarget(display::get_renderer(), prevTarget);
+        }
+
+        inline void fill_rects(Surface& surface, const std::vector<Rect>& rects, Color color = { 0, 0, 0, 255 })
+        {
+            CGAME_PROFILE_ZONE("draw::fill_rects");
+            if (rects.empty())
+                return;
+
+            for (const Rect& r : rects)
+                surface.mark_dirty(r);
+
+            if (batch::is_active())
+            {
+                for (const Rect& r : rects)
+                    batch::fill_rect(display::get_renderer(), surface.get_surface(), r.to_sdl_frect(), color.to_sdl());
+                return;
+            }
+
+            rectScratch.clear();
+            for (const Rect& r : rects)
+                rectScratch.push_back(r.to_sdl_frect());
+
+            SDL_Texture* prevTarget = SDL_GetRenderTarget(display::get_renderer());
+            SDL_SetRenderTarget(display::get_renderer(), surface.get_surface());
+            SDL_SetRenderDrawColor(display::get_renderer(), color.r, color.g, color.b, color.a);
+            SDL_RenderFillRectsF(display::get_renderer(), rectScratch.data(), static_cast<int>(rectScratch.size()));
+            SDL_SetRenderTarget(display::get_renderer(), prevTarget);
+        }
+
+        // A polyline through points. Width 1 outside a batch uses SDL's own line drawing; anything
+        // else is tessellated into quads and cached.
+        inline void lines(Surface& surface, const std::vector<Vec2>& points, Color color = { 0, 0, 0, 255 }, bool closed = false, float width = 1.0f)
+        {
+            CGAME_PROFILE_ZONE("draw::lines");
+            if (points.size() < 2 || width <= 0.0f)
+                return;
+
+            if (width == 1.0f && !batch::is_active())
+            {
+                float x0 = points[0].x, y0 = points[0].y, x1 = x0, y1 = y0;
+                pointScratch.clear();
+                for (const Vec2& p : points)
+                {
+                    pointScratch.push_back({ p.x, p.y });
+                    x0 = std::min(x0, p.x);
+                    y0 = std::min(y0, p.y);
+                    x1 = std::max(x1, p.x);
+                    y1 = std::max(y1, p.y);
+                }
+                if (closed)
+                    pointScratch.push_back(pointScratch.front());
+                surface.mark_dirty({ x0, y0, x1 - x0 + 1, y1 - y0 + 1 });
+
+                SDL_Texture* prevTarget = SDL_GetRenderTarget(display::get_renderer());
+                SDL_SetRenderTarget(display::get_renderer(), surface.get_surface());
+                SDL_SetRenderDrawColor(display::get_renderer(), color.r, color.g, color.b, color.a);
+                SDL_RenderDrawLinesF(display::get_renderer(), pointScratch.data(), static_cast<int>(pointScratch.size()));
+                SDL_SetRenderTarget(display::get_renderer(), prevTarget);
+                return;
+            }
+
+            // Consecutive duplicates have no direction to offset along.
+            Vec2 origin = points[0];
+            pathScratch.clear();
+            for (const Vec2& p : points)
+            {
+                if (pathScratch.empty() || p - origin != pathScratch.back())
+                    pathScratch.push_back(p - origin);
+            }
+            if (closed && pathScratch.size() > 2 && pathScratch.back() == pathScratch.front())
+                pathScratch.pop_back();
+            if (pathScratch.size() < 2)
+                return;
+
+            shapeKey.assign({ static_cast<float>(closed ? SHAPE_CLOSED_STROKE : SHAPE_STROKE), width });
+            for (const Vec2& p : pathScratch)
+                shapeKey.insert(shapeKey.end(), { p.x, p.y });
+
+            const std::vector<SDL_FPoint>& quads = shapeCache.get(shapeKey, [&](std::vector<SDL_FPoint>& out)
+            {
+                tessellate_stroke(out, pathScratch.data(), pathScratch.size(), closed, width);
+            });
+            fill_quads(surface, quads, origin, color);
+        }
+
+        inline void line(Surface& surface, Vec2 start, Vec2 end, Color color = { 0, 0, 0, 255 }, float width = 1.0f)
+        {
+            CGAME_PROFILE_ZONE("draw::line");
+            if (width <= 0.0f)
+                return;
+
+            if (width == 1.0f && !batch::is_active())
+            {
+                surface.mark_dirty({ std::min(start.x, end.x), std::min(start.y, end.y), std::abs(end.x - start.x) + 1, std::abs(end.y - start.y) + 1 });
+                SDL_Texture* prevTarget = SDL_GetRenderTarget(display::get_renderer());
+                SDL_SetRenderTarget(display::get_renderer(), surface.get_surface());
+                SDL_SetRenderDrawColor(display::get_renderer(), color.r, color.g, color.b, color.a);
+                SDL_RenderDrawLineF(display::get_renderer(), start.x, start.y, end.x, end.y);
+                SDL_SetRenderTarget(display::get_renderer(), prevTarget);
+                return;
+            }
+
+            // A single quad is cheaper to build than to look up.
+            if (start == end)
+                return;
+            Vec2 offset = (end - start).normalize().perpendicular() * (width / 2);
+            SDL_FPoint corners[4];
+            Vec2 quad[4] = { start + offset, end + offset, end - offset, start - offset };
+            for (int i = 0; i < 4; i++)
+                corners[i] = { quad[i].x, quad[i].y };
+            fill_quads(surface, corners, 1, Vec2(), color);
+        }
+
+        // Outlines grow inwards from the edge, like pygame's; a width past the radius fills.
+        inline void ellipse(Surface& surface, Rect bounds, Color color = { 0, 0, 0, 255 }, float width = 1.0f)
+        {
+            CGAME_PROFILE_ZONE("draw::ellipse");
+            float rx = bounds.w / 2, ry = bounds.h / 2;
+            if (rx <= 0.0f || ry <= 0.0f || width <= 0.0f)
+                return;
+
+            shapeKey.assign({ static_cast<float>(SHAPE_ELLIPSE), rx, ry, width });
+            const std::vector<SDL_FPoint>& quads = shapeCache.get(shapeKey, [&](std::vector<SDL_FPoint>& out)
+            {
+                tessellate_ellipse(out, rx, ry, width);
+            });
+            fill_quads(surface, quads, Vec2(bounds.x + rx, bounds.y + ry), color);
+        }
+
+        inline void fill_ellipse(Surface& surface, Rect bounds, Color color = { 0, 0, 0, 255 })
+        {
+            CGAME_PROFILE_ZONE("draw::fill_ellipse");
+            float rx = bounds.w / 2, ry = bounds.h / 2;
+            if (rx <= 0.0f || ry <= 0.0f)
+                return;
+
+            shapeKey.assign({ static_cast<float>(SHAPE_FILLED_ELLIPSE), rx, ry });
+            const std::vector<SDL_FPoint>& quads = shapeCache.get(shapeKey, [&](std::vector<SDL_FPoint>& out)
+            {
+                tessellate_ellipse(out, rx, ry, 0.0f);
+            });
+            fill_quads(surface, quads, Vec2(bounds.x + rx, bounds.y + ry), color);
+        }
+
+        inline void circle(Surface& surface, Vec2 center, float radius, Color color = { 0, 0, 0, 255 }, float width = 1.0f)
+        {
+            ellipse(surface, Rect(center.x - radius, center.y - radius, radius * 2, radius * 2), color, width);
+        }
+
+        inline void fill_circle(Surface& surface, Vec2 center, float radius, Color color = { 0, 0, 0, 255 })
+        {
+            fill_ellipse(surface, Rect(center.x - radius, center.y - radius, radius * 2, radius * 2), color);
+        }
+
+        inline void polygon(Surface& surface, const std::vector<Vec2>& points, Color color = { 0, 0, 0, 255 }, float width = 1.0f)
+        {
+            lines(surface, points, color, true, width);
+        }
+
+        inline void fill_polygon(Surface& surface, const std::vector<Vec2>& points, Color color = { 0, 0, 0, 255 })
+        {
+            CGAME_PROFILE_ZONE("draw::fill_polygon");
+            if (points.size() < 3)
+                return;
+
+            Vec2 origin = points[0];
+            shapeKey.assign({ static_cast<float>(SHAPE_FILLED_POLYGON) });
+            for (const Vec2& p : points)
+                shapeKey.insert(shapeKey.end(), { p.x - origin.x, p.y - origin.y });
+
+            const std::vector<SDL_FPoint>& quads = shapeCache.get(shapeKey, [&](std::vector<SDL_FPoint>& out)
+            {
+                pathScratch.clear();
+                for (const Vec2& p : points)
+                    pathScratch.push_back(p - origin);
+                tessellate_polygon(out, pathScratch.data(), pathScratch.size());
+            });
+            fill_quads(surface, quads, origin, color);
+        }
+    }
+
+    namespace tilemap
+    {
+        static constexpr Uint16 EMPTY = 0;
+        static constexpr int CHUNK_TILES = 16;
+
+        // Tile n (1-based; 0 is EMPTY) is the n-th cell of a sheet, left to right, top to bottom.
+        class Tileset
+        {
+        public:
+            Tileset() = default;
+
+            Tileset(const Surface& sheet, int _tileWidth, int _tileHeight, int _spacing = 0, int _margin = 0)
+                : texture(sheet.get_surface()), region(sheet.get_region()),
+                  tileWidth(_tileWidth), tileHeight(_tileHeight), spacing(_spacing), margin(_margin)
+            {
+                SDL_QueryTexture(texture, NULL, NULL, &textureWidth, &textureHeight);
+                columns = std::max(0, (region.w - 2 * margin + spacing) / (tileWidth + spacing));
+                int rows = std::max(0, (region.h - 2 * margin + spacing) / (tileHeight + spacing));
+                count = columns * rows;
+            }
+
+            // Texture-space source rect of a tile.
+            bool get_source(Uint16 id, SDL_Rect& out) const
+            {
+                if (id == EMPTY || id > count)
+                    return false;
+
+                int index = id - 1;
+                out.x = region.x + margin + (index % columns) * (tileWidth + spacing);
+                out.y = region.y + margin + (index / columns) * (tileHeight + spacing);
+                out.w = tileWidth;
+                out.h = tileHeight;
+                return true;
+            }
+
+            SDL_Texture* get_texture() const { return texture; }
+            int get_texture_width() const { return textureWidth; }
+            int get_texture_height() const { return textureHeight; }
+            int get_tile_width() const { return tileWidth; }
+            int get_tile_height() const { return tileHeight; }
+            int get_count() const { return count; }
+
+        private:
+            SDL_Texture* texture = NULL;
+            SDL_Rect region = { 0, 0, 0, 0 };
+            int textureWidth = 0, textureHeight = 0;
+            int tileWidth = 0, tileHeight = 0;
+            int spacing = 0, margin = 0;
+            int columns = 0, count = 0;
+        };
+
+        struct Stats
+        {
+            int chunksDrawn = 0;
+            int chunksBaked = 0;
+            int tilesDrawn = 0;
+            int chunksResident = 0;
+        };
+
+        // Tile ids in a flat grid per layer. Static layers are baked CHUNK_TILES x CHUNK_TILES at a
+        // time into chunk textures when a chunk first becomes visible, and re-baked only after a tile
+        // in it changes; drawing them costs one textured quad per visible chunk. Dynamic layers are
+        // drawn tile by tile each frame, culled to the view. Baked textures are recycled
+        // least-recently-drawn first once more than the cache limit exist.
+        class TileMap
+        {
+        public:
+            static constexpr int DEFAULT_CACHE_LIMIT = 256;
+
+            TileMap(SDL_Renderer* _renderer, const Tileset& _tileset, int _width, int _height, int layerCount = 1)
+                : renderer(_renderer), tileset(_tileset), width(std::max(_width, 0)), height(std::max(_height, 0))
+            {
+                chunksX = (width + CHUNK_TILES - 1) / CHUNK_TILES;
+                chunksY = (height + CHUNK_TILES - 1) / CHUNK_TILES;
+                layers.resize(std::max(layerCount, 1));
+                for (Layer& layer : layers)
+                {
+                    layer.tiles.assign(static_cast<size_t>(width) * height, EMPTY);
+                    layer.chunks.resize(static_cast<size_t>(chunksX) * chunksY);
+                }
+            }
+
+            ~TileMap()
+            {
+                for (Layer& layer : layers)
+                {
+                    for (Chunk& chunk : layer.chunks)
+                        destroy_texture(chunk.texture);
+                }
+                for (SDL_Texture* texture : freeTextures)
+                    destroy_texture(texture);
+            }
+
+            TileMap(const TileMap&) = delete;
+            TileMap& operator=(const TileMap&) = delete;
+            TileMap(TileMap&&) = default;
+            TileMap& operator=(TileMap&&) = delete;
+
+            void set(int x, int y, Uint16 id, int layer = 0)
+            {
+                if (!in_bounds(x, y) || !valid_layer(layer))
+                    return;
+
+                Layer& l = layers[layer];
+                Uint16& tile = l.tiles[static_cast<size_t>(y) * width + x];
+                if (tile == id)
+                    return;
+
+                Chunk& chunk = l.chunks[chunk_index(x / CHUNK_TILES, y / CHUNK_TILES)];
+                chunk.tiles += (id != EMPTY) - (tile != EMPTY);
+                chunk.dirty = true;
+                tile = id;
+            }
+
+            Uint16 get(int x, int y, int layer = 0) const
+            {
+                if (!in_bounds(x, y) || !valid_layer(layer))
+                    return EMPTY;
+                return layers[layer].tiles[static_cast<size_t>(y) * width + x];
+            }
+
+            // Row-major, width * height ids.
+            void set_tiles(const Uint16* ids, int layer = 0)
+            {
+                if (!valid_layer(layer))
+                    return;
+                for (int y = 0; y < height; y++)
+                {
+                    for (int x = 0; x < width; x++)
+                        set(x, y, ids[static_cast<size_t>(y) * width + x], layer);
+                }
+            }
+
+            void fill(Uint16 id, int layer = 0)
+            {
+                for (int y = 0; y < height; y++)
+                {
+                    for (int x = 0; x < width; x++)
+                        set(x, y, id, layer);
+                }
+            }
+
+            // Dynamic layers skip baking; use them for tiles that change most frames.
+            void set_static(int layer, bool isStatic)
+            {
+                if (!valid_layer(layer) || layers[layer].baked == isStatic)
+                    return;
+
+                layers[layer].baked = isStatic;
+                for (Chunk& chunk : layers[layer].chunks)
+                {
+                    release(chunk);
+                    chunk.dirty = true;
+                }
+            }
+
+            void set_visible(int layer, bool visible)
+            {
+                if (valid_layer(layer))
+                    layers[layer].visible = visible;
+            }
+
+            // Drops every baked chunk, e.g. after the tileset texture was redrawn.
+            void invalidate()
+            {
+                for (Layer& layer : layers)
+                {
+                    for (Chunk& chunk : layer.chunks)
+                        chunk.dirty = true;
+                }
+            }
+
+            void set_cache_limit(int chunks) { cacheLimit = std::max(chunks, 1); }
+
+            // Draws every visible layer. view is the world-space rect (in map pixels) shown on the
+            // target; it fills the whole target unless a viewport rect on the target is given.
+            void draw(Surface& target, const Rect& view)
+            {
+                draw(target, view, { 0, 0, target.get_width(), target.get_height() });
+            }
+
+            void draw(Surface& target, const Rect& view, const Rect& viewport)
+            {
+                for (int layer = 0; layer < static_cast<int>(layers.size()); layer++)
+                    draw_layer(target, layer, view, viewport);
+            }
+
+            // Chunks are drawn axis-aligned, so the camera's rotation is ignored here.
+            void draw(Surface& target, const Camera& camera)
+            {
+                Camera level = camera;
+                level.set_rotation(0.0f);
+                draw(target, level.get_view(), camera.get_viewport());
+            }
+
+            void draw_layer(Surface& target, int layer, const Rect& view)
+            {
+                draw_layer(target, layer, view, { 0, 0, target.get_width(), target.get_height() });
+            }
+
+            void draw_layer(Surface& target, int layer, const Rect& view, const Rect& viewport)
+            {
+                CGAME_PROFILE_ZONE("TileMap::draw_layer");
+                if (!valid_layer(layer) || !layers[layer].visible || view.w <= 0 || view.h <= 0)
+                    return;
+
+                int tw = tileset.get_tile_width(), th = tileset.get_tile_height();
+                if (tw <= 0 || th <= 0)
+                    return;
+
+                target.mark_dirty(viewport);
+
+                float scaleX = viewport.w / view.w, scaleY = viewport.h / view.h;
+                int x0 = std::max(0, static_cast<int>(std::floor(view.x / tw)));
+                int y0 = std::max(0, static_cast<int>(std::floor(view.y / th)));
+                int x1 = std::min(width, static_cast<int>(std::ceil((view.x + view.w) / tw)));
+                int y1 = std::min(height, static_cast<int>(std::ceil((view.y + view.h) / th)));
+                if (x1 <= x0 || y1 <= y0)
+                    return;
+
+                auto to_screen = [&](int tileX, int tileY, int tilesW, int tilesH)
+                {
+                    return SDL_FRect{ viewport.x + (tileX * tw - view.x) * scaleX, viewport.y + (tileY * th - view.y) * scaleY,
+                                      tilesW * tw * scaleX, tilesH * th * scaleY };
+                };
+
+                Layer& l = layers[layer];
+                serial++;
+
+                if (!l.baked)
+                {
+                    for (int y = y0; y < y1; y++)
+                    {
+                        for (int x = x0; x < x1; x++)
+                        {
+                            SDL_Rect src;
+                            if (tileset.get_source(l.tiles[static_cast<size_t>(y) * width + x], src))
+                            {
+                                copy(target, tileset.get_texture(), tileset.get_texture_width(), tileset.get_texture_height(), src, to_screen(x, y, 1, 1));
+                                stats.tilesDrawn++;
+                            }
+                        }
+                    }
+                    end_copies();
+                    return;
+                }
+
+                int cx0 = x0 / CHUNK_TILES, cy0 = y0 / CHUNK_TILES;
+                int cx1 = (x1 - 1) / CHUNK_TILES, cy1 = (y1 - 1) / CHUNK_TILES;
+
+                // Bake first, so target switches for baking don't interleave with the draws.
+                for (int cy = cy0; cy <= cy1; cy++)
+                {
+                    for (int cx = cx0; cx <= cx1; cx++)
+                    {
+                        Chunk& chunk = l.chunks[chunk_index(cx, cy)];
+                        chunk.lastUsed = serial;
+                        if (chunk.tiles > 0 && (chunk.dirty || !chunk.texture))
+                            bake(l, cx, cy);
+                    }
+                }
+
+                SDL_Rect src = { 0, 0, CHUNK_TILES * tw, CHUNK_TILES * th };
+                for (int cy = cy0; cy <= cy1; cy++)
+                {
+                    for (int cx = cx0; cx <= cx1; cx++)
+                    {
+                        Chunk& chunk = l.chunks[chunk_index(cx, cy)];
+                        if (chunk.tiles == 0 || !chunk.texture)
+                            continue;
+                        copy(target, chunk.texture, src.w, src.h, src, to_screen(cx * CHUNK_TILES, cy * CHUNK_TILES, CHUNK_TILES, CHUNK_TILES));
+                        stats.chunksDrawn++;
+                    }
+                }
+                end_copies();
+            }
+
+            int get_width() const { return width; }
+            int get_height() const { return height; }
+            int get_layer_count() const { return static_cast<int>(layers.size()); }
+            const Tileset& get_tileset() const { return tileset; }
+
+            // Tile coordinates under a world-space point; false outside the map.
+            bool tile_at(float worldX, float worldY, int& tileX, int& tileY) const
+            {
+                tileX = static_cast<int>(std::floor(worldX / tileset.get_tile_width()));
+                tileY = static_cast<int>(std::floor(worldY / tileset.get_tile_height()));
+                return in_bounds(tileX, tileY);
+            }
+
+            Stats get_stats() const
+            {
+                Stats result = stats;
+                result.chunksResident = resident;
+                return result;
+            }
+
+            void reset_stats() { stats = Stats(); }
+
+        private:
+            struct Chunk
+            {
+                SDL_Texture* texture = NULL;
+                bool dirty = true;
+                int tiles = 0;
+                Uint64 lastUsed = 0;
+            };
+
+            struct Layer
+            {
+                std::vector<Uint16> tiles;
+                std::vector<Chunk> chunks;
+                bool baked = true;
+                bool visible = true;
+            };
+
+            bool in_bounds(int x, int y) const { return x >= 0 && y >= 0 && x < width && y < height; }
+            bool valid_layer(int layer) const { return layer >= 0 && layer < static_cast<int>(layers.size()); }
+            size_t chunk_index(int cx, int cy) const { return static_cast<size_t>(cy) * chunksX + cx; }
+
+            void bake(Layer& layer, int cx, int cy)
+            {
+                Chunk& chunk = layer.chunks[chunk_index(cx, cy)];
+                if (!chunk.texture)
+                {
+                    chunk.texture = acquire_texture();
+                    if (!chunk.texture)
+                        return;
+                }
+
+                // Queued draws may still read this chunk or write the tileset.
+                batch::flush();
+
+                int tw = tileset.get_tile_width(), th = tileset.get_tile_height();
+                SDL_Texture* previousTarget = SDL_GetRenderTarget(renderer);
+                SDL_SetRenderTarget(renderer, chunk.texture);
+                SDL_SetRenderDrawColor(renderer, 0, 0, 0, 0);
+                SDL_RenderClear(renderer);
+
+                int baseX = cx * CHUNK_TILES, baseY = cy * CHUNK_TILES;
+                int endX = std::min(width, baseX + CHUNK_TILES), endY = std::min(height, baseY + CHUNK_TILES);
+                for (int y = baseY; y < endY; y++)
+                {
+                    for (int x = baseX; x < endX; x++)
+                    {
+                        SDL_Rect src;
+                        if (!tileset.get_source(layer.tiles[static_cast<size_t>(y) * width + x], src))
+                            continue;
+                        SDL_Rect dst = { (x - baseX) * tw, (y - baseY) * th, tw, th };
+                        SDL_RenderCopy(renderer, tileset.get_texture(), &src, &dst);
+                    }
+                }
+
+                SDL_SetRenderTarget(renderer, previousTarget);
+                chunk.dirty = false;
+                stats.chunksBaked++;
+            }
+
+            SDL_Texture* acquire_texture()
+            {
+                if (resident >= cacheLimit)
+                    evict_one();
+
+                SDL_Texture* texture = NULL;
+                if (!freeTextures.empty())
+                {
+                    texture = freeTextures.back();
+                    freeTextures.pop_back();
+                }
+                else
+                {
+                    int w = CHUNK_TILES * tileset.get_tile_width(), h = CHUNK_TILES * tileset.get_tile_height();
+                    texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_TARGET, w, h);
+                    if (!texture)
+                    {
+                        std::cerr << "Failed to create tilemap chunk texture: " << SDL_GetError() << std::endl;
+                        return NULL;
+                    }
+                    SDL_SetTextureBlendMode(texture, SDL_BLENDMODE_BLEND);
+                }
+                resident++;
+                return texture;
+            }
+
+            // Least recently drawn chunk that wasn't drawn by the current draw call.
+            void evict_one()
+            {
+                Chunk* oldest = NULL;
+                for (Layer& layer : layers)
+                {
+                    for (Chunk& chunk : layer.chunks)
+                    {
+                        if (chunk.texture && chunk.lastUsed != serial && (!oldest || chunk.lastUsed < oldest->lastUsed))
+                            oldest = &chunk;
+                    }
+                }
+                if (oldest)
+                    release(*oldest);
+            }
+
+            void release(Chunk& chunk)
+            {
+                if (!chunk.texture)
+                    return;
+                batch::flush_if_pending(chunk.texture);
+                freeTextures.push_back(chunk.texture);
+                chunk.texture = NULL;
+                chunk.dirty = true;
+                resident--;
+            }
+
+            void destroy_texture(SDL_Texture* texture)
+            {
+                if (!texture)
+                    return;
+                batch::flush_if_pending(texture);
+                SDL_DestroyTexture(texture);
+            }
+
+            // Queued through the sprite batch when it is active; otherwise drawn straight into the
+            // target, switching the render target once per layer.
+            void copy(Surface& target, SDL_Texture* texture, int texW, int texH, const SDL_Rect& src, const SDL_FRect& dst)
+            {
+                if (batch::is_active())
+                {
+                    batch::sprite(renderer, target.get_surface(), texture, texW, texH, src, dst, 0.0, SDL_FLIP_NONE, { 255, 255, 255, 255 });
+                    return;
+                }
+
+                if (!copying)
+                {
+                    previousTarget = SDL_GetRenderTarget(renderer);
+                    SDL_SetRenderTarget(renderer, target.get_surface());
+                    copying = true;
+                }
+                SDL_RenderCopyF(renderer, texture, &src, &dst);
+            }
+
+            void end_copies()
+            {
+                if (!copying)
+                    return;
+                SDL_SetRenderTarget(renderer, previousTarget);
+                copying = false;
+            }
+
+            SDL_Renderer* renderer;
+            Tileset tileset;
+            int width, height;
+            int chunksX = 0, chunksY = 0;
+            std::vector<Layer> layers;
+
+            std::vector<SDL_Texture*> freeTextures;
+            int resident = 0;
+            int cacheLimit = DEFAULT_CACHE_LIMIT;
+            Uint64 serial = 0;
+
+            bool copying = false;
+            SDL_Texture* previousTarget = NULL;
+            Stats stats;
+        };
+    }
+
+    namespace font
+    {
+        struct Glyph
+        {
+            SDL_Texture* page;
+            SDL_Rect src;
+            int offsetX;
+            int advance;
+        };
+
+        inline Uint32 next_codepoint(const std::string& text, size_t& i)
+        {
+            Uint8 c = static_cast<Uint8>(text[i++]);
+            if (c < 0x80)
+                return c;
+
+            int extra = (c >= 0xF0) ? 3 : (c >= 0xE0) ? 2 : (c >= 0xC0) ? 1 : 0;
+            Uint32 codepoint = c & (0x3F >> extra);
+            for (int k = 0; k < extra && i < text.size(); k++)
+                codepoint = (codepoint << 6) | (static_cast<Uint8>(text[i++]) & 0x3F);
+
+            return codepoint;
+        }
+
+        class GlyphAtlas
+        {
+        public:
+            static constexpr int PAGE_SIZE = 512;
+            static constexpr int PADDING = 1;
+
+            GlyphAtlas(SDL_Renderer* _renderer, TTF_Font* _font)
+                : renderer(_renderer), font(_font)
+            {
+                for (const Glyph*& g : ascii)
+                    g = nullptr;
+            }
+
+            ~GlyphAtlas()
+            {
+                for (SDL_Texture* page : pages)
+                {
+                    batch::flush_if_pending(page);
+                    SDL_DestroyTexture(page);
+                }
+            }
+
+            GlyphAtlas(const GlyphAtlas&) = delete;
+            GlyphAtlas& operator=(const GlyphAtlas&) = delete;
+
+            const Glyph* get(Uint32 codepoint)
+            {
+                if (codepoint < 128 && ascii[codepoint])
+                    return ascii[codepoint];
+
+                auto it = glyphs.find(codepoint);
+                if (it == glyphs.end())
+                    it = glyphs.emplace(codepoint, rasterize(codepoint)).first;
+
+                const Glyph* glyph = it->second.page ? &it->second : nullptr;
+                if (codepoint < 128)
+                    ascii[codepoint] = glyph;
+                return glyph;
+            }
+
+            int kerning(Uint32 previous, Uint32 codepoint)
+            {
+                return TTF_GetFontKerningSizeGlyphs32(font, previous, codepoint);
+            }
+
+            SDL_Renderer* get_renderer() const { return renderer; }
+            size_t get_page_count() const { return pages.size(); }
+
+        private:
+            Glyph rasterize(Uint32 codepoint)
+            {
+                Glyph glyph = { NULL, { 0, 0, 0, 0 }, 0, 0 };
+
+                int minx = 0, maxx = 0, miny = 0, maxy = 0, advance = 0;
+                if (TTF_GlyphMetrics32(font, codepoint, &minx, &maxx, &miny, &maxy, &advance) != 0)
+                    return glyph;
+                glyph.advance = advance;
+                glyph.offsetX = std::min(minx, 0);
+
+                SDL_Surface* rendered = TTF_RenderGlyph32_Blended(font, codepoint, { 255, 255, 255, 255 });
+                if (!rendered)
+                {
+                    std::cerr << "Failed to rasterize glyph " << codepoint << ": " << TTF_GetError() << std::endl;
+                    return glyph;
+                }
+
+                SDL_Surface* converted = SDL_ConvertSurfaceFormat(rendered, SDL_PIXELFORMAT_ARGB8888, 0);
+                SDL_FreeSurface(rendered);
+                if (!converted)
+                    return glyph;
+
+                if (converted->w > 0 && converted->h > 0 && reserve(converted->w, converted->h, glyph.src))
+                {
+                    glyph.page = pages.back();
+                    SDL_UpdateTexture(glyph.page, &glyph.src, converted->pixels, converted->pitch);
+                }
+
+                SDL_FreeSurface(converted);
+                return glyph;
+            }
+
+            bool reserve(int w, int h, SDL_Rect& out)
+            {
+                if (w + PADDING > PAGE_SIZE || h + PADDING > PAGE_SIZE)
+                    return false;
+
+                if (!pages.empty() && cursorX + w + PADDING > PAGE_SIZE)
+                {
+                    cursorX = 0;
+                    cursorY += shelfHeight;
+                    shelfHeight = 0;
+                }
+
+                if (pages.empty() || cursorY + h + PADDING > PAGE_SIZE)
+                {
+                    SDL_Texture* page = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STATIC, PAGE_SIZE, PAGE_SIZE);
+                    if (page == NULL)
+                    {
+                        std::cerr << "Failed to create glyph atlas page: " << SDL_GetError() << std::endl;
+                        return false;
+                    }
+                    SDL_SetTextureBlendMode(page, SDL_BLENDMODE_BLEND);
+
+                    pages.push_back(page);
+                    cursorX = 0;
+                    cursorY = 0;
+                    shelfHeight = 0;
+                }
+
+                out = { cursorX, cursorY, w, h };
+                cursorX += w + PADDING;
+                shelfHeight = std::max(shelfHeight, h + PADDING);
+                return true;
+            }
+
+            SDL_Renderer* renderer;
+            TTF_Font* font;
+
+            std::vector<SDL_Texture*> pages;
+            int cursorX = 0, cursorY = 0, shelfHeight = 0;
+
+            std::unordered_map<Uint32, Glyph> glyphs;
+            const Glyph* ascii[128];
+        };
+
+        struct Font
+        {
+            std::string filePath;
+            float size;
+            TTF_Font* font;
+
+            Font(std::string _filePath, float _size = 12.0f)
+                : filePath(_filePath), size(_size)
+            {
+                font = TTF_OpenFont(filePath.c_str(), size);
+                if (!font)
+                {
+                    std::cerr << "Failed to load font " << filePath << " " << TTF_GetError() << std::endl;
+                }
+            }
+
+            // Opens the font from memory that has to stay valid for the lifetime of the Font;
+            // _memory keeps its owner alive.
+            Font(std::string _filePath, const void* data, size_t dataSize, float _size, std::shared_ptr<const void> _memory = nullptr)
+                : filePath(_filePath), size(_size), memory(_memory)
+            {
+                font = TTF_OpenFontRW(SDL_RWFromConstMem(data, static_cast<int>(dataSize)), 1, static_cast<int>(size));
+                if (!font)
+                {
+                    std::cerr << "Failed to load font " << filePath << " " << TTF_GetError() << std::endl;
+                }
+            }
+
+            ~Font()
+            {
+                atlas.reset();
+                if (font)
+                    TTF_CloseFont(font);
+            }
+
+            Surface render(std::string content, Color color = { 0, 0, 0, 255 })
+            {
+                CGAME_PROFILE_ZONE("Font::render");
+                SDL_Surface* fontSurface = TTF_RenderText_Solid(font, content.c_str(), color.to_sdl());
+                if (!fontSurface)
+                {
+                    std::cerr << "Failed to render text surface: " << TTF_GetError() << std::endl;
+                    return Surface(display::get_renderer(), (SDL_Texture*)NULL);
+                }
+
+                SDL_Texture* tex = SDL_CreateTextureFromSurface(display::get_renderer(), fontSurface);
+                if (tex == NULL)
+                {
+                    std::cerr << "Failed to create texture from font surface: " << TTF_GetError() << std::endl;
+                    return Surface(display::get_renderer(), (SDL_Texture*)NULL);
+                }
+                SDL_FreeSurface(fontSurface);
+
+                return Surface(display::get_renderer(), tex);
+            }
+
+            void draw(Surface& surface, const std::string& content, float x, float y, Color color = { 0, 0, 0, 255 })
+            {
+                CGAME_PROFILE_ZONE("Font::draw");
+                GlyphAtlas* glyphAtlas = get_atlas();
+                if (!glyphAtlas)
+                    return;
+
+                SDL_Renderer* renderer = glyphAtlas->get_renderer();
+                SDL_Color vertexColor = color.to_sdl();
+                float lineSkip = static_cast<float>(TTF_FontLineSkip(font));
+
+                // Without an active batch the quads are grouped per atlas page here and drawn directly.
+                bool batched = batch::is_active();
+                std::vector<std::pair<SDL_Texture*, std::vector<SDL_Vertex>>> runs;
+
+                float penX = x, penY = y;
+                float minX = x, maxX = x, maxY = y;
+                Uint32 previous = 0;
+                size_t i = 0;
+                while (i < content.size())
+                {
+                    Uint32 codepoint = next_codepoint(content, i);
+                    if (codepoint == '\n')
+                    {
+                        penX = x;
+                        penY += lineSkip;
+                        previous = 0;
+                        continue;
+                    }
+
+                    if (previous)
+                        penX += glyphAtlas->kerning(previous, codepoint);
+                    previous = codepoint;
+
+                    const Glyph* glyph = glyphAtlas->get(codepoint);
+                    if (!glyph)
+                        continue;
+
+                    SDL_FRect dst = { penX + glyph->offsetX, penY, (float)glyph->src.w, (float)glyph->src.h };
+                    minX = std::min(minX, dst.x);
+                    maxX = std::max(maxX, dst.x + dst.w);
+                    maxY = std::max(maxY, dst.y + dst.h);
+                    float u0 = (float)glyph->src.x / GlyphAtlas::PAGE_SIZE, v0 = (float)glyph->src.y / GlyphAtlas::PAGE_SIZE;
+                    float u1 = (float)(glyph->src.x + glyph->src.w) / GlyphAtlas::PAGE_SIZE, v1 = (float)(glyph->src.y + glyph->src.h) / GlyphAtlas::PAGE_SIZE;
+
+                    SDL_Vertex quad[4];
+                    batch::set_quad(quad, dst, u0, v0, u1, v1, 0.0, vertexColor);
+
+                    if (batched)
+                    {
+                        batch::spriteBatch.quad(renderer, surface.get_surface(), glyph->page, quad);
+                    }
+                    else
+                    {
+                        if (runs.empty() || runs.back().first != glyph->page)
+                            runs.push_back({ glyph->page, {} });
+                        runs.back().second.insert(runs.back().second.end(), quad, quad + 4);
+                    }
+
+                    penX += glyph->advance;
+                }
+
+                surface.mark_dirty({ minX, y, maxX - minX, maxY - y });
+
+                if (runs.empty())
+                    return;
+
+                SDL_Texture* prevTarget = SDL_GetRenderTarget(renderer);
+                SDL_SetRenderTarget(renderer, surface.get_surface());
+                std::vector<int> indices;
+                for (auto& run : runs)
+                {
+                    int quadCount = static_cast<int>(run.second.size() / 4);
+                    indices.clear();
+                    for (int q = 0; q < quadCount; q++)
+                        indices.insert(indices.end(), { q * 4, q * 4 + 1, q * 4 + 2, q * 4 + 2, q * 4 + 3, q * 4 });
+                    SDL_RenderGeometry(renderer, run.first, run.second.data(), quadCount * 4, indices.data(), quadCount * 6);
+                }
+                SDL_SetRenderTarget(renderer, prevTarget);
+            }
+
+            Vec2 get_text_size(const std::string& content)
+            {
+                GlyphAtlas* glyphAtlas = get_atlas();
+                if (!glyphAtlas)
+                    return { 0, 0 };
+
+                float lineSkip = static_cast<float>(TTF_FontLineSkip(font));
+                float width = 0, lineWidth = 0, height = static_cast<float>(TTF_FontHeight(font));
+                Uint32 previous = 0;
+                size_t i = 0;
+                while (i < content.size())
+                {
+                    Uint32 codepoint = next_codepoint(content, i);
+                    if (codepoint == '\n')
+                    {
+                        width = std::max(width, lineWidth);
+                        lineWidth = 0;
+                        height += lineSkip;
+                        previous = 0;
+                        continue;
+                    }
+
+                    if (previous)
+                        lineWidth += glyphAtlas->kerning(previous, codepoint);
+                    previous = codepoint;
+
+                    if (const Glyph* glyph = glyphAtlas->get(codepoint))
+                        lineWidth += glyph->advance;
+                }
+
+                return { std::max(width, lineWidth), height };
+            }
+
+            void set_font_size(float _size)
+            {
+                size = _size;
+                atlas.reset();
+                TTF_SetFontSize(font, static_cast<int>(_size));
+            }
+
+        private:
+            GlyphAtlas* get_atlas()
+            {
+                if (!font)
+                    return nullptr;
+                if (!atlas)
+                    atlas.reset(new GlyphAtlas(display::get_renderer(), font));
+                return atlas.get();
+            }
+
+            std::unique_ptr<GlyphAtlas> atlas;
+            std::shared_ptr<const void> memory;
+        };
+    }
+
+    namespace mixer
+    {
+        enum LoopMode
+        {
+            LOOP_INFINITE = -1,
+            LOOP_NONE = 0
+        };
+
+        enum StealMode
+        {
+            STEAL_OLDEST,
+            STEAL_QUIETEST,
+            STEAL_NONE
+        };
+
+        // Handle to one playing instance of a Sound. It goes stale once that instance ends or its
+        // channel is stolen, after which every call is a no-op.
+        class Voice
+        {
+        public:
+            Voice() = default;
+            Voice(int _channel, Uint32 _generation)
+                : channel(_channel), generation(_generation) { }
+
+            // A voice on the mixing Engine; scale is the Sound's own volume, applied on top of set_volume.
+            Voice(Uint32 _engineId, float _engineScale, float _engineVolume)
+                : engineId(_engineId), engineScale(_engineScale), engineVolume(_engineVolume) { }
+
+            bool is_playing() const;
+            void stop();
+            void pause();
+            void resume();
+            void set_volume(float volume);
+            float get_volume() const;
+            void set_pan(float pan);
+            void set_pitch(float pitch);
+
+            int get_channel() const { return channel; }
+            explicit operator bool() const { return is_playing(); }
+
+        private:
+            int channel = -1;
+            Uint32 generation = 0;
+            Uint32 engineId = 0;
+            float engineScale = 1.0f;
+            float engineVolume = 1.0f;
+        };
+
+        struct VoiceStats
+        {
+            int channels = 0;
+            int active = 0;
+            size_t played = 0;
+            size_t stolen = 0;
+            size_t rejected = 0;
+        };
+
+        // Hands out SDL_mixer channels. Channels are allocated on demand up to maxChannels; past that a
+        // new voice steals the lowest-priority busy one (oldest or quietest among equals) or is
+        // rejected if everything playing outranks it. maxInstances caps overlapping copies of a chunk.
+        class VoiceManager
+        {
+        public:
+            static constexpr int DEFAULT_MAX_CHANNELS = 64;
+
+            void set_max_channels(int channels) { maxChannels = std::max(channels, 1); }
+            int get_max_channels() const { return maxChannels; }
+
+            Voice play(Mix_Chunk* chunk, int loops, int priority, int maxInstances, StealMode steal, float volume = 1.0f)
+            {
+                if (!chunk)
+                    return Voice();
+
+                refresh();
+
+                int channel = -1;
+                if (maxInstances > 0 && count_instances(chunk) >= maxInstances)
+                {
+                    channel = pick_victim(chunk, priority, steal);
+                    if (channel < 0)
+                    {
+                        stats.rejected++;
+                        return Voice();
+                    }
+                }
+
+                if (channel < 0)
+                    channel = free_channel();
+                if (channel < 0)
+                    channel = pick_victim(nullptr, priority, steal);
+                if (channel < 0)
+                {
+                    stats.rejected++;
+                    return Voice();
+                }
+
+                if (slots[channel].active)
+                {
+                    Mix_HaltChannel(channel);
+                    slots[channel].active = false;
+                    stats.stolen++;
+                }
+
+                if (Mix_PlayChannel(channel, chunk, loops) == -1)
+                {
+                    std::cerr << "Failed to play sound: " << Mix_GetError() << std::endl;
+                    return Voice();
+                }
+
+                Slot& slot = slots[channel];
+                slot.active = true;
+                slot.chunk = chunk;
+                slot.priority = priority;
+                slot.order = ++playCount;
+                slot.generation++;
+                set_channel_volume(channel, volume);
+
+                stats.played++;
+                return Voice(channel, slot.generation);
+            }
+
+            bool is_current(int channel, Uint32 generation) const
+            {
+                return channel >= 0 && channel < static_cast<int>(slots.size())
+                    && slots[channel].active && slots[channel].generation == generation;
+            }
+
+            bool is_playing(int channel, Uint32 generation)
+            {
+                if (!is_current(channel, generation))
+                    return false;
+                if (Mix_Playing(channel))
+                    return true;
+                slots[channel].active = false;
+                return false;
+            }
+
+            void stop(int channel)
+            {
+                Mix_HaltChannel(channel);
+                slots[channel].active = false;
+            }
+
+            void set_channel_volume(int channel, float volume)
+            {
+                volume = std::max(0.0f, std::min(volume, 1.0f));
+                slots[channel].volume = volume;
+                Mix_Volume(channel, static_cast<int>(volume * static_cast<float>(MIX_MAX_VOLUME) + 0.5f));
+            }
+
+            float get_channel_volume(int channel) const { return slots[channel].volume; }
+
+            void stop_all(Mix_Chunk* chunk)
+            {
+                for (size_t i = 0; i < slots.size(); i++)
+                {
+                    if (slots[i].active && slots[i].chunk == chunk)
+                        stop(static_cast<int>(i));
+                }
+            }
+
+            int count_instances(Mix_Chunk* chunk) const
+            {
+                int count = 0;
+                for (const Slot& slot : slots)
+                {
+                    if (slot.active && slot.chunk == chunk)
+                        count++;
+                }
+                return count;
+            }
+
+            VoiceStats get_stats()
+            {
+                refresh();
+                VoiceStats result = stats;
+                result.channels = static_cast<int>(slots.size());
+                for (const Slot& slot : slots)
+                    result.active += slot.active ? 1 : 0;
+                return result;
+            }
+
+            void reset_stats() { stats = VoiceStats(); }
+
+        private:
+            struct Slot
+            {
+                bool active = false;
+                Mix_Chunk* chunk = nullptr;
+                int priority = 0;
+                Uint64 order = 0;
+                Uint32 generation = 0;
+                float volume = 1.0f;
+            };
+
+            // SDL_mixer only reports finished channels through a callback on the audio thread, so
+            // slots are polled instead.
+            void refresh()
+            {
+                int allocated = Mix_AllocateChannels(-1);
+                if (static_cast<int>(slots.size()) != allocated)
+                    slots.resize(allocated);
+
+                for (size_t i = 0; i < slots.size(); i++)
+                {
+                    if (slots[i].active && !Mix_Playing(static_cast<int>(i)))
+                        slots[i].active = false;
+                }
+            }
+
+            int free_channel()
+            {
+                for (size_t i = 0; i < slots.size(); i++)
+                {
+                    // Channels played directly through SDL_mixer are busy without being tracked here.
+                    if (!slots[i].active && !Mix_Playing(static_cast<int>(i)))
+                        return static_cast<int>(i);
+                }
+
+                int allocated = static_cast<int>(slots.size());
+                if (allocated >= maxChannels)
+                    return -1;
+
+                int grown = Mix_AllocateChannels(std::min(std::max(allocated * 2, 8), maxChannels));
+                slots.resize(grown);
+                return grown > allocated ? allocated : -1;
+            }
+
+            // Lowest priority first; among equal priorities the oldest or quietest. Only voices at or
+            // below the new sound's priority can be taken. With chunk set, only its own instances count.
+            int pick_victim(Mix_Chunk* chunk, int priority, StealMode steal) const
+            {
+                if (steal == STEAL_NONE)
+                    return -1;
+
+                int best = -1;
+                for (size_t i = 0; i < slots.size(); i++)
+                {
+                    const Slot& slot = slots[i];
+                    if (!slot.active || slot.priority > priority || (chunk && slot.chunk != chunk))
+                        continue;
+
+                    if (best < 0 || better_victim(slot, slots[best], steal))
+                        best = static_cast<int>(i);
+                }
+                return best;
+            }
+
+            static bool better_victim(const Slot& a, const Slot& b, StealMode steal)
+            {
+                if (a.priority != b.priority)
+                    return a.priority < b.priority;
+
+                if (steal == STEAL_QUIETEST)
+                {
+                    float loudA = a.volume * a.chunk->volume;
+                    float loudB = b.volume * b.chunk->volume;
+                    if (loudA != loudB)
+                        return loudA < loudB;
+                }
+                return a.order < b.order;
+            }
+
+            std::vector<Slot> slots;
+            int maxChannels = DEFAULT_MAX_CHANNELS;
+            Uint64 playCount = 0;
+            VoiceStats stats;
+        };
+
+        static VoiceManager voices;
+
+        // dst[i] += src[i] * gain, where gain alternates gainL/gainR across interleaved stereo
+        // samples. Mono buffers pass the same gain twice.
+        inline void mix_scaled_scalar(float* dst, const float* src, size_t count, float gainL, float gainR)
+        {
+            size_t i = 0;
+            for (; i + 1 < count; i += 2)
+            {
+                dst[i] += src[i] * gainL;
+                dst[i + 1] += src[i + 1] * gainR;
+            }
+            if (i < count)
+                dst[i] += src[i] * gainL;
+        }
+
+        inline void mix_scaled(float* dst, const float* src, size_t count, float gainL, float gainR)
+        {
+            size_t i = 0;
+#if defined(CGAME_AVX2)
+            __m256 gain = _mm256_setr_ps(gainL, gainR, gainL, gainR, gainL, gainR, gainL, gainR);
+            for (; i + 8 <= count; i += 8)
+                _mm256_storeu_ps(dst + i, _mm256_add_ps(_mm256_loadu_ps(dst + i), _mm256_mul_ps(_mm256_loadu_ps(src + i), gain)));
+#elif defined(CGAME_SSE2)
+            __m128 gain = _mm_setr_ps(gainL, gainR, gainL, gainR);
+            for (; i + 4 <= count; i += 4)
+                _mm_storeu_ps(dst + i, _mm_add_ps(_mm_loadu_ps(dst + i), _mm_mul_ps(_mm_loadu_ps(src + i), gain)));
+#endif
+            mix_scaled_scalar(dst + i, src + i, count - i, gainL, gainR);
+        }
+
+        inline void s16_to_float_scalar(const Sint16* src, float* dst, size_t count)
+        {
+            for (size_t i = 0; i < count; i++)
+                dst[i] = static_cast<float>(src[i]) * (1.0f / 32768.0f);
+        }
+
+        inline void s16_to_float(const Sint16* src, float* dst, size_t count)
+        {
+            size_t i = 0;
+#if defined(CGAME_AVX2) || defined(CGAME_SSE2)
+            const __m128 scale = _mm_set1_ps(1.0f / 32768.0f);
+            for (; i + 8 <= count; i += 8)
+            {
+                __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+                __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(s, s), 16);
+                __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(s, s), 16);
+                _mm_storeu_ps(dst + i, _mm_mul_ps(_mm_cvtepi32_ps(lo), scale));
+                _mm_storeu_ps(dst + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), scale));
+            }
+#endif
+            s16_to_float_scalar(src + i, dst + i, count - i);
+        }
+
+        inline void float_to_s16_scalar(const float* src, Sint16* dst, size_t count)
+        {
+            for (size_t i = 0; i < count; i++)
+            {
+                float v = std::max(-1.0f, std::min(src[i], 1.0f)) * 32767.0f;
+                dst[i] = static_cast<Sint16>(std::lrint(v));
+            }
+        }
+
+        inline void float_to_s16(const float* src, Sint16* dst, size_t count)
+        {
+            size_t i = 0;
+#if defined(CGAME_AVX2) || defined(CGAME_SSE2)
+            // Clamp before converting: out-of-range floats convert to INT_MIN, which packs to -32768.
+            const __m128 lo = _mm_set1_ps(-1.0f), hi = _mm_set1_ps(1.0f), scale = _mm_set1_ps(32767.0f);
+            for (; i + 8 <= count; i += 8)
+            {
+                __m128 a = _mm_mul_ps(_mm_min_ps(_mm_max_ps(_mm_loadu_ps(src + i), lo), hi), scale);
+                __m128 b = _mm_mul_ps(_mm_min_ps(_mm_max_ps(_mm_loadu_ps(src + i + 4), lo), hi), scale);
+                __m128i packed = _mm_packs_epi32(_mm_cvtps_epi32(a), _mm_cvtps_epi32(b));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), packed);
+            }
+#endif
+            float_to_s16_scalar(src + i, dst + i, count - i);
+        }
+
+        // Single-producer single-consumer ring. push() from one thread, pop() from another; no locks.
+        template <typename T, size_t Capacity>
+        class SpscQueue
+        {
+            static_assert((Capacity & (Capacity - 1)) == 0, "SpscQueue capacity must be a power of two");
+
+        public:
+            bool push(const T& item)
+            {
+                size_t t = tail.load(std::memory_order_relaxed);
+                if (t - head.load(std::memory_order_acquire) == Capacity)
+                    return false;
+                items[t & (Capacity - 1)] = item;
+                tail.store(t + 1, std::memory_order_release);
+                return true;
+            }
+
+            bool pop(T& item)
+            {
+                size_t h = head.load(std::memory_order_relaxed);
+                if (h == tail.load(std::memory_order_acquire))
+                    return false;
+                item = items[h & (Capacity - 1)];
+                head.store(h + 1, std::memory_order_release);
+                return true;
+            }
+
+        private:
+            T items[Capacity];
+            std::atomic<size_t> head{ 0 };
+            std::atomic<size_t> tail{ 0 };
+        };
+
+        // Sample data converted to float at the device rate and channel count. Owned by the Engine;
+        // freed once released and no voice on the audio thread still reads it.
+        struct Clip
+        {
+            std::vector<float> samples;
+            Uint32 frames = 0;
+            std::atomic<int> users{ 0 };
+            bool released = false;
+        };
+
+        struct EngineStats
+        {
+            Uint64 callbacks = 0;
+            float lastMs = 0.0f;
+            float avgMs = 0.0f;
+            float maxMs = 0.0f;
+            float budgetMs = 0.0f;
+            int voices = 0;
+            Uint64 droppedCommands = 0;
+        };
+
+        // Optional software mixer on Mix_SetPostMix. Voices get per-voice gain, pan and pitch and are
+        // summed into submix buses (gain + one-pole low-pass) that are added on top of SDL_mixer's own
+        // output. The game thread only sends commands through an SPSC queue; all voice state lives on
+        // the audio thread.
+        class Engine
+        {
+        public:
+            static constexpr int MAX_VOICES = 64;
+            static constexpr int MAX_BUSES = 8;
+            static constexpr int BLOCK_FRAMES = 512;
+
+            ~Engine() { stop(); }
+
+            bool start(int buses = 4)
+            {
+                if (running)
+                    return true;
+
+                int frequency = 0, deviceChannels = 0;
+                Uint16 format = 0;
+                if (!Mix_QuerySpec(&frequency, &format, &deviceChannels))
+                {
+                    std::cerr << "Mixing engine needs an open audio device: " << Mix_GetError() << std::endl;
+                    return false;
+                }
+                if ((format != AUDIO_S16SYS && format != AUDIO_F32SYS) || deviceChannels < 1 || deviceChannels > 2)
+                {
+                    std::cerr << "Mixing engine supports 16-bit or float mono/stereo output only" << std::endl;
+                    return false;
+                }
+
+                rate = frequency;
+                sampleFormat = format;
+                channels = deviceChannels;
+                busCount = std::max(1, std::min(buses, MAX_BUSES));
+
+                busBuffers.assign(static_cast<size_t>(busCount) * BLOCK_FRAMES * channels, 0.0f);
+                master.assign(static_cast<size_t>(BLOCK_FRAMES) * channels, 0.0f);
+                resampled.assign(static_cast<size_t>(BLOCK_FRAMES) * channels, 0.0f);
+                for (int b = 0; b < MAX_BUSES; b++)
+                {
+                    busState[b] = Bus();
+                    busGains[b] = 1.0f;
+                }
+                for (auto& slot : slots)
+                    slot = Slot();
+                for (auto& id : playingIds)
+                    id.store(0, std::memory_order_relaxed);
+
+                running = true;
+                Mix_SetPostMix(&Engine::callback, this);
+                return true;
+            }
+
+            // Mix_SetPostMix takes the audio lock, so the callback is not running once this returns.
+            void stop()
+            {
+                if (!running)
+                    return;
+
+                Mix_SetPostMix(nullptr, nullptr);
+                running = false;
+
+                Command command;
+                while (commands.pop(command))
+                {
+                    if (command.type == PLAY)
+                        command.clip->users.fetch_sub(1, std::memory_order_relaxed);
+                }
+                for (Slot& slot : slots)
+                {
+                    if (slot.id)
+                        slot.clip->users.fetch_sub(1, std::memory_order_relaxed);
+                    slot = Slot();
+                }
+                for (auto& id : playingIds)
+                    id.store(0, std::memory_order_relaxed);
+                collect();
+            }
+
+            bool is_running() const { return running; }
+
+            // Chunks from Mix_LoadWAV are already in the device format, so this is a plain widening.
+            Clip* load(Mix_Chunk* chunk)
+            {
+                if (!chunk || !running)
+                    return nullptr;
+
+                std::unique_ptr<Clip> clip(new Clip());
+                if (sampleFormat == AUDIO_S16SYS)
+                {
+                    size_t count = chunk->alen / sizeof(Sint16);
+                    clip->samples.resize(count);
+                    s16_to_float(reinterpret_cast<const Sint16*>(chunk->abuf), clip->samples.data(), count);
+                }
+                else
+                {
+                    size_t count = chunk->alen / sizeof(float);
+                    clip->samples.resize(count);
+                    std::memcpy(clip->samples.data(), chunk->abuf, count * sizeof(float));
+                }
+                clip->frames = static_cast<Uint32>(clip->samples.size() / channels);
+
+                clips.push_back(std::move(clip));
+                return clips.back().get();
+            }
+
+            void release(Clip* clip)
+            {
+                if (!clip)
+                    return;
+                clip->released = true;
+                if (running)
+                    send(Command(STOP_CLIP, 0, clip));
+                collect();
+            }
+
+            // Returns 0 if the command queue is full.
+            Uint32 play(Clip* clip, int bus, int loops, float gain, float pan = 0.0f, float pitch = 1.0f)
+            {
+                if (!running || !clip || clip->frames == 0)
+                    return 0;
+
+                collect();
+                clip->users.fetch_add(1, std::memory_order_relaxed);
+                Command command(PLAY, ++lastId, clip);
+                command.bus = std::max(0, std::min(bus, busCount - 1));
+                command.loops = loops;
+                command.a = gain;
+                command.b = pan;
+                command.c = pitch;
+                if (!send(command))
+                {
+                    clip->users.fetch_sub(1, std::memory_order_relaxed);
+                    return 0;
+                }
+                return lastId;
+            }
+
+            // A voice counts as playing from play() until the audio thread ends it.
+            bool is_playing(Uint32 id) const
+            {
+                if (!running || id == 0)
+                    return false;
+                if (id > processedId.load(std::memory_order_acquire))
+                    return true;
+                for (const auto& playing : playingIds)
+                {
+                    if (playing.load(std::memory_order_relaxed) == id)
+                        return true;
+                }
+                return false;
+            }
+
+            void stop_voice(Uint32 id) { send(Command(STOP, id)); }
+            void pause_voice(Uint32 id) { send(Command(PAUSE, id)); }
+            void resume_voice(Uint32 id) { send(Command(RESUME, id)); }
+            void set_voice_gain(Uint32 id, float gain) { send(Command(SET_GAIN, id, nullptr, 0, gain)); }
+            void set_voice_pan(Uint32 id, float pan) { send(Command(SET_PAN, id, nullptr, 0, pan)); }
+            void set_voice_pitch(Uint32 id, float pitch) { send(Command(SET_PITCH, id, nullptr, 0, pitch)); }
+            void stop_clip(Clip* clip) { send(Command(STOP_CLIP, 0, clip)); }
+
+            void set_bus_gain(int bus, float gain)
+            {
+                if (bus < 0 || bus >= MAX_BUSES)
+                    return;
+                busGains[bus] = gain;
+                send(Command(SET_BUS_GAIN, 0, nullptr, bus, gain));
+                if (bus == musicBus)
+                    apply_music_volume();
+            }
+
+            float get_bus_gain(int bus) const { return (bus >= 0 && bus < MAX_BUSES) ? busGains[bus] : 0.0f; }
+
+            // 0 turns the filter off.
+            void set_bus_lowpass(int bus, float cutoffHz)
+            {
+                float coefficient = 1.0f;
+                if (cutoffHz > 0.0f && rate > 0)
+                    coefficient = 1.0f - std::exp(-2.0f * static_cast<float>(math::PI) * cutoffHz / static_cast<float>(rate));
+                send(Command(SET_BUS_LOWPASS, 0, nullptr, bus, coefficient));
+            }
+
+            // Scales everything, including what SDL_mixer mixed before the post-mix hook.
+            void set_master_gain(float gain) { send(Command(SET_MASTER_GAIN, 0, nullptr, 0, gain)); }
+
+            // SDL_mixer decodes music internally, so a Music can only follow a bus's gain.
+            void set_music_bus(int bus)
+            {
+                musicBus = bus;
+                apply_music_volume();
+            }
+
+            void set_music_volume(float volume)
+            {
+                musicVolume = volume;
+                apply_music_volume();
+            }
+
+            int get_music_bus() const { return musicBus; }
+
+            EngineStats get_stats() const
+            {
+                EngineStats stats;
+                double toMs = 1000.0 / static_cast<double>(SDL_GetPerformanceFrequency());
+                stats.callbacks = callbackCount.load(std::memory_order_relaxed);
+                stats.lastMs = static_cast<float>(lastTicks.load(std::memory_order_relaxed) * toMs);
+                stats.maxMs = static_cast<float>(maxTicks.load(std::memory_order_relaxed) * toMs);
+                if (stats.callbacks > 0)
+                    stats.avgMs = static_cast<float>(totalTicks.load(std::memory_order_relaxed) * toMs / stats.callbacks);
+                if (rate > 0)
+                    stats.budgetMs = 1000.0f * lastFrames.load(std::memory_order_relaxed) / rate;
+                stats.voices = activeVoices.load(std::memory_order_relaxed);
+                stats.droppedCommands = dropped;
+                return stats;
+            }
+
+            void reset_stats()
+            {
+                dropped = 0;
+                send(Command(RESET_STATS));
+            }
+
+            // Frees released clips that no voice still uses. Called from play() and release().
+            void collect()
+            {
+                clips.erase(std::remove_if(clips.begin(), clips.end(), [](const std::unique_ptr<Clip>& clip)
+                {
+                    return clip->released && clip->users.load(std::memory_order_acquire) == 0;
+                }), clips.end());
+            }
+
+        private:
+            enum CommandType
+            {
+                PLAY,
+                STOP,
+                PAUSE,
+                RESUME,
+                SET_GAIN,
+                SET_PAN,
+                SET_PITCH,
+                STOP_CLIP,
+                SET_BUS_GAIN,
+                SET_BUS_LOWPASS,
+                SET_MASTER_GAIN,
+                RESET_STATS
+            };
+
+            struct Command
+            {
+                Command(CommandType _type = RESET_STATS, Uint32 _id = 0, Clip* _clip = nullptr, int _bus = 0, float _a = 0.0f)
+                    : type(_type), id(_id), clip(_clip), bus(_bus), a(_a) { }
+
+                CommandType type;
+                Uint32 id;
+                Clip* clip;
+                int bus;
+                int loops = 0;
+                float a;
+                float b = 0.0f;
+                float c = 0.0f;
+            };
+
+            struct Slot
+            {
+                Uint32 id = 0;
+                Clip* clip = nullptr;
+                double position = 0.0;
+                float pitch = 1.0f;
+                float gain = 1.0f;
+                float pan = 0.0f;
+                float gainL = 1.0f, gainR = 1.0f;
+                int bus = 0;
+                int loops = 0;
+                bool paused = false;
+                Uint64 order = 0;
+            };
+
+            struct Bus
+            {
+                float gain = 1.0f;
+                float lowpass = 1.0f;
+                float state[2] = { 0.0f, 0.0f };
+            };
+
+            bool send(const Command& command)
+            {
+                if (!running)
+                    return false;
+                if (commands.push(command))
+                    return true;
+                dropped++;
+                return false;
+            }
+
+            void apply_music_volume()
+            {
+                float gain = musicBus >= 0 ? get_bus_gain(musicBus) : 1.0f;
+                float volume = std::max(0.0f, std::min(musicVolume * gain, 1.0f));
+                Mix_VolumeMusic(static_cast<int>(volume * static_cast<float>(MIX_MAX_VOLUME) + 0.5f));
+            }
+
+            static void callback(void* udata, Uint8* stream, int len)
+            {
+                static_cast<Engine*>(udata)->mix(stream, len);
+            }
+
+            // Everything below runs on the audio thread.
+
+            void mix(Uint8* stream, int len)
+            {
+                Uint64 start = SDL_GetPerformanceCounter();
+                process_commands();
+
+                size_t sampleSize = sampleFormat == AUDIO_S16SYS ? sizeof(Sint16) : sizeof(float);
+                int frames = len / static_cast<int>(sampleSize * channels);
+
+                for (int offset = 0; offset < frames; offset += BLOCK_FRAMES)
+                {
+                    int count = std::min(BLOCK_FRAMES, frames - offset);
+                    size_t samples = static_cast<size_t>(count) * channels;
+                    Uint8* out = stream + offset * sampleSize * channels;
+                    mix_block(out, count, samples);
+                }
+
+                int active = 0;
+                for (const Slot& slot : slots)
+                    active += slot.id ? 1 : 0;
+                activeVoices.store(active, std::memory_order_relaxed);
+
+                Uint64 ticks = SDL_GetPerformanceCounter() - start;
+                lastTicks.store(ticks, std::memory_order_relaxed);
+                totalTicks.fetch_add(ticks, std::memory_order_relaxed);
+                if (ticks > maxTicks.load(std::memory_order_relaxed))
+                    maxTicks.store(ticks, std::memory_order_relaxed);
+                lastFrames.store(frames, std::memory_order_relaxed);
+                callbackCount.fetch_add(1, std::memory_order_relaxed);
+            }
+
+            void mix_block(Uint8* out, int frames, size_t samples)
+            {
+                std::fill(busBuffers.begin(), busBuffers.end(), 0.0f);
+                size_t busStride = static_cast<size_t>(BLOCK_FRAMES) * channels;
+
+                for (int i = 0; i < MAX_VOICES; i++)
+                {
+                    Slot& slot = slots[i];
+                    if (slot.id && !slot.paused)
+                        mix_voice(i, busBuffers.data() + slot.bus * busStride, frames);
+                }
+
+                if (sampleFormat == AUDIO_S16SYS)
+                    s16_to_float(reinterpret_cast<const Sint16*>(out), master.data(), samples);
+                else
+                    std::memcpy(master.data(), out, samples * sizeof(float));
+
+                for (int b = 0; b < busCount; b++)
+                {
+                    float* buffer = busBuffers.data() + b * busStride;
+                    Bus& bus = busState[b];
+                    if (bus.lowpass < 1.0f)
+                    {
+                        for (size_t i = 0; i < samples; i++)
+                        {
+                            float& state = bus.state[i % channels];
+                            state += bus.lowpass * (buffer[i] - state);
+                            buffer[i] = state;
+                        }
+                    }
+                    mix_scaled(master.data(), buffer, samples, bus.gain, bus.gain);
+                }
+
+                if (masterGain != 1.0f)
+                {
+                    for (size_t i = 0; i < samples; i++)
+                        master[i] *= masterGain;
+                }
+
+                if (sampleFormat == AUDIO_S16SYS)
+                    float_to_s16(master.data(), reinterpret_cast<Sint16*>(out), samples);
+                else
+                    std::memcpy(out, master.data(), samples * sizeof(float));
+            }
+
+            void mix_voice(int index, float* out, int frames)
+            {
+                Slot& slot = slots[index];
+                const Clip* clip = slot.clip;
+                int done = 0;
+
+                while (done < frames && slot.id)
+                {
+                    if (slot.pitch == 1.0f && slot.position == std::floor(slot.position))
+                    {
+                        Uint32 first = static_cast<Uint32>(slot.position);
+                        int count = static_cast<int>(std::min<Uint32>(frames - done, clip->frames - first));
+                        mix_scaled(out + done * channels, clip->samples.data() + first * channels, static_cast<size_t>(count) * channels, slot.gainL, slot.gainR);
+                        slot.position += count;
+                        done += count;
+                    }
+                    else
+                    {
+                        int produced = 0;
+                        while (done + produced < frames && slot.position < clip->frames)
+                        {
+                            Uint32 i0 = static_cast<Uint32>(slot.position);
+                            Uint32 i1 = i0 + 1 < clip->frames ? i0 + 1 : (slot.loops != 0 ? 0 : i0);
+                            float t = static_cast<float>(slot.position - i0);
+                            for (int c = 0; c < channels; c++)
+                            {
+                                float s0 = clip->samples[i0 * channels + c];
+                                float s1 = clip->samples[i1 * channels + c];
+                                resampled[produced * channels + c] = s0 + (s1 - s0) * t;
+                            }
+                            slot.position += slot.pitch;
+                            produced++;
+                        }
+                        mix_scaled(out + done * channels, resampled.data(), static_cast<size_t>(produced) * channels, slot.gainL, slot.gainR);
+                        done += produced;
+                    }
+
+                    if (slot.position >= clip->frames)
+                    {
+                        if (slot.loops == 0)
+                        {
+                            free_slot(index);
+                            break;
+                        }
+                        slot.position = std::fmod(slot.position, static_cast<double>(clip->frames));
+                        if (slot.loops > 0)
+                            slot.loops--;
+                    }
+                }
+            }
+
+            void process_commands()
+            {
+                Command command;
+                while (commands.pop(command))
+                {
+                    switch (command.type)
+                    {
+                    case PLAY:
+                    {
+                        int index = find_free_slot();
+                        if (slots[index].id)
+                            free_slot(index);
+                        Slot& slot = slots[index];
+                        slot.id = command.id;
+                        slot.clip = command.clip;
+                        slot.position = 0.0;
+                        slot.bus = command.bus;
+                        slot.loops = command.loops;
+                        slot.paused = false;
+                        slot.order = ++playOrder;
+                        slot.gain = command.a;
+                        slot.pan = command.b;
+                        slot.pitch = clamp_pitch(command.c);
+                        update_gains(slot);
+                        playingIds[index].store(command.id, std::memory_order_relaxed);
+                        processedId.store(command.id, std::memory_order_release);
+                        break;
+                    }
+                    case STOP:
+                        if (Slot* slot = find(command.id))
+                            free_slot(static_cast<int>(slot - slots));
+                        break;
+                    case PAUSE:
+                    case RESUME:
+                        if (Slot* slot = find(command.id))
+                            slot->paused = command.type == PAUSE;
+                        break;
+                    case SET_GAIN:
+                    case SET_PAN:
+                        if (Slot* slot = find(command.id))
+                        {
+                            (command.type == SET_GAIN ? slot->gain : slot->pan) = command.a;
+                            update_gains(*slot);
+                        }
+                        break;
+                    case SET_PITCH:
+                        if (Slot* slot = find(command.id))
+                            slot->pitch = clamp_pitch(command.a);
+                        break;
+                    case STOP_CLIP:
+                        for (int i = 0; i < MAX_VOICES; i++)
+                        {
+                            if (slots[i].id && slots[i].clip == command.clip)
+                                free_slot(i);
+                        }
+                        break;
+                    case SET_BUS_GAIN:
+                        if (command.bus >= 0 && command.bus < busCount)
+                            busState[command.bus].gain = command.a;
+                        break;
+                    case SET_BUS_LOWPASS:
+                        if (command.bus >= 0 && command.bus < busCount)
+                            busState[command.bus].lowpass = command.a;
+                        break;
+                    case SET_MASTER_GAIN:
+                        masterGain = command.a;
+                        break;
+                    case RESET_STATS:
+                        callbackCount.store(0, std::memory_order_relaxed);
+                        totalTicks.store(0, std::memory_order_relaxed);
+                        maxTicks.store(0, std::memory_order_relaxed);
+                        break;
+                    }
+                }
+            }
+
+            // A free slot, or the oldest voice if all MAX_VOICES are busy.
+            int find_free_slot() const
+            {
+                int oldest = 0;
+                for (int i = 0; i < MAX_VOICES; i++)
+                {
+                    if (!slots[i].id)
+                        return i;
+                    if (slots[i].order < slots[oldest].order)
+                        oldest = i;
+                }
+                return oldest;
+            }
+
+            Slot* find(Uint32 id)
+            {
+                for (Slot& slot : slots)
+                {
+                    if (slot.id == id)
+                        return &slot;
+                }
+                return nullptr;
+            }
+
+            void free_slot(int index)
+            {
+                slots[index].clip->users.fetch_sub(1, std::memory_order_release);
+                slots[index].id = 0;
+                slots[index].clip = nullptr;
+                playingIds[index].store(0, std::memory_order_relaxed);
+            }
+
+            void update_gains(Slot& slot) const
+            {
+                float pan = std::max(-1.0f, std::min(slot.pan, 1.0f));
+                slot.gainL = channels == 2 ? slot.gain * std::min(1.0f, 1.0f - pan) : slot.gain;
+                slot.gainR = channels == 2 ? slot.gain * std::min(1.0f, 1.0f + pan) : slot.gain;
+            }
+
+            static float clamp_pitch(float pitch)
+            {
+                return std::max(0.01f, std::min(pitch, 8.0f));
+            }
+
+            bool running = false;
+            int rate = 0;
+            Uint16 sampleFormat = 0;
+            int channels = 2;
+            int busCount = 1;
+
+            // Game thread.
+            std::vector<std::unique_ptr<Clip>> clips;
+            Uint32 lastId = 0;
+            Uint64 dropped = 0;
+            float busGains[MAX_BUSES] = {};
+            int musicBus = -1;
+            float musicVolume = 1.0f;
+
+            SpscQueue<Command, 1024> commands;
+
+            // Audio thread.
+            Slot slots[MAX_VOICES];
+            Bus busState[MAX_BUSES];
+            Uint64 playOrder = 0;
+            float masterGain = 1.0f;
+            std::vector<float> busBuffers;
+            std::vector<float> master;
+            std::vector<float> resampled;
+
+            // Written by the audio thread, read by the game thread.
+            std::atomic<Uint32> playingIds[MAX_VOICES] = {};
+            std::atomic<Uint32> processedId{ 0 };
+            std::atomic<int> activeVoices{ 0 };
+            std::atomic<int> lastFrames{ 0 };
+            std::atomic<Uint64> callbackCount{ 0 };
+            std::atomic<Uint64> lastTicks{ 0 };
+            std::atomic<Uint64> totalTicks{ 0 };
+            std::atomic<Uint64> maxTicks{ 0 };
+        };
+
+        static Engine engine;
+
+        inline bool start_engine(int buses = 4)
+        {
+            return engine.start(buses);
+        }
+
+        inline void stop_engine()
+        {
+            engine.stop();
+        }
+
+        inline EngineStats get_engine_stats()
+        {
+            return engine.get_stats();
+        }
+
+        inline bool Voice::is_playing() const
+        {
+            if (engineId)
+                return engine.is_playing(engineId);
+            return voices.is_playing(channel, generation);
+        }
+
+        inline void Voice::stop()
+        {
+            if (engineId)
+                engine.stop_voice(engineId);
+            else if (voices.is_current(channel, generation))
+                voices.stop(channel);
+        }
+
+        inline void Voice::pause()
+        {
+            if (engineId)
+                engine.pause_voice(engineId);
+            else if (voices.is_current(channel, generation))
+                Mix_Pause(channel);
+        }
+
+        inline void Voice::resume()
+        {
+            if (engineId)
+                engine.resume_voice(engineId);
+            else if (voices.is_current(channel, generation))
+                Mix_Resume(channel);
+        }
+
+        inline void Voice::set_volume(float volume)
+        {
+            volume = std::max(0.0f, std::min(volume, 1.0f));
+            if (engineId)
+            {
+                engineVolume = volume;
+                engine.set_voice_gain(engineId, volume * engineScale);
+            }
+            else if (voices.is_current(channel, generation))
+            {
+                voices.set_channel_volume(channel, volume);
+            }
+        }
+
+        inline float Voice::get_volume() const
+        {
+            if (engineId)
+                return engineVolume;
+            return voices.is_current(channel, generation) ? voices.get_channel_volume(channel) : 0.0f;
+        }
+
+        // -1 is hard left, 1 hard right.
+        inline void Voice::set_pan(float pan)
+        {
+            pan = std::max(-1.0f, std::min(pan, 1.0f));
+            if (engineId)
+            {
+                engine.set_voice_pan(engineId, pan);
+            }
+            else if (voices.is_current(channel, generation))
+            {
+                Uint8 left = static_cast<Uint8>(255.0f * std::min(1.0f, 1.0f - pan));
+                Uint8 right = static_cast<Uint8>(255.0f * std::min(1.0f, 1.0f + pan));
+                Mix_SetPanning(channel, left, right);
+            }
+        }
+
+        // Engine voices only; SDL_mixer channels have no pitch control.
+        inline void Voice::set_pitch(float pitch)
+        {
+            if (engineId)
+                engine.set_voice_pitch(engineId, pitch);
+        }
+
+        inline void set_max_channels(int channels)
+        {
+            voices.set_max_channels(channels);
+        }
+
+        inline VoiceStats get_voice_stats()
+        {
+            return voices.get_stats();
+        }
+
+        class Sound
+        {
+        public:
+            Sound(const std::string& filename)
+            {
+                sound = Mix_LoadWAV(filename.c_str());
+                if (!sound)
+                {
+                    std::cerr << "Failed to load sound: " << filename << " Error: " << Mix_GetError() << std::endl;
+                }
+            }
+
+            explicit Sound(Mix_Chunk* chunk)
+                : sound(chunk) { }
+
+            ~Sound()
+            {
+                engine.release(clip);
+                if (sound)
+                    Mix_FreeChunk(sound);
+            }
+
+            // Returns an empty Voice if the sound is over its instance limit or lost to higher
+            // priority voices. With a bus set and the Engine running, plays on the Engine instead
+            // (where voices are capped by Engine::MAX_VOICES only).
+            Voice play(LoopMode loop = LOOP_NONE, float volume = 1.0f)
+            {
+                if (bus >= 0 && engine.is_running() && sound)
+                {
+                    if (!clip)
+                        clip = engine.load(sound);
+                    float scale = static_cast<float>(sound->volume) / static_cast<float>(MIX_MAX_VOLUME);
+                    Uint32 id = engine.play(clip, bus, loop, volume * scale);
+                    return id ? Voice(id, scale, volume) : Voice();
+                }
+                return voices.play(sound, loop, priority, maxInstances, stealMode, volume);
+            }
+
+            void stop()
+            {
+                if (!sound)
+                    return;
+                voices.stop_all(sound);
+                if (clip)
+                    engine.stop_clip(clip);
+            }
+
+            // Routes later play() calls through the mixing Engine's bus; -1 goes back to SDL_mixer channels.
+            void set_bus(int _bus) { bus = _bus; }
+            int get_bus() const { return bus; }
+
+            void set_priority(int _priority) { priority = _priority; }
+            int get_priority() const { return priority; }
+
+            // 0 means unlimited.
+            void set_max_instances(int instances) { maxInstances = std::max(instances, 0); }
+            int get_max_instances() const { return maxInstances; }
+
+            void set_steal_mode(StealMode mode) { stealMode = mode; }
+            StealMode get_steal_mode() const { return stealMode; }
+
+            int get_instance_count() const { return sound ? voices.count_instances(sound) : 0; }
+
+            void set_volume(float volume)
+            {
+                if (!sound)
+                    return;
+
+                if (volume < 0.0f) volume = 0.0f;
+                if (volume > 1.0f) volume = 1.0f;
+
+                int vol = static_cast<int>(volume * static_cast<float>(MIX_MAX_VOLUME) + 0.5f);
+                Mix_VolumeChunk(sound, vol);
+            }
+
+            Mix_Chunk* get_chunk() const { return sound; }
+
+        private:
+            Mix_Chunk* sound = NULL;
+            int priority = 0;
+            int maxInstances = 0;
+            StealMode stealMode = STEAL_OLDEST;
+            int bus = -1;
+            Clip* clip = nullptr;
+        };
+
+        class Music
+        {
+        public:
+            Music(const std::string& filename)
+            {
+                music = Mix_LoadMUS(filename.c_str());
+                if (!music)
+                {
+                    std::cerr << "Failed to load music: " << filename << " Error: " << Mix_GetError() << std::endl;
+                }
+            }
+
+            // Streams from memory that has to stay valid while the Music exists; _memory keeps its owner alive.
+            Music(const std::string& filename, const void* data, size_t dataSize, std::shared_ptr<const void> _memory = nullptr)
+                : memory(_memory)
+            {
+                music = Mix_LoadMUS_RW(SDL_RWFromConstMem(data, static_cast<int>(dataSize)), 1);
+                if (!music)
+                {
+                    std::cerr << "Failed to load music: " << filename << " Error: " << Mix_GetError() << std::endl;
+                }
+            }
+
+            ~Music()
+            {
+                if (music)
+                    Mix_FreeMusic(music);
+            }
+
+            void play(LoopMode loop = LOOP_NONE)
+            {
+                if (music)
+                {
+                    if (Mix_PlayMusic(music, static_cast<int>(loop)) == -1)
+                    {
+                        std::cerr << "Failed to play music: " << Mix_GetError() << std::endl;
+                    }
+                }
+            }
+
+            void pause()
+            {
+                Mix_PauseMusic();
+            }
+
+            void resume()
+            {
+                Mix_ResumeMusic();
+            }
+
+            void stop()
+            {
+                Mix_HaltMusic();
+            }
+
+            void set_volume(float volume)
+            {
+                if (volume < 0.0f) volume = 0.0f;
+                if (volume > 1.0f) volume = 1.0f;
+
+                if (engine.get_music_bus() >= 0)
+                {
+                    engine.set_music_volume(volume);
+                    return;
+                }
+
+                int vol = static_cast<int>(volume * static_cast<float>(MIX_MAX_VOLUME) + 0.5f);
+                Mix_VolumeMusic(vol);
+            }
+
+            // SDL_mixer decodes and mixes music itself, so routing only makes the music volume
+            // follow the bus gain. Applies to whichever Music is playing; -1 unroutes.
+            void set_bus(int bus)
+            {
+                engine.set_music_volume(get_volume());
+                engine.set_music_bus(bus);
+            }
+
+            float get_volume() const
+            {
+                int vol = Mix_VolumeMusic(-1);
+                return static_cast<float>(vol) / static_cast<float>(MIX_MAX_VOLUME);
+            }
+
+            bool is_playing() const
+            {
+                return Mix_PlayingMusic() != 0;
+            }
+
+            Mix_Music* get_music() const { return music; }
+        private:
+            Mix_Music* music = NULL;
+            std::shared_ptr<const void> memory;
+        };
+    }
+
+    // Packed asset archives. One file holds every asset behind a table of contents sorted by the
+    // FNV-1a hash of each path, so a lookup is a binary search over the mapped file:
+    //
+    //     header: "CGPK", u32 version, u32 count, u32 reserved
+    //     toc:    count x { u64 hash, u64 offset, u32 size, u32 rawSize, u32 nameOffset, u32 nameLength }
+    //     names:  the paths, '/'-separated, back to back
+    //     data:   entries at 16-byte aligned offsets; size != rawSize marks an LZ4 block
+    //
+    // Values are stored in host byte order.
+    namespace archive
+    {
+        static constexpr Uint32 VERSION = 1;
+        static constexpr char MAGIC[4] = { 'C', 'G', 'P', 'K' };
+        static constexpr size_t HEADER_SIZE = 16;
+        static constexpr size_t DATA_ALIGNMENT = 16;
+
+        struct TocEntry
+        {
+            Uint64 hash;
+            Uint64 offset;
+            Uint32 size;
+            Uint32 rawSize;
+            Uint32 nameOffset;
+            Uint32 nameLength;
+        };
+        static_assert(sizeof(TocEntry) == 32, "TocEntry is stored as is");
+
+        // Paths are matched with '/' separators and without a leading "./".
+        inline std::string normalize(const std::string& path)
+        {
+            std::string out = path;
+            std::replace(out.begin(), out.end(), '\\', '/');
+            size_t start = 0;
+            while (out.compare(start, 2, "./") == 0)
+                start += 2;
+            return out.substr(start);
+        }
+
+        inline Uint64 hash(const std::string& normalizedPath)
+        {
+            Uint64 h = 14695981039346656037ull;
+            for (unsigned char c : normalizedPath)
+            {
+                h ^= c;
+                h *= 1099511628211ull;
+            }
+            return h;
+        }
+
+        // LZ4 block format. Decoding checks every length against both buffers, so a corrupt
+        // entry fails instead of reading or writing out of bounds.
+        inline bool lz4_decompress(const Uint8* src, size_t srcSize, Uint8* dst, size_t dstSize)
+        {
+            const Uint8* ip = src;
+            const Uint8* ipEnd = src + srcSize;
+            Uint8* op = dst;
+            Uint8* opEnd = dst + dstSize;
+
+            auto read_length = [&](size_t& length)
+            {
+                Uint8 b;
+                do
+                {
+                    if (ip >= ipEnd)
+                        return false;
+                    b = *ip++;
+                    length += b;
+                } while (b == 255);
+                return true;
+            };
+
+            while (ip < ipEnd)
+            {
+                Uint8 token = *ip++;
+                size_t literals = token >> 4;
+                if (literals == 15 && !read_length(literals))
+                    return false;
+                if (literals > static_cast<size_t>(ipEnd - ip) || literals > static_cast<size_t>(opEnd - op))
+                    return false;
+                if (literals > 0)
+                    std::memcpy(op, ip, literals);
+                op += literals;
+                ip += literals;
+
+                // The last sequence is literals only.
+                if (ip == ipEnd)
+                    break;
+
+                if (ipEnd - ip < 2)
+                    return false;
+                size_t offset = ip[0] | (ip[1] << 8);
+                ip += 2;
+                if (offset == 0 || offset > static_cast<size_t>(op - dst))
+                    return false;
+
+                size_t length = token & 15;
+                if (length == 15 && !read_length(length))
+                    return false;
+                length += 4;
+                if (length > static_cast<size_t>(opEnd - op))
+                    return false;
+
+                const Uint8* match = op - offset;
+                if (offset >= length)
+                {
+                    std::memcpy(op, match, length);
+                }
+                else
+                {
+                    for (size_t i = 0; i < length; i++)
+                        op[i] = match[i];
+                }
+                op += length;
+            }
+
+            return op == opEnd;
+        }
+
+        // Greedy single-probe matcher: quick rather than tight, since packing runs once per build.
+        inline std::vector<Uint8> lz4_compress(const Uint8* src, size_t size)
+        {
+            static constexpr size_t MIN_MATCH = 4;
+            static constexpr size_t LAST_LITERALS = 5;
+            static constexpr size_t MATCH_LIMIT = 12;
+            static constexpr int HASH_BITS = 16;
+
+            std::vector<Uint8> out;
+            out.reserve(size + size / 255 + 16);
+
+            auto put_length = [&](size_t length)
+            {
+                for (; length >= 255; length -= 255)
+                    out.push_back(255);
+                out.push_back(static_cast<Uint8>(length));
+            };
+
+            auto put_sequence = [&](const Uint8* literals, size_t literalCount, size_t offset, size_t matchLength)
+            {
+                size_t matchCode = matchLength > 0 ? matchLength - MIN_MATCH : 0;
+                out.push_back(static_cast<Uint8>((std::min<size_t>(literalCount, 15) << 4) | std::min<size_t>(matchCode, 15)));
+                if (literalCount >= 15)
+                    put_length(literalCount - 15);
+                out.insert(out.end(), literals, literals + literalCount);
+                if (matchLength == 0)
+                    return;
+
+                out.push_back(static_cast<Uint8>(offset & 0xFF));
+                out.push_back(static_cast<Uint8>(offset >> 8));
+                if (matchCode >= 15)
+                    put_length(matchCode - 15);
+            };
+
+            auto read32 = [&](size_t at)
+            {
+                Uint32 v;
+                std::memcpy(&v, src + at, sizeof(v));
+                return v;
+            };
+
+            size_t anchor = 0;
+            if (size > MATCH_LIMIT)
+            {
+                std::vector<size_t> table(static_cast<size_t>(1) << HASH_BITS, SIZE_MAX);
+                size_t i = 0;
+                while (i < size - MATCH_LIMIT)
+                {
+                    Uint32 sequence = read32(i);
+                    Uint32 slot = (sequence * 2654435761u) >> (32 - HASH_BITS);
+                    size_t candidate = table[slot];
+                    table[slot] = i;
+
+                    if (candidate == SIZE_MAX || i - candidate > 0xFFFF || read32(candidate) != sequence)
+                    {
+                        i++;
+                        continue;
+                    }
+
+                    size_t length = MIN_MATCH;
+                    size_t maxLength = size - LAST_LITERALS - i;
+                    while (length < maxLength && src[candidate + length] == src[i + length])
+                        length++;
+
+                    put_sequence(src + anchor, i - anchor, i - candidate, length);
+                    i += length;
+                    anchor = i;
+                }
+            }
+
+            put_sequence(src + anchor, size - anchor, 0, 0);
+            return out;
+        }
+
+        // An entry's bytes. owner keeps them valid: the mapping for stored entries, a buffer for
+        // decompressed ones. Hand it to the memory constructors of Font and Music.
+        struct Blob
+        {
+            const Uint8* data = nullptr;
+            size_t size = 0;
+            std::shared_ptr<const void> owner;
+
+            explicit operator bool() const { return owner != nullptr; }
+        };
+
+        class Archive
+        {
+        public:
+            Archive() = default;
+            ~Archive() { close(); }
+
+            Archive(const Archive&) = delete;
+            Archive& operator=(const Archive&) = delete;
+
+            bool open(const std::string& filePath)
+            {
+                close();
+
+                auto mapped = std::make_shared<Mapping>();
+                if (!mapped->map(filePath))
+                {
+                    std::cerr << "Failed to map archive " << filePath << std::endl;
+                    return false;
+                }
+
+                Uint32 version = 0, count = 0;
+                if (mapped->size < HEADER_SIZE || std::memcmp(mapped->data, MAGIC, sizeof(MAGIC)) != 0)
+                {
+                    std::cerr << "Not an asset archive: " << filePath << std::endl;
+                    return false;
+                }
+                std::memcpy(&version, mapped->data + 4, sizeof(version));
+                std::memcpy(&count, mapped->data + 8, sizeof(count));
+                if (version != VERSION)
+                {
+                    std::cerr << "Unsupported archive version " << version << " in " << filePath << std::endl;
+                    return false;
+                }
+
+                size_t namesStart = HEADER_SIZE + static_cast<size_t>(count) * sizeof(TocEntry);
+                if (namesStart > mapped->size)
+                {
+                    std::cerr << "Truncated archive " << filePath << std::endl;
+                    return false;
+                }
+
+                const TocEntry* entries = reinterpret_cast<const TocEntry*>(mapped->data + HEADER_SIZE);
+                for (Uint32 i = 0; i < count; i++)
+                {
+                    const TocEntry& e = entries[i];
+                    bool valid = e.offset <= mapped->size && e.size <= mapped->size - e.offset &&
+                                 namesStart + e.nameOffset + static_cast<Uint64>(e.nameLength) <= mapped->size &&
+                                 (i == 0 || entries[i - 1].hash <= e.hash);
+                    if (!valid)
+                    {
+                        std::cerr << "Corrupt table of contents in archive " << filePath << std::endl;
+                        return false;
+                    }
+                }
+
+                mapping = mapped;
+                toc = entries;
+                tocCount = count;
+                names = reinterpret_cast<const char*>(mapped->data + namesStart);
+                return true;
+            }
+
+            // Entries already read stay valid through their Blob's owner.
+            void close()
+            {
+                mapping.reset();
+                toc = nullptr;
+                tocCount = 0;
+                names = nullptr;
+            }
+
+            bool is_open() const { return mapping != nullptr; }
+            size_t get_count() const { return tocCount; }
+
+            bool contains(const std::string& path) const
+            {
+                return find(normalize(path)) != nullptr;
+            }
+
+            // Stored entries point straight into the mapping; compressed ones are decoded into a
+            // new buffer on every call. Empty when the path isn't in the archive or fails to decode.
+            Blob read(const std::string& path) const
+            {
+                std::string name = normalize(path);
+                const TocEntry* entry = find(name);
+                if (!entry)
+                    return Blob();
+
+                const Uint8* bytes = mapping->data + entry->offset;
+                if (entry->size == entry->rawSize)
+                    return { bytes, entry->size, mapping };
+
+                auto buffer = std::make_shared<std::vector<Uint8>>(entry->rawSize);
+                if (!lz4_decompress(bytes, entry->size, buffer->data(), buffer->size()))
+                {
+                    std::cerr << "Corrupt archive entry " << name << std::endl;
+                    return Blob();
+                }
+                return { buffer->data(), buffer->size(), buffer };
+            }
+
+            std::vector<std::string> get_names() const
+            {
+                std::vector<std::string> out;
+                for (size_t i = 0; i < tocCount; i++)
+                    out.emplace_back(names + toc[i].nameOffset, toc[i].nameLength);
+                return out;
+            }
+
+        private:
+            struct Mapping
+            {
+                const Uint8* data = nullptr;
+                size_t size = 0;
+#if defined(_WIN32)
+                HANDLE file = INVALID_HANDLE_VALUE;
+                HANDLE view = NULL;
+#endif
+
+                ~Mapping()
+                {
+#if defined(_WIN32)
+                    if (data)
+                        UnmapViewOfFile(data);
+                    if (view)
+                        CloseHandle(view);
+                    if (file != INVALID_HANDLE_VALUE)
+                        CloseHandle(file);
+#else
+                    if (data)
+                        munmap(const_cast<Uint8*>(data), size);
+#endif
+                }
+
+                bool map(const std::string& filePath)
+                {
+#if defined(_WIN32)
+                    file = CreateFileA(filePath.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+                    LARGE_INTEGER fileSize;
+                    if (file == INVALID_HANDLE_VALUE || !GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0)
+                        return false;
+                    view = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+                    if (!view)
+                        return false;
+                    data = static_cast<const Uint8*>(MapViewOfFile(view, FILE_MAP_READ, 0, 0, 0));
+                    size = static_cast<size_t>(fileSize.QuadPart);
+                    return data != nullptr;
+#else
+                    int fd = ::open(filePath.c_str(), O_RDONLY);
+                    if (fd < 0)
+                        return false;
+
+                    struct stat info;
+                    void* mapped = MAP_FAILED;
+                    if (fstat(fd, &info) == 0 && info.st_size > 0)
+                        mapped = mmap(NULL, static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+                    ::close(fd);
+                    if (mapped == MAP_FAILED)
+                        return false;
+
+                    data = static_cast<const Uint8*>(mapped);
+                    size = static_cast<size_t>(info.st_size);
+                    return true;
+#endif
+                }
+            };
+
+            const TocEntry* find(const std::string& name) const
+            {
+                Uint64 h = hash(name);
+                const TocEntry* end = toc + tocCount;
+                const TocEntry* it = std::lower_bound(toc, end, h, [](const TocEntry& e, Uint64 value) { return e.hash < value; });
+                for (; it != end && it->hash == h; ++it)
+                {
+                    if (it->nameLength == name.size() && std::memcmp(names + it->nameOffset, name.data(), name.size()) == 0)
+                        return it;
+                }
+                return nullptr;
+            }
+
+            std::shared_ptr<Mapping> mapping;
+            const TocEntry* toc = nullptr;
+            size_t tocCount = 0;
+            const char* names = nullptr;
+        };
+
+        // Builds an archive. Each entry is compressed when LZ4 saves at least an eighth of it;
+        // PNG, MP3 and OGG data usually doesn't and is stored as is.
+        class Writer
+        {
+        public:
+            void add(const std::string& path, const void* data, size_t size, bool compress = true)
+            {
+                Entry entry;
+                entry.name = normalize(path);
+                entry.rawSize = static_cast<Uint32>(size);
+                const Uint8* bytes = static_cast<const Uint8*>(data);
+
+                if (compress && size > 0)
+                    entry.bytes = lz4_compress(bytes, size);
+                if (!compress || size == 0 || entry.bytes.size() > size - size / 8)
+                    entry.bytes.assign(bytes, bytes + size);
+
+                auto existing = std::find_if(entries.begin(), entries.end(), [&](const Entry& e) { return e.name == entry.name; });
+                if (existing != entries.end())
+                    *existing = std::move(entry);
+                else
+                    entries.push_back(std::move(entry));
+            }
+
+            bool add_file(const std::string& filePath, bool compress = true)
+            {
+                SDL_RWops* rw = SDL_RWFromFile(filePath.c_str(), "rb");
+                if (!rw)
+                {
+                    std::cerr << "Failed to open " << filePath << ": " << SDL_GetError() << std::endl;
+                    return false;
+                }
+
+                Sint64 size = SDL_RWsize(rw);
+                std::vector<Uint8> data(size > 0 ? static_cast<size_t>(size) : 0);
+                size_t got = data.empty() ? 0 : SDL_RWread(rw, data.data(), 1, data.size());
+                SDL_RWclose(rw);
+                if (got != data.size())
+                {
+                    std::cerr << "Failed to read " << filePath << std::endl;
+                    return false;
+                }
+
+                add(filePath, data.data(), data.size(), compress);
+                return true;
+            }
+
+            bool save(const std::string& filePath) const
+            {
+                std::vector<size_t> order(entries.size());
+                for (size_t i = 0; i < order.size(); i++)
+                    order[i] = i;
+                std::vector<Uint64> hashes(entries.size());
+                for (size_t i = 0; i < entries.size(); i++)
+                    hashes[i] = hash(entries[i].name);
+                std::sort(order.begin(), order.end(), [&](size_t a, size_t b) { return hashes[a] != hashes[b] ? hashes[a] < hashes[b] : entries[a].name < entries[b].name; });
+
+                std::vector<TocEntry> toc(entries.size());
+                std::string names;
+                for (size_t i = 0; i < order.size(); i++)
+                {
+                    const Entry& e = entries[order[i]];
+                    toc[i].hash = hashes[order[i]];
+                    toc[i].nameOffset = static_cast<Uint32>(names.size());
+                    toc[i].nameLength = static_cast<Uint32>(e.name.size());
+                    toc[i].size = static_cast<Uint32>(e.bytes.size());
+                    toc[i].rawSize = e.rawSize;
+                    names += e.name;
+                }
+
+                Uint64 offset = HEADER_SIZE + toc.size() * sizeof(TocEntry) + names.size();
+                for (size_t i = 0; i < order.size(); i++)
+                {
+                    offset = (offset + DATA_ALIGNMENT - 1) & ~static_cast<Uint64>(DATA_ALIGNMENT - 1);
+                    toc[i].offset = offset;
+                    offset += toc[i].size;
+                }
+
+                std::FILE* file = std::fopen(filePath.c_str(), "wb");
+                if (!file)
+                {
+                    std::cerr << "Failed to open archive " << filePath << " for writing" << std::endl;
+                    return false;
+                }
+
+                Uint32 header[3] = { VERSION, static_cast<Uint32>(toc.size()), 0 };
+                bool ok = std::fwrite(MAGIC, sizeof(MAGIC), 1, file) == 1 && std::fwrite(header, sizeof(header), 1, file) == 1;
+                if (ok && !toc.empty())
+                    ok = std::fwrite(toc.data(), sizeof(TocEntry), toc.size(), file) == toc.size();
+                if (ok && !names.empty())
+                    ok = std::fwrite(names.data(), 1, names.size(), file) == names.size();
+
+                static const Uint8 padding[DATA_ALIGNMENT] = {};
+                Uint64 written = HEADER_SIZE + toc.size() * sizeof(TocEntry) + names.size();
+                for (size_t i = 0; ok && i < order.size(); i++)
+                {
+                    const Entry& e = entries[order[i]];
+                    size_t pad = static_cast<size_t>(toc[i].offset - written);
+                    ok = (pad == 0 || std::fwrite(padding, 1, pad, file) == pad) &&
+                         (e.bytes.empty() || std::fwrite(e.bytes.data(), 1, e.bytes.size(), file) == e.bytes.size());
+                    written = toc[i].offset + e.bytes.size();
+                }
+
+                if (std::fclose(file) != 0)
+                    ok = false;
+                if (!ok)
+                    std::cerr << "Failed to write archive " << filePath << std::endl;
+                return ok;
+            }
+
+            size_t get_count() const { return entries.size(); }
+
+            size_t get_raw_bytes() const
+            {
+                size_t total = 0;
+                for (const Entry& e : entries)
+                    total += e.rawSize;
+                return total;
+            }
+
+            size_t get_packed_bytes() const
+            {
+                size_t total = 0;
+                for (const Entry& e : entries)
+                    total += e.bytes.size();
+                return total;
+            }
+
+        private:
+            struct Entry
+            {
+                std::string name;
+                std::vector<Uint8> bytes;
+                Uint32 rawSize = 0;
+            };
+
+            std::vector<Entry> entries;
+        };
+    }
+
+    namespace assets
+    {
+        struct Stats
+        {
+            size_t hits = 0;
+            size_t misses = 0;
+            size_t evictions = 0;
+            size_t entries = 0;
+            size_t residentBytes = 0;
+        };
+
+        inline size_t file_size(const std::string& filePath)
+        {
+            SDL_RWops* rw = SDL_RWFromFile(filePath.c_str(), "rb");
+            if (!rw)
+                return 0;
+
+            Sint64 size = SDL_RWsize(rw);
+            SDL_RWclose(rw);
+            return size > 0 ? static_cast<size_t>(size) : 0;
+        }
+
+        static std::vector<std::shared_ptr<archive::Archive>> mounts;
+        static std::mutex mountMutex;
+
+        // Mounted archives are searched newest first, before the file system, by Cache and Loader.
+        inline void mount(std::shared_ptr<archive::Archive> pack)
+        {
+            if (!pack || !pack->is_open())
+                return;
+
+            std::lock_guard<std::mutex> lock(mountMutex);
+            mounts.insert(mounts.begin(), pack);
+        }
+
+        inline bool mount(const std::string& archivePath)
+        {
+            auto pack = std::make_shared<archive::Archive>();
+            if (!pack->open(archivePath))
+                return false;
+
+            mount(pack);
+            return true;
+        }
+
+        inline void unmount(const std::shared_ptr<archive::Archive>& pack)
+        {
+            std::lock_guard<std::mutex> lock(mountMutex);
+            mounts.erase(std::remove(mounts.begin(), mounts.end(), pack), mounts.end());
+        }
+
+        inline void unmount_all()
+        {
+            std::lock_guard<std::mutex> lock(mountMutex);
+            mounts.clear();
+        }
+
+        inline bool find_mounted(const std::string& filePath, archive::Blob& out)
+        {
+            std::vector<std::shared_ptr<archive::Archive>> searched;
+            {
+                std::lock_guard<std::mutex> lock(mountMutex);
+                if (mounts.empty())
+                    return false;
+                searched = mounts;
+            }
+
+            for (const auto& pack : searched)
+            {
+                if (pack->contains(filePath))
+                {
+                    out = pack->read(filePath);
+                    return static_cast<bool>(out);
+                }
+            }
+            return false;
+        }
+
+        // A file's bytes from the mounts, or read from disk. Empty if neither has it.
+        inline archive::Blob read_file(const std::string& filePath)
+        {
+            archive::Blob blob;
+            if (find_mounted(filePath, blob))
+                return blob;
+
+            SDL_RWops* rw = SDL_RWFromFile(filePath.c_str(), "rb");
+            if (!rw)
+                return blob;
+
+            Sint64 size = SDL_RWsize(rw);
+            if (size > 0)
+            {
+                auto buffer = std::make_shared<std::vector<Uint8>>(static_cast<size_t>(size));
+                if (SDL_RWread(rw, buffer->data(), 1, buffer->size()) == buffer->size())
+                    blob = { buffer->data(), buffer->size(), buffer };
+            }
+            SDL_RWclose(rw);
+            return blob;
+        }
+
+        inline std::string image_key(const std::string& filePath) { return "image:" + filePath; }
+        inline std::string font_key(const std::string& filePath, float size) { return "font:" + filePath + "@" + std::to_string(size); }
+        inline std::string sound_key(const std::string& filePath) { return "sound:" + filePath; }
+        inline std::string music_key(const std::string& filePath) { return "music:" + filePath; }
+
+        class Cache
+        {
+        public:
+            std::shared_ptr<Surface> image(SDL_Renderer* renderer, const std::string& filePath)
+            {
+                return fetch<Surface>(image_key(filePath), filePath, [&](size_t& bytes) -> std::shared_ptr<Surface>
+                {
+                    archive::Blob blob;
+                    SDL_Texture* tex = find_mounted(filePath, blob)
+                        ? IMG_LoadTexture_RW(renderer, SDL_RWFromConstMem(blob.data, static_cast<int>(blob.size)), 1)
+                        : IMG_LoadTexture(renderer, filePath.c_str());
+                    if (tex == NULL)
+                    {
+                        std::cerr << "Failed to load image " << filePath << " Error: " << IMG_GetError() << std::endl;
+                        return nullptr;
+                    }
+
+                    int w = 0, h = 0;
+                    SDL_QueryTexture(tex, nullptr, nullptr, &w, &h);
+                    bytes = static_cast<size_t>(w) * h * 4;
+                    return std::make_shared<Surface>(renderer, tex);
+                });
+            }
+
+            std::shared_ptr<font::Font> font(const std::string& filePath, float size = 12.0f)
+            {
+                return fetch<font::Font>(font_key(filePath, size), filePath, [&](size_t& bytes) -> std::shared_ptr<font::Font>
+                {
+                    archive::Blob blob;
+                    if (find_mounted(filePath, blob))
+                    {
+                        auto loaded = std::make_shared<font::Font>(filePath, blob.data, blob.size, size, blob.owner);
+                        bytes = blob.size;
+                        return loaded->font ? loaded : nullptr;
+                    }
+
+                    auto loaded = std::make_shared<font::Font>(filePath, size);
+                    if (!loaded->font)
+                        return nullptr;
+
+                    bytes = file_size(filePath);
+                    return loaded;
+                });
+            }
+
+            std::shared_ptr<mixer::Sound> sound(const std::string& filePath)
+            {
+                return fetch<mixer::Sound>(sound_key(filePath), filePath, [&](size_t& bytes) -> std::shared_ptr<mixer::Sound>
+                {
+                    archive::Blob blob;
+                    std::shared_ptr<mixer::Sound> loaded;
+                    if (find_mounted(filePath, blob))
+                    {
+                        Mix_Chunk* chunk = Mix_LoadWAV_RW(SDL_RWFromConstMem(blob.data, static_cast<int>(blob.size)), 1);
+                        if (!chunk)
+                            std::cerr << "Failed to load sound: " << filePath << " Error: " << Mix_GetError() << std::endl;
+                        loaded = std::make_shared<mixer::Sound>(chunk);
+                    }
+                    else
+                    {
+                        loaded = std::make_shared<mixer::Sound>(filePath);
+                    }
+                    if (!loaded->get_chunk())
+                        return nullptr;
+
+                    bytes = loaded->get_chunk()->alen;
+                    return loaded;
+                });
+            }
+
+            std::shared_ptr<mixer::Music> music(const std::string& filePath)
+            {
+                return fetch<mixer::Music>(music_key(filePath), filePath, [&](size_t& bytes) -> std::shared_ptr<mixer::Music>
+                {
+                    archive::Blob blob;
+                    if (find_mounted(filePath, blob))
+                    {
+                        auto loaded = std::make_shared<mixer::Music>(filePath, blob.data, blob.size, blob.owner);
+                        bytes = blob.size;
+                        return loaded->get_music() ? loaded : nullptr;
+                    }
+
+                    auto loaded = std::make_shared<mixer::Music>(filePath);
+                    if (!loaded->get_music())
+                        return nullptr;
+
+                    bytes = file_size(filePath);
+                    return loaded;
+                });
+            }
+
+            template <typename T>
+            void insert(const std::string& key, const std::string& filePath, std::shared_ptr<T> handle, size_t bytes)
+            {
+                if (!handle)
+                    return;
+
+                evict_key(key);
+                entries[key] = { handle, filePath, bytes };
+                stats.residentBytes += bytes;
+            }
+
+            template <typename T>
+            std::shared_ptr<T> find(const std::string& key)
+            {
+                auto it = entries.find(key);
+                if (it == entries.end())
+                    return nullptr;
+
+                stats.hits++;
+                return std::static_pointer_cast<T>(it->second.handle);
+            }
+
+            bool contains(const std::string& key) const { return entries.count(key) != 0; }
+
+            size_t evict(const std::string& filePath)
+            {
+                size_t count = 0;
+                for (auto it = entries.begin(); it != entries.end();)
+                {
+                    if (it->second.filePath == filePath)
+                    {
+                        stats.residentBytes -= it->second.bytes;
+                        it = entries.erase(it);
+                        count++;
+                    }
+                    else
+                    {
+                        ++it;
+                    }
+                }
+                stats.evictions += count;
+                return count;
+            }
+
+            size_t evict_unused()
+            {
+                size_t count = 0;
+                for (auto it = entries.begin(); it != entries.end();)
+                {
+                    if (it->second.handle.use_count() == 1)
+                    {
+                        stats.residentBytes -= it->second.bytes;
+                        it = entries.erase(it);
+                        count++;
+                    }
+                    else
+                    {
+                        ++it;
+                    }
+                }
+                stats.evictions += count;
+                return count;
+            }
+
+            void clear()
+            {
+                stats.evictions += entries.size();
+                entries.clear();
+                stats.residentBytes = 0;
+            }
+
+            Stats get_stats() const
+            {
+                Stats result = stats;
+                result.entries = entries.size();
+                return result;
+            }
+
+            void reset_counters()
+            {
+                stats.hits = 0;
+                stats.misses = 0;
+                stats.evictions = 0;
+            }
+
+        private:
+            struct Entry
+            {
+                std::shared_ptr<void> handle;
+                std::string filePath;
+                size_t bytes;
+            };
+
+            template <typename T, typename Load>
+            std::shared_ptr<T> fetch(const std::string& key, const std::string& filePath, Load load)
+            {
+                auto it = entries.find(key);
+                if (it != entries.end())
+                {
+                    stats.hits++;
+                    return std::static_pointer_cast<T>(it->second.handle);
+                }
+
+                stats.misses++;
+                size_t bytes = 0;
+                std::shared_ptr<T> loaded = load(bytes);
+                if (loaded)
+                {
+                    entries[key] = { loaded, filePath, bytes };
+                    stats.residentBytes += bytes;
+                }
+                return loaded;
+            }
+
+            void evict_key(const std::string& key)
+            {
+                auto it = entries.find(key);
+                if (it == entries.end())
+                    return;
+
+                stats.residentBytes -= it->second.bytes;
+                entries.erase(it);
+                stats.evictions++;
+            }
+
+            std::unordered_map<std::string, Entry> entries;
+            Stats stats;
+        };
+
+        static Cache cache;
+
+        enum LoadStatus
+        {
+            LOAD_PENDING,
+            LOAD_READY,
+            LOAD_FAILED
+        };
+
+        template <typename T>
+        class Handle
+        {
+        public:
+            Handle() = default;
+
+            LoadStatus get_status() const { return state ? static_cast<LoadStatus>(state->status.load()) : LOAD_FAILED; }
+            bool is_ready() const { return get_status() == LOAD_READY; }
+            bool is_failed() const { return get_status() == LOAD_FAILED; }
+            std::shared_ptr<T> get() const { return is_ready() ? state->result : nullptr; }
+
+        private:
+            friend class Loader;
+
+            struct State
+            {
+                std::atomic<int> status{ LOAD_PENDING };
+                std::shared_ptr<T> result;
+            };
+
+            static Handle ready(std::shared_ptr<T> result)
+            {
+                Handle handle;
+                handle.state = std::make_shared<State>();
+                handle.state->result = result;
+                handle.state->status = LOAD_READY;
+                return handle;
+            }
+
+            std::shared_ptr<State> state;
+        };
+
+        // Decodes on the shared job system into CPU-side buffers; everything that touches the renderer,
+        // or SDL_ttf (which is not thread-safe), runs in update() on the thread that owns the renderer.
+        class Loader
+        {
+        public:
+            // At most maxDecodes files decode at once (default 4); the rest wait in order.
+            Loader(SDL_Renderer* _renderer, int maxDecodes = 0)
+                : renderer(_renderer), decodeLimit(maxDecodes > 0 ? maxDecodes : 4)
+            {
+            }
+
+            ~Loader()
+            {
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    stopping = true;
+                }
+                jobs::wait(inFlight);
+
+                for (auto& job : decoded)
+                    job->discard();
+                for (auto& job : queued)
+                    job->discard();
+            }
+
+            Loader(const Loader&) = delete;
+            Loader& operator=(const Loader&) = delete;
+
+            Handle<Surface> image(const std::string& filePath)
+            {
+                std::string key = image_key(filePath);
+                if (auto cached = cache.find<Surface>(key))
+                    return Handle<Surface>::ready(cached);
+
+                auto surface = std::make_shared<SDL_Surface*>(nullptr);
+                SDL_Renderer* target = renderer;
+                return submit<Surface>(key, filePath,
+                    [=]()
+                    {
+                        archive::Blob blob;
+                        *surface = find_mounted(filePath, blob)
+                            ? IMG_Load_RW(SDL_RWFromConstMem(blob.data, static_cast<int>(blob.size)), 1)
+                            : IMG_Load(filePath.c_str());
+                    },
+                    [=](size_t& bytes) -> std::shared_ptr<Surface>
+                    {
+                        if (!*surface)
+                        {
+                            std::cerr << "Failed to load image " << filePath << " Error: " << IMG_GetError() << std::endl;
+                            return nullptr;
+                        }
+
+                        SDL_Texture* tex = SDL_CreateTextureFromSurface(target, *surface);
+                        bytes = static_cast<size_t>((*surface)->w) * (*surface)->h * 4;
+                        SDL_FreeSurface(*surface);
+                        *surface = nullptr;
+                        if (tex == NULL)
+                        {
+                            std::cerr << "Failed to upload image " << filePath << " Error: " << SDL_GetError() << std::endl;
+                            return nullptr;
+                        }
+                        return std::make_shared<Surface>(target, tex);
+                    },
+                    [=]() { if (*surface) SDL_FreeSurface(*surface); });
+            }
+
+            Handle<font::Font> font(const std::string& filePath, float size = 12.0f)
+            {
+                std::string key = font_key(filePath, size);
+                if (auto cached = cache.find<font::Font>(key))
+                    return Handle<font::Font>::ready(cached);
+
+                auto data = std::make_shared<archive::Blob>();
+                return submit<font::Font>(key, filePath,
+                    [=]() { *data = read_file(filePath); },
+                    [=](size_t& bytes) -> std::shared_ptr<font::Font>
+                    {
+                        if (!*data)
+                        {
+                            std::cerr << "Failed to load font " << filePath << std::endl;
+                            return nullptr;
+                        }
+
+                        auto loaded = std::make_shared<font::Font>(filePath, data->data, data->size, size, data->owner);
+                        bytes = data->size;
+                        return loaded->font ? loaded : nullptr;
+                    },
+                    []() { });
+            }
+
+            Handle<mixer::Sound> sound(const std::string& filePath)
+            {
+                std::string key = sound_key(filePath);
+                if (auto cached = cache.find<mixer::Sound>(key))
+                    return Handle<mixer::Sound>::ready(cached);
+
+                auto chunk = std::make_shared<Mix_Chunk*>(nullptr);
+                return submit<mixer::Sound>(key, filePath,
+                    [=]()
+                    {
+                        archive::Blob blob;
+                        *chunk = find_mounted(filePath, blob)
+                            ? Mix_LoadWAV_RW(SDL_RWFromConstMem(blob.data, static_cast<int>(blob.size)), 1)
+                            : Mix_LoadWAV(filePath.c_str());
+                    },
+                    [=](size_t& bytes) -> std::shared_ptr<mixer::Sound>
+                    {
+                        if (!*chunk)
+                        {
+                            std::cerr << "Failed to load sound: " << filePath << " Error: " << Mix_GetError() << std::endl;
+                            return nullptr;
+                        }
+
+                        bytes = (*chunk)->alen;
+                        auto loaded = std::make_shared<mixer::Sound>(*chunk);
+                        *chunk = nullptr;
+                        return loaded;
+                    },
+                    [=]() { if (*chunk) Mix_FreeChunk(*chunk); });
+            }
+
+            Handle<mixer::Music> music(const std::string& filePath)
+            {
+                std::string key = music_key(filePath);
+                if (auto cached = cache.find<mixer::Music>(key))
+                    return Handle<mixer::Music>::ready(cached);
+
+                auto data = std::make_shared<archive::Blob>();
+                return submit<mixer::Music>(key, filePath,
+                    [=]() { *data = read_file(filePath); },
+                    [=](size_t& bytes) -> std::shared_ptr<mixer::Music>
+                    {
+                        if (!*data)
+                        {
+                            std::cerr << "Failed to load music: " << filePath << std::endl;
+                            return nullptr;
+                        }
+
+                        auto loaded = std::make_shared<mixer::Music>(filePath, data->data, data->size, data->owner);
+                        bytes = data->size;
+                        return loaded->get_music() ? loaded : nullptr;
+                    },
+                    []() { });
+            }
+
+            int update(float budgetMs = 2.0f)
+            {
+                Uint64 start = SDL_GetPerformanceCounter();
+                Uint64 budget = static_cast<Uint64>(budgetMs / 1000.0f * SDL_GetPerformanceFrequency());
+
+                int finished = 0;
+                while (true)
+                {
+                    std::unique_ptr<Job> job;
+                    {
+                        std::lock_guard<std::mutex> lock(mutex);
+                        if (decoded.empty())
+                            break;
+                        job = std::move(decoded.front());
+                        decoded.pop_front();
+                    }
+
+                    job->finish();
+                    pending.erase(job->key);
+                    completed++;
+                    finished++;
+
+                    if (SDL_GetPerformanceCounter() - start >= budget)
+                        break;
+                }
+                return finished;
+            }
+
+            void wait()
+            {
+                while (!is_done())
+                {
+                    {
+                        std::unique_lock<std::mutex> lock(mutex);
+                        done.wait(lock, [this]() { return !decoded.empty(); });
+                    }
+                    update(1000.0f);
+                }
+            }
+
+            size_t get_total() const { return total; }
+            size_t get_completed() const { return completed; }
+            bool is_done() const { return completed == total; }
+            float get_progress() const { return total == 0 ? 1.0f : static_cast<float>(completed) / total; }
+
+        private:
+            struct Job
+            {
+                explicit Job(const std::string& _key) : key(_key) { }
+                virtual ~Job() = default;
+                virtual void decode() = 0;
+                virtual void finish() = 0;
+                virtual void discard() = 0;
+
+                std::string key;
+            };
+
+            template <typename T, typename Decode, typename Finish, typename Discard>
+            struct TypedJob : Job
+            {
+                TypedJob(const std::string& _key, const std::string& _filePath, std::shared_ptr<typename Handle<T>::State> _state,
+                         Decode _decode, Finish _finish, Discard _discard)
+                    : Job(_key), filePath(_filePath), state(_state), decodeFn(_decode), finishFn(_finish), discardFn(_discard) { }
+
+                void decode() override { decodeFn(); }
+
+                void finish() override
+                {
+                    size_t bytes = 0;
+                    state->result = finishFn(bytes);
+                    if (state->result)
+                        cache.insert(key, filePath, state->result, bytes);
+                    state->status = state->result ? LOAD_READY : LOAD_FAILED;
+                }
+
+                void discard() override
+                {
+                    discardFn();
+                    state->status = LOAD_FAILED;
+                }
+
+                std::string filePath;
+                std::shared_ptr<typename Handle<T>::State> state;
+                Decode decodeFn;
+                Finish finishFn;
+                Discard discardFn;
+            };
+
+            template <typename T, typename Decode, typename Finish, typename Discard>
+            Handle<T> submit(const std::string& key, const std::string& filePath, Decode decodeFn, Finish finishFn, Discard discardFn)
+            {
+                // A request for something still loading shares the first one's handle.
+                Handle<T> handle;
+                auto it = pending.find(key);
+                if (it != pending.end())
+                {
+                    handle.state = std::static_pointer_cast<typename Handle<T>::State>(it->second);
+                    return handle;
+                }
+
+                handle.state = std::make_shared<typename Handle<T>::State>();
+                pending[key] = handle.state;
+
+                std::unique_ptr<Job> job(new TypedJob<T, Decode, Finish, Discard>(key, filePath, handle.state, decodeFn, finishFn, discardFn));
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    queued.push_back(std::move(job));
+                    schedule();
+                }
+                total++;
+                return handle;
+            }
+
+            // Starts queued decodes up to the limit. Called with mutex held.
+            void schedule()
+            {
+                while (!stopping && decoding < decodeLimit && !queued.empty())
+                {
+                    Job* job = queued.front().release();
+                    queued.pop_front();
+                    decoding++;
+                    jobs::run([this, job]() { decode(job); }, &inFlight);
+                }
+            }
+
+            void decode(Job* raw)
+            {
+                std::unique_ptr<Job> job(raw);
+                job->decode();
+
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    decoded.push_back(std::move(job));
+                    decoding--;
+                    schedule();
+                }
+                done.notify_all();
+            }
+
+            SDL_Renderer* renderer;
+            int decodeLimit;
+            int decoding = 0;
+            jobs::Counter inFlight;
+
+            std::mutex mutex;
+            std::condition_variable done;
+            std::deque<std::unique_ptr<Job>> queued;
+            std::deque<std::unique_ptr<Job>> decoded;
+            bool stopping = false;
+
+            // Keys submitted but not finished yet. Only touched by the thread calling submit and update.
+            std::unordered_map<std::string, std::shared_ptr<void>> pending;
+
+            size_t total = 0;
+            size_t completed = 0;
+        };
+
+        inline std::shared_ptr<Surface> image(SDL_Renderer* renderer, const std::string& filePath)
+        {
+            return cache.image(renderer, filePath);
+        }
+
+        inline std::shared_ptr<font::Font> font(const std::string& filePath, float size = 12.0f)
+        {
+            return cache.font(filePath, size);
+        }
+
+        inline std::shared_ptr<mixer::Sound> sound(const std::string& filePath)
+        {
+            return cache.sound(filePath);
+        }
+
+        inline std::shared_ptr<mixer::Music> music(const std::string& filePath)
+        {
+            return cache.music(filePath);
+        }
+
+        inline size_t evict(const std::string& filePath)
+        {
+            return cache.evict(filePath);
+        }
+
+        inline size_t evict_unused()
+        {
+            return cache.evict_unused();
+        }
+
+        inline void clear()
+        {
+            cache.clear();
+        }
+
+        inline Stats get_stats()
+        {
+            return cache.get_stats();
+        }
+    }
+
+    namespace random
+    {
+        inline Uint64 rotl(Uint64 x, int k)
+        {
+            return (x << k) | (x >> (64 - k));
+        }
+
+        inline Uint64 splitmix64(Uint64& state)
+        {
+            Uint64 z = (state += 0x9E3779B97F4A7C15ull);
+            z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+            z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+            return z ^ (z >> 31);
+        }
+
+        // PCG-XSH-RR: 64-bit state, 32-bit output, and a selectable stream. Small enough to embed
+        // per object.
+        class Pcg32
+        {
+        public:
+            using result_type = Uint32;
+
+            Pcg32(Uint64 _seed = 0x853C49E6748FEA9Bull, Uint64 stream = 0xDA3E39CB94B95BDBull)
+            {
+                seed(_seed, stream);
+            }
+
+            void seed(Uint64 _seed, Uint64 stream = 0xDA3E39CB94B95BDBull)
+            {
+                state = 0;
+                increment = (stream << 1) | 1;
+                next();
+                state += _seed;
+                next();
+            }
+
+            Uint32 next()
+            {
+                Uint64 old = state;
+                state = old * 6364136223846793005ull + increment;
+                Uint32 xorshifted = static_cast<Uint32>(((old >> 18) ^ old) >> 27);
+                Uint32 rot = static_cast<Uint32>(old >> 59);
+                return (xorshifted >> rot) | (xorshifted << ((32 - rot) & 31));
+            }
+
+            // Unbiased value in [0, range).
+            Uint32 bounded(Uint32 range)
+            {
+                Uint32 threshold = (0u - range) % range;
+                while (true)
+                {
+                    Uint32 r = next();
+                    if (r >= threshold)
+                        return r % range;
+                }
+            }
+
+            Uint32 operator()() { return next(); }
+            static constexpr Uint32 min() { return 0; }
+            static constexpr Uint32 max() { return 0xFFFFFFFFu; }
+
+        private:
+            Uint64 state;
+            Uint64 increment;
+        };
+
+        // xoshiro256++ with convenience draws. Streams are 2^192 draws apart (long jump), so
+        // generators made with different stream numbers never overlap. The bulk fills run their own
+        // four interleaved lanes, each 2^128 apart, so they vectorize without touching next().
+        class Rng
+        {
+        public:
+            using result_type = Uint64;
+
+            Rng(Uint64 _seed = 0x9E3779B97F4A7C15ull, Uint64 stream = 0)
+            {
+                seed(_seed, stream);
+            }
+
+            void seed(Uint64 _seed, Uint64 stream = 0)
+            {
+                Uint64 sm = _seed;
+                for (Uint64& word : s)
+                    word = splitmix64(sm);
+                for (Uint64 i = 0; i < stream; i++)
+                    long_jump();
+                lanesReady = false;
+            }
+
+            Uint64 next()
+            {
+                Uint64 result = rotl(s[0] + s[3], 23) + s[0];
+                Uint64 t = s[1] << 17;
+                s[2] ^= s[0];
+                s[3] ^= s[1];
+                s[1] ^= s[2];
+                s[0] ^= s[3];
+                s[2] ^= t;
+                s[3] = rotl(s[3], 45);
+                return result;
+            }
+
+            Uint64 operator()() { return next(); }
+            static constexpr Uint64 min() { return 0; }
+            static constexpr Uint64 max() { return ~0ull; }
+
+            // Equivalent to 2^128 calls to next().
+            void jump()
+            {
+                static const Uint64 JUMP[] = { 0x180EC6D33CFD0ABAull, 0xD5A61266F0C9392Cull, 0xA9582618E03FC9AAull, 0x39ABDC4529B1661Cull };
+                apply_jump(JUMP);
+            }
+
+            // Equivalent to 2^192 calls to next().
+            void long_jump()
+            {
+                static const Uint64 LONG_JUMP[] = { 0x76E15D3EFEFDF5BFull, 0xC5004E441C522FB3ull, 0x77710069854EE241ull, 0x39109BB02ACBE635ull };
+                apply_jump(LONG_JUMP);
+            }
+
+            // [0, 1) with 24 bits of precision.
+            float random()
+            {
+                return static_cast<float>(next() >> 40) * (1.0f / 16777216.0f);
+            }
+
+            float uniform(float a, float b)
+            {
+                return a + (b - a) * random();
+            }
+
+            // Unbiased value in [0, range) (Lemire's multiply-shift with rejection).
+            Uint32 bounded(Uint32 range)
+            {
+                Uint64 m = (next() >> 32) * range;
+                Uint32 low = static_cast<Uint32>(m);
+                if (low < range)
+                {
+                    Uint32 threshold = (0u - range) % range;
+                    while (low < threshold)
+                    {
+                        m = (next() >> 32) * range;
+                        low = static_cast<Uint32>(m);
+                    }
+                }
+                return static_cast<Uint32>(m >> 32);
+            }
+
+            // Inclusive on both ends, like pygame's randint.
+            int randint(int a, int b)
+            {
+                if (a > b)
+                    std::swap(a, b);
+                Uint32 range = static_cast<Uint32>(static_cast<Sint64>(b) - a + 1);
+                if (range == 0)
+                    return static_cast<int>(static_cast<Uint32>(next() >> 32));
+                return static_cast<int>(static_cast<Uint32>(a) + bounded(range));
+            }
+
+            // Bulk draws produce 8 values per lane step; a tail shorter than 8 drops the rest of its
+            // step. randint here skips the rejection step: bias is at most range / 2^32.
+            void fill_uniform(float* out, size_t count, float a = 0.0f, float b = 1.0f)
+            {
+                prepare_lanes();
+                size_t i = 0;
+                float range = b - a;
+#if defined(CGAME_AVX2)
+                __m256i s0, s1, s2, s3;
+                load_lanes(s0, s1, s2, s3);
+                const __m256 scale = _mm256_set1_ps(1.0f / 16777216.0f);
+                const __m256 base = _mm256_set1_ps(a), width = _mm256_set1_ps(range);
+                for (; i + 8 <= count; i += 8)
+                {
+                    __m256i bits = _mm256_srli_epi32(step(s0, s1, s2, s3), 8);
+                    __m256 u = _mm256_mul_ps(_mm256_cvtepi32_ps(bits), scale);
+                    _mm256_storeu_ps(out + i, _mm256_add_ps(base, _mm256_mul_ps(width, u)));
+                }
+                store_lanes(s0, s1, s2, s3);
+#elif defined(CGAME_SSE2)
+                __m128i a0, a1, a2, a3, b0, b1, b2, b3;
+                load_lanes(a0, a1, a2, a3, 0);
+                load_lanes(b0, b1, b2, b3, 2);
+                const __m128 scale = _mm_set1_ps(1.0f / 16777216.0f);
+                const __m128 base = _mm_set1_ps(a), width = _mm_set1_ps(range);
+                for (; i + 8 <= count; i += 8)
+                {
+                    __m128i lo = _mm_srli_epi32(step(a0, a1, a2, a3), 8);
+                    __m128i hi = _mm_srli_epi32(step(b0, b1, b2, b3), 8);
+                    _mm_storeu_ps(out + i, _mm_add_ps(base, _mm_mul_ps(width, _mm_mul_ps(_mm_cvtepi32_ps(lo), scale))));
+                    _mm_storeu_ps(out + i + 4, _mm_add_ps(base, _mm_mul_ps(width, _mm_mul_ps(_mm_cvtepi32_ps(hi), scale))));
+                }
+                store_lanes(a0, a1, a2, a3, 0);
+                store_lanes(b0, b1, b2, b3, 2);
+#endif
+                fill_uniform_from(out, i, count, a, range);
+            }
+
+            void fill_uniform_scalar(float* out, size_t count, float a = 0.0f, float b = 1.0f)
+            {
+                prepare_lanes();
+                fill_uniform_from(out, 0, count, a, b - a);
+            }
+
+            void fill_randint(int* out, size_t count, int a, int b)
+            {
+                if (a > b)
+                    std::swap(a, b);
+                prepare_lanes();
+                Uint32 range = static_cast<Uint32>(static_cast<Sint64>(b) - a + 1);
+                size_t i = 0;
+#if defined(CGAME_AVX2)
+                __m256i s0, s1, s2, s3;
+                load_lanes(s0, s1, s2, s3);
+                const __m256i r = _mm256_set1_epi64x(range);
+                const __m256i base = _mm256_set1_epi32(a);
+                const __m256i highHalf = _mm256_set1_epi64x(static_cast<long long>(0xFFFFFFFF00000000ull));
+                for (; i + 8 <= count; i += 8)
+                {
+                    __m256i bits = step(s0, s1, s2, s3);
+                    if (range != 0)
+                    {
+                        __m256i even = _mm256_srli_epi64(_mm256_mul_epu32(bits, r), 32);
+                        __m256i odd = _mm256_and_si256(_mm256_mul_epu32(_mm256_srli_epi64(bits, 32), r), highHalf);
+                        bits = _mm256_or_si256(even, odd);
+                    }
+                    _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), _mm256_add_epi32(bits, base));
+                }
+                store_lanes(s0, s1, s2, s3);
+#elif defined(CGAME_SSE2)
+                __m128i a0, a1, a2, a3, b0, b1, b2, b3;
+                load_lanes(a0, a1, a2, a3, 0);
+                load_lanes(b0, b1, b2, b3, 2);
+                const __m128i r = _mm_set1_epi32(static_cast<int>(range));
+                const __m128i base = _mm_set1_epi32(a);
+                const __m128i highHalf = _mm_set_epi32(-1, 0, -1, 0);
+                for (; i + 8 <= count; i += 8)
+                {
+                    __m128i lanes[2] = { step(a0, a1, a2, a3), step(b0, b1, b2, b3) };
+                    for (int half = 0; half < 2; half++)
+                    {
+                        __m128i bits = lanes[half];
+                        if (range != 0)
+                        {
+                            __m128i even = _mm_srli_epi64(_mm_mul_epu32(bits, r), 32);
+                            __m128i odd = _mm_and_si128(_mm_mul_epu32(_mm_srli_epi64(bits, 32), r), highHalf);
+                            bits = _mm_or_si128(even, odd);
+                        }
+                        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i + half * 4), _mm_add_epi32(bits, base));
+                    }
+                }
+                store_lanes(a0, a1, a2, a3, 0);
+                store_lanes(b0, b1, b2, b3, 2);
+#endif
+                fill_randint_from(out, i, count, a, range);
+            }
+
+            void fill_randint_scalar(int* out, size_t count, int a, int b)
+            {
+                if (a > b)
+                    std::swap(a, b);
+                prepare_lanes();
+                fill_randint_from(out, 0, count, a, static_cast<Uint32>(static_cast<Sint64>(b) - a + 1));
+            }
+
+        private:
+            static constexpr int LANES = 4;
+
+            void apply_jump(const Uint64* table)
+            {
+                Uint64 t[4] = { 0, 0, 0, 0 };
+                for (int i = 0; i < 4; i++)
+                {
+                    for (int b = 0; b < 64; b++)
+                    {
+                        if (table[i] & (1ull << b))
+                        {
+                            for (int w = 0; w < 4; w++)
+                                t[w] ^= s[w];
+                        }
+                        next();
+                    }
+                }
+                std::copy(t, t + 4, s);
+            }
+
+            // Lanes start at this generator's state jumped 1..4 times, stored word-major so each
+            // state word of all four lanes loads as one vector.
+            void prepare_lanes()
+            {
+                if (lanesReady)
+                    return;
+
+                Uint64 saved[4];
+                std::copy(s, s + 4, saved);
+                for (int l = 0; l < LANES; l++)
+                {
+                    jump();
+                    for (int w = 0; w < 4; w++)
+                        lanes[w][l] = s[w];
+                }
+                std::copy(saved, saved + 4, s);
+                lanesReady = true;
+            }
+
+            // One xoshiro256++ step of every lane; output l gives values 2l (low half) and 2l + 1.
+            void step_lanes_scalar(Uint32 out[2 * LANES])
+            {
+                for (int l = 0; l < LANES; l++)
+                {
+                    Uint64 s0 = lanes[0][l], s1 = lanes[1][l], s2 = lanes[2][l], s3 = lanes[3][l];
+                    Uint64 result = rotl(s0 + s3, 23) + s0;
+                    Uint64 t = s1 << 17;
+                    s2 ^= s0;
+                    s3 ^= s1;
+                    s1 ^= s2;
+                    s0 ^= s3;
+                    s2 ^= t;
+                    s3 = rotl(s3, 45);
+                    lanes[0][l] = s0;
+                    lanes[1][l] = s1;
+                    lanes[2][l] = s2;
+                    lanes[3][l] = s3;
+                    out[2 * l] = static_cast<Uint32>(result);
+                    out[2 * l + 1] = static_cast<Uint32>(result >> 32);
+                }
+            }
+
+            void fill_uniform_from(float* out, size_t i, size_t count, float a, float range)
+            {
+                Uint32 bits[2 * LANES];
+                while (i < count)
+                {
+                    step_lanes_scalar(bits);
+                    for (int k = 0; k < 2 * LANES && i < count; k++, i++)
+                        out[i] = a + range * (static_cast<float>(bits[k] >> 8) * (1.0f / 16777216.0f));
+                }
+            }
+
+            void fill_randint_from(int* out, size_t i, size_t count, int a, Uint32 range)
+            {
+                Uint32 bits[2 * LANES];
+                while (i < count)
+                {
+                    step_lanes_scalar(bits);
+                    for (int k = 0; k < 2 * LANES && i < count; k++, i++)
+                    {
+                        Uint32 v = range ? static_cast<Uint32>((static_cast<Uint64>(bits[k]) * range) >> 32) : bits[k];
+                        out[i] = static_cast<int>(static_cast<Uint32>(a) + v);
+                    }
+                }
+            }
+
+#if defined(CGAME_AVX2)
+            static __m256i rotl_lanes(__m256i x, int k)
+            {
+                return _mm256_or_si256(_mm256_slli_epi64(x, k), _mm256_srli_epi64(x, 64 - k));
+            }
+
+            static __m256i step(__m256i& s0, __m256i& s1, __m256i& s2, __m256i& s3)
+            {
+                __m256i result = _mm256_add_epi64(rotl_lanes(_mm256_add_epi64(s0, s3), 23), s0);
+                __m256i t = _mm256_slli_epi64(s1, 17);
+                s2 = _mm256_xor_si256(s2, s0);
+                s3 = _mm256_xor_si256(s3, s1);
+                s1 = _mm256_xor_si256(s1, s2);
+                s0 = _mm256_xor_si256(s0, s3);
+                s2 = _mm256_xor_si256(s2, t);
+                s3 = rotl_lanes(s3, 45);
+                return result;
+            }
+
+            void load_lanes(__m256i& s0, __m256i& s1, __m256i& s2, __m256i& s3) const
+            {
+                s0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(lanes[0]));
+                s1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(lanes[1]));
+                s2 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(lanes[2]));
+                s3 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(lanes[3]));
+            }
+
+            void store_lanes(__m256i s0, __m256i s1, __m256i s2, __m256i s3)
+            {
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes[0]), s0);
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes[1]), s1);
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes[2]), s2);
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes[3]), s3);
+            }
+#elif defined(CGAME_SSE2)
+            static __m128i rotl_lanes(__m128i x, int k)
+            {
+                return _mm_or_si128(_mm_slli_epi64(x, k), _mm_srli_epi64(x, 64 - k));
+            }
+
+            static __m128i step(__m128i& s0, __m128i& s1, __m128i& s2, __m128i& s3)
+            {
+                __m128i result = _mm_add_epi64(rotl_lanes(_mm_add_epi64(s0, s3), 23), s0);
+                __m128i t = _mm_slli_epi64(s1, 17);
+                s2 = _mm_xor_si128(s2, s0);
+                s3 = _mm_xor_si128(s3, s1);
+                s1 = _mm_xor_si128(s1, s2);
+                s0 = _mm_xor_si128(s0, s3);
+                s2 = _mm_xor_si128(s2, t);
+                s3 = rotl_lanes(s3, 45);
+                return result;
+            }
+
+            // Two of the four lanes, starting at lane `first`.
+            void load_lanes(__m128i& s0, __m128i& s1, __m128i& s2, __m128i& s3, int first) const
+            {
+                s0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(lanes[0] + first));
+                s1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(lanes[1] + first));
+                s2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(lanes[2] + first));
+                s3 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(lanes[3] + first));
+            }
+
+            void store_lanes(__m128i s0, __m128i s1, __m128i s2, __m128i s3, int first)
+            {
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes[0] + first), s0);
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes[1] + first), s1);
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes[2] + first), s2);
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes[3] + first), s3);
+            }
+#endif
+
+            Uint64 s[4];
+            Uint64 lanes[4][LANES];
+            bool lanesReady = false;
+        };
+
+        // The free functions draw from a thread_local Rng per thread, seeded from the global seed and
+        // a stream number given out in order of first use. seed() reseeds every thread's stream on
+        // its next draw, so a single-threaded game replays exactly from its seed.
+        static std::atomic<unsigned int> currentSeed{ std::random_device{}() };
+        static std::atomic<Uint32> seedGeneration{ 0 };
+        static std::atomic<Uint32> nextStream{ 0 };
+
+        inline Rng& thread_rng()
+        {
+            struct Local
+            {
+                Rng rng;
+                Uint32 stream = nextStream.fetch_add(1, std::memory_order_relaxed);
+                Uint32 generation = ~0u;
+            };
+            thread_local Local local;
+
+            Uint32 generation = seedGeneration.load(std::memory_order_acquire);
+            if (local.generation != generation)
+            {
+                local.rng.seed(currentSeed.load(std::memory_order_relaxed), local.stream);
+                local.generation = generation;
+            }
+            return local.rng;
+        }
+
+        inline void seed(unsigned int s)
+        {
+            currentSeed.store(s, std::memory_order_relaxed);
+            seedGeneration.fetch_add(1, std::memory_order_release);
+        }
+
+        inline unsigned int get_seed()
+        {
+            return currentSeed.load(std::memory_order_relaxed);
+        }
+
+        inline float random() 
+        {
+            return thread_rng().random();
+        }
+
+        inline float uniform(float a, float b)
+        {
+            return thread_rng().uniform(a, b);
+        }
+
+        inline int randint(int a, int b)
+        {
+            return thread_rng().randint(a, b);
+        }
+
+        inline void fill_uniform(float* out, size_t count, float a = 0.0f, float b = 1.0f)
+        {
+            thread_rng().fill_uniform(out, count, a, b);
+        }
+
+        inline void fill_randint(int* out, size_t count, int a, int b)
+        {
+            thread_rng().fill_randint(out, count, a, b);
+        }
+
+        // Seeded 2D lattice noise for procedural content. All three return roughly [-1, 1].
+        class Noise
+        {
+        public:
+            explicit Noise(Uint64 _seed = 0)
+            {
+                seed(_seed);
+            }
+
+            void seed(Uint64 _seed)
+            {
+                Pcg32 shuffle(_seed);
+                for (int i = 0; i < 256; i++)
+                    perm[i] = static_cast<Uint8>(i);
+                for (int i = 255; i > 0; i--)
+                    std::swap(perm[i], perm[shuffle.bounded(static_cast<Uint32>(i + 1))]);
+                std::copy(perm, perm + 256, perm + 256);
+            }
+
+            float value(float x, float y) const
+            {
+                int xi = fast_floor(x), yi = fast_floor(y);
+                float u = fade(x - xi), v = fade(y - yi);
+
+                float a = lattice(xi, yi), b = lattice(xi + 1, yi);
+                float c = lattice(xi, yi + 1), d = lattice(xi + 1, yi + 1);
+                return math::lerp(math::lerp(a, b, u), math::lerp(c, d, u), v);
+            }
+
+            float perlin(float x, float y) const
+            {
+                int xi = fast_floor(x), yi = fast_floor(y);
+                float xf = x - xi, yf = y - yi;
+                float u = fade(xf), v = fade(yf);
+
+                float a = grad(hash(xi, yi), xf, yf);
+                float b = grad(hash(xi + 1, yi), xf - 1.0f, yf);
+                float c = grad(hash(xi, yi + 1), xf, yf - 1.0f);
+                float d = grad(hash(xi + 1, yi + 1), xf - 1.0f, yf - 1.0f);
+                return math::lerp(math::lerp(a, b, u), math::lerp(c, d, u), v);
+            }
+
+            float simplex(float x, float y) const
+            {
+                const float F2 = 0.36602540378f; // (sqrt(3) - 1) / 2
+                const float G2 = 0.21132486540f; // (3 - sqrt(3)) / 6
+
+                float skew = (x + y) * F2;
+                int i = fast_floor(x + skew), j = fast_floor(y + skew);
+                float unskew = (i + j) * G2;
+                float x0 = x - (i - unskew), y0 = y - (j - unskew);
+
+                int i1 = x0 > y0 ? 1 : 0;
+                int j1 = 1 - i1;
+                float x1 = x0 - i1 + G2, y1 = y0 - j1 + G2;
+                float x2 = x0 - 1.0f + 2.0f * G2, y2 = y0 - 1.0f + 2.0f * G2;
+
+                float n = corner(hash(i, j), x0, y0) + corner(hash(i + i1, j + j1), x1, y1) + corner(hash(i + 1, j + 1), x2, y2);
+                return 70.0f * n;
+            }
+
+            // Octaves of simplex noise, normalized back to roughly [-1, 1].
+            float fbm(float x, float y, int octaves = 4, float lacunarity = 2.0f, float gain = 0.5f) const
+            {
+                float sum = 0.0f, amplitude = 1.0f, total = 0.0f;
+                for (int o = 0; o < octaves; o++)
+                {
+                    sum += amplitude * simplex(x, y);
+                    total += amplitude;
+                    x *= lacunarity;
+                    y *= lacunarity;
+                    amplitude *= gain;
+                }
+                return total > 0.0f ? sum / total : 0.0f;
+            }
+
+        private:
+            static int fast_floor(float x)
+            {
+                int i = static_cast<int>(x);
+                return x < i ? i - 1 : i;
+            }
+
+            static float fade(float t)
+            {
+                return t * t * t * (t * (t * 6.0f - 15.0f) + 10.0f);
+            }
+
+            static float grad(int h, float x, float y)
+            {
+                switch (h & 7)
+                {
+                case 0: return x + y;
+                case 1: return -x + y;
+                case 2: return x - y;
+                case 3: return -x - y;
+                case 4: return x;
+                case 5: return -x;
+                case 6: return y;
+                default: return -y;
+                }
+            }
+
+            static float corner(int h, float x, float y)
+            {
+                float t = 0.5f - x * x - y * y;
+                if (t < 0.0f)
+                    return 0.0f;
+                t *= t;
+                return t * t * grad(h, x, y);
+            }
+
+            int hash(int x, int y) const
+            {
+                return perm[perm[x & 255] + (y & 255)];
+            }
+
+            float lattice(int x, int y) const
+            {
+                return hash(x, y) * (2.0f / 255.0f) - 1.0f;
+            }
+
+            Uint8 perm[512];
+        };
+    }
+
+    namespace particles
+    {
+        // Piecewise-linear value over a particle's normalized age (0 at spawn, 1 at death).
+        class Curve
+        {
+        public:
+            static constexpr int MAX_KEYS = 8;
+
+            Curve(float value = 1.0f) { add(0.0f, value); }
+
+            // Evenly spaced keys from birth to death.
+            Curve(std::initializer_list<float> values)
+            {
+                int n = static_cast<int>(std::min(values.size(), static_cast<size_t>(MAX_KEYS)));
+                int i = 0;
+                for (float value : values)
+                {
+                    if (i == n)
+                        break;
+                    add(n > 1 ? static_cast<float>(i) / (n - 1) : 0.0f, value);
+                    i++;
+                }
+            }
+
+            Curve& add(float t, float value)
+            {
+                if (count == MAX_KEYS)
+                    return *this;
+
+                t = std::clamp(t, 0.0f, 1.0f);
+                int i = count;
+                while (i > 0 && times[i - 1] > t)
+                {
+                    times[i] = times[i - 1];
+                    values[i] = values[i - 1];
+                    i--;
+                }
+                times[i] = t;
+                values[i] = value;
+                count++;
+                return *this;
+            }
+
+            float evaluate(float t) const
+            {
+                if (count == 0)
+                    return 0.0f;
+                if (t <= times[0])
+                    return values[0];
+
+                for (int i = 1; i < count; i++)
+                {
+                    if (t <= times[i])
+                    {
+                        float span = times[i] - times[i - 1];
+                        float f = span > 0.0f ? (t - times[i - 1]) / span : 1.0f;
+                        return values[i - 1] + (values[i] - values[i - 1]) * f;
+                    }
+                }
+                return values[count - 1];
+            }
+
+        private:
+            float times[MAX_KEYS] = {};
+            float values[MAX_KEYS] = {};
+            int count = 0;
+        };
+
+        class ColorCurve
+        {
+        public:
+            ColorCurve(Color color = { 255, 255, 255, 255 }) { add(0.0f, color); }
+
+            ColorCurve(std::initializer_list<Color> colors)
+            {
+                int n = static_cast<int>(std::min(colors.size(), static_cast<size_t>(Curve::MAX_KEYS)));
+                int i = 0;
+                for (Color color : colors)
+                {
+                    if (i == n)
+                        break;
+                    add(n > 1 ? static_cast<float>(i) / (n - 1) : 0.0f, color);
+                    i++;
+                }
+            }
+
+            ColorCurve& add(float t, Color color)
+            {
+                r.add(t, color.r);
+                g.add(t, color.g);
+                b.add(t, color.b);
+                a.add(t, color.a);
+                return *this;
+            }
+
+            Color evaluate(float t) const
+            {
+                return { to_channel(r.evaluate(t)), to_channel(g.evaluate(t)), to_channel(b.evaluate(t)), to_channel(a.evaluate(t)) };
+            }
+
+        private:
+            static Uint8 to_channel(float value)
+            {
+                return static_cast<Uint8>(std::clamp(value, 0.0f, 255.0f) + 0.5f);
+            }
+
+            Curve r, g, b, a;
+        };
+
+        struct EmitterConfig
+        {
+            float rate = 50.0f;                 // particles per second while emitting
+            float lifetimeMin = 1.0f, lifetimeMax = 1.0f;
+            float speedMin = 50.0f, speedMax = 100.0f;
+            float direction = -90.0f;           // degrees; 0 is +x, -90 is up
+            float spread = 360.0f;              // degrees around direction
+            Vec2 area = { 0, 0 };               // spawn box centered on the emitter position
+            Vec2 gravity = { 0, 0 };
+            float drag = 0.0f;                  // velocity lost per second, exponential
+
+            Curve speed = 1.0f;                 // velocity multiplier
+            Curve size = 8.0f;                  // quad edge in pixels
+            Curve alpha = 1.0f;                 // multiplies the color's alpha
+            ColorCurve color;
+        };
+
+        // Advances count particles by dt: velocity is damped and gains gravity, position moves by
+        // velocity times the per-particle speed scale, and the normalized age grows by dt / lifetime.
+        inline void integrate_scalar(float* px, float* py, float* vx, float* vy, float* age, const float* ageRate, const float* speedScale,
+                                     size_t count, float dt, float damping, float gx, float gy)
+        {
+            for (size_t i = 0; i < count; i++)
+            {
+                vx[i] = vx[i] * damping + gx * dt;
+                vy[i] = vy[i] * damping + gy * dt;
+                px[i] += vx[i] * speedScale[i] * dt;
+                py[i] += vy[i] * speedScale[i] * dt;
+                age[i] += ageRate[i] * dt;
+            }
+        }
+
+        inline void integrate(float* px, float* py, float* vx, float* vy, float* age, const float* ageRate, const float* speedScale,
+                              size_t count, float dt, float damping, float gx, float gy)
+        {
+            size_t i = 0;
+#if defined(CGAME_AVX2)
+            const __m256 d = _mm256_set1_ps(dt), damp = _mm256_set1_ps(damping);
+            const __m256 gxdt = _mm256_set1_ps(gx * dt), gydt = _mm256_set1_ps(gy * dt);
+            for (; i + 8 <= count; i += 8)
+            {
+                __m256 nvx = _mm256_add_ps(_mm256_mul_ps(_mm256_loadu_ps(vx + i), damp), gxdt);
+                __m256 nvy = _mm256_add_ps(_mm256_mul_ps(_mm256_loadu_ps(vy + i), damp), gydt);
+                __m256 step = _mm256_mul_ps(_mm256_loadu_ps(speedScale + i), d);
+                _mm256_storeu_ps(vx + i, nvx);
+                _mm256_storeu_ps(vy + i, nvy);
+                _mm256_storeu_ps(px + i, _mm256_add_ps(_mm256_loadu_ps(px + i), _mm256_mul_ps(nvx, step)));
+                _mm256_storeu_ps(py + i, _mm256_add_ps(_mm256_loadu_ps(py + i), _mm256_mul_ps(nvy, step)));
+                _mm256_storeu_ps(age + i, _mm256_add_ps(_mm256_loadu_ps(age + i), _mm256_mul_ps(_mm256_loadu_ps(ageRate + i), d)));
+            }
+#elif defined(CGAME_SSE2)
+            const __m128 d = _mm_set1_ps(dt), damp = _mm_set1_ps(damping);
+            const __m128 gxdt = _mm_set1_ps(gx * dt), gydt = _mm_set1_ps(gy * dt);
+            for (; i + 4 <= count; i += 4)
+            {
+                __m128 nvx = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(vx + i), damp), gxdt);
+                __m128 nvy = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(vy + i), damp), gydt);
+                __m128 step = _mm_mul_ps(_mm_loadu_ps(speedScale + i), d);
+                _mm_storeu_ps(vx + i, nvx);
+                _mm_storeu_ps(vy + i, nvy);
+                _mm_storeu_ps(px + i, _mm_add_ps(_mm_loadu_ps(px + i), _mm_mul_ps(nvx, step)));
+                _mm_storeu_ps(py + i, _mm_add_ps(_mm_loadu_ps(py + i), _mm_mul_ps(nvy, step)));
+                _mm_storeu_ps(age + i, _mm_add_ps(_mm_loadu_ps(age + i), _mm_mul_ps(_mm_loadu_ps(ageRate + i), d)));
+            }
+#endif
+            integrate_scalar(px + i, py + i, vx + i, vy + i, age + i, ageRate + i, speedScale + i, count - i, dt, damping, gx, gy);
+        }
+
+        // A fixed-capacity pool of particles stored as parallel arrays. All storage is allocated up
+        // front; spawning past capacity drops the new particles instead of growing.
+        class Emitter
+        {
+        public:
+            static constexpr int LUT_SIZE = 64;
+
+            Emitter(const EmitterConfig& _config, size_t _capacity, Surface* _texture = NULL)
+                : capacity(_capacity), rng(random::thread_rng().next())
+            {
+                for (std::vector<float>* array : { &px, &py, &vx, &vy, &age, &ageRate, &speedScale })
+                    array->resize(capacity);
+                set_config(_config);
+                set_texture(_texture);
+            }
+
+            void set_config(const EmitterConfig& _config)
+            {
+                config = _config;
+                for (int i = 0; i < LUT_SIZE; i++)
+                {
+                    float t = static_cast<float>(i) / (LUT_SIZE - 1);
+                    Color c = config.color.evaluate(t);
+                    float alpha = std::clamp(c.a * config.alpha.evaluate(t), 0.0f, 255.0f);
+                    speedLut[i] = config.speed.evaluate(t);
+                    sizeLut[i] = config.size.evaluate(t);
+                    colorLut[i] = { c.r, c.g, c.b, static_cast<Uint8>(alpha + 0.5f) };
+                }
+            }
+
+            // Draws the surface's region as each particle, or plain colored quads without one.
+            void set_texture(Surface* _texture)
+            {
+                texture = _texture ? _texture->get_surface() : NULL;
+                u0 = v0 = 0.0f;
+                u1 = v1 = 1.0f;
+
+                int texW = 0, texH = 0;
+                if (texture && SDL_QueryTexture(texture, NULL, NULL, &texW, &texH) == 0 && texW > 0 && texH > 0)
+                {
+                    SDL_Rect region = _texture->get_region();
+                    u0 = static_cast<float>(region.x) / texW;
+                    v0 = static_cast<float>(region.y) / texH;
+                    u1 = static_cast<float>(region.x + region.w) / texW;
+                    v1 = static_cast<float>(region.y + region.h) / texH;
+                }
+            }
+
+            void set_position(Vec2 _position) { position = _position; }
+            void start() { emitting = true; }
+            void stop() { emitting = false; }
+
+            void burst(int n)
+            {
+                for (int i = 0; i < n; i++)
+                    spawn();
+            }
+
+            void clear()
+            {
+                count = 0;
+                accumulator = 0.0f;
+            }
+
+            void update(float dt)
+            {
+                if (count > 0)
+                {
+                    integrate(px.data(), py.data(), vx.data(), vy.data(), age.data(), ageRate.data(), speedScale.data(),
+                              count, dt, std::exp(-config.drag * dt), config.gravity.x, config.gravity.y);
+                    compact();
+                }
+
+                if (emitting)
+                {
+                    accumulator += config.rate * dt;
+                    int n = static_cast<int>(accumulator);
+                    accumulator -= static_cast<float>(n);
+                    burst(n);
+                }
+            }
+
+            const EmitterConfig& get_config() const { return config; }
+            SDL_Texture* get_texture() const { return texture; }
+            Vec2 get_position() const { return position; }
+            bool is_emitting() const { return emitting; }
+            bool is_finished() const { return !emitting && count == 0; }
+            size_t get_count() const { return count; }
+            size_t get_capacity() const { return capacity; }
+
+            // Writes four vertices per live particle, positioned through toScreen with sizes scaled
+            // by sizeScale. Returns the bounds of what was written.
+            Rect write_quads(SDL_Vertex* out, const math::Transform& toScreen, float sizeScale) const
+            {
+                float minX = 0, minY = 0, maxX = 0, maxY = 0;
+                for (size_t i = 0; i < count; i++)
+                {
+                    int k = lut_index(age[i]);
+                    float half = sizeLut[k] * sizeScale * 0.5f;
+                    Vec2 c = toScreen.apply({ px[i], py[i] });
+                    SDL_Color color = colorLut[k];
+
+                    SDL_Vertex* v = out + i * 4;
+                    v[0] = { { c.x - half, c.y - half }, color, { u0, v0 } };
+                    v[1] = { { c.x + half, c.y - half }, color, { u1, v0 } };
+                    v[2] = { { c.x + half, c.y + half }, color, { u1, v1 } };
+                    v[3] = { { c.x - half, c.y + half }, color, { u0, v1 } };
+
+                    if (i == 0)
+                    {
+                        minX = c.x - half;
+                        minY = c.y - half;
+                        maxX = c.x + half;
+                        maxY = c.y + half;
+                    }
+                    else
+                    {
+                        minX = std::min(minX, c.x - half);
+                        minY = std::min(minY, c.y - half);
+                        maxX = std::max(maxX, c.x + half);
+                        maxY = std::max(maxY, c.y + half);
+                    }
+                }
+                return { minX, minY, maxX - minX, maxY - minY };
+            }
+
+        private:
+            static int lut_index(float t)
+            {
+                return std::clamp(static_cast<int>(t * (LUT_SIZE - 1) + 0.5f), 0, LUT_SIZE - 1);
+            }
+
+            void spawn()
+            {
+                if (count == capacity)
+                    return;
+
+                size_t i = count++;
+                float angle = math::radians(config.direction + (rng.random() - 0.5f) * config.spread);
+                float speed = rng.uniform(config.speedMin, config.speedMax);
+                float lifetime = std::max(rng.uniform(config.lifetimeMin, config.lifetimeMax), 0.001f);
+
+                px[i] = position.x + (rng.random() - 0.5f) * config.area.x;
+                py[i] = position.y + (rng.random() - 0.5f) * config.area.y;
+                vx[i] = std::cos(angle) * speed;
+                vy[i] = std::sin(angle) * speed;
+                age[i] = 0.0f;
+                ageRate[i] = 1.0f / lifetime;
+                speedScale[i] = speedLut[0];
+            }
+
+            // Swap-removes dead particles and looks up each survivor's speed scale for the next step.
+            void compact()
+            {
+                size_t i = 0;
+                while (i < count)
+                {
+                    if (age[i] >= 1.0f)
+                    {
+                        count--;
+                        px[i] = px[count];
+                        py[i] = py[count];
+                        vx[i] = vx[count];
+                        vy[i] = vy[count];
+                        age[i] = age[count];
+                        ageRate[i] = ageRate[count];
+                        continue;
+                    }
+                    speedScale[i] = speedLut[lut_index(age[i])];
+                    i++;
+                }
+            }
+
+            EmitterConfig config;
+            size_t capacity;
+            size_t count = 0;
+            std::vector<float> px, py, vx, vy, age, ageRate, speedScale;
+
+            float speedLut[LUT_SIZE];
+            float sizeLut[LUT_SIZE];
+            SDL_Color colorLut[LUT_SIZE];
+
+            SDL_Texture* texture = NULL;
+            float u0 = 0, v0 = 0, u1 = 1, v1 = 1;
+
+            Vec2 position;
+            bool emitting = true;
+            float accumulator = 0.0f;
+            random::Rng rng;
+        };
+
+        struct Stats
+        {
+            size_t particles = 0;
+            int drawCalls = 0;
+        };
+
+        // Owns emitters and draws them with one SDL_RenderGeometry call per texture. Vertex and
+        // index storage grows only when emitters are added.
+        class ParticleSystem
+        {
+        public:
+            static constexpr size_t PARALLEL_THRESHOLD = 8192;
+
+            Emitter& add_emitter(const EmitterConfig& config, size_t capacity, Surface* texture = NULL)
+            {
+                emitters.push_back(std::make_unique<Emitter>(config, capacity, texture));
+                reserve();
+                return *emitters.back();
+            }
+
+            void remove_emitter(Emitter& emitter)
+            {
+                emitters.erase(std::remove_if(emitters.begin(), emitters.end(), [&](const std::unique_ptr<Emitter>& e)
+                {
+                    return e.get() == &emitter;
+                }), emitters.end());
+            }
+
+            // Emitters are independent; with set_parallel, busy systems update them across the job
+            // system. That queues a few small jobs per update, so it is off by default.
+            void set_parallel(bool enabled) { parallel = enabled; }
+
+            void update(float dt)
+            {
+                CGAME_PROFILE_ZONE("ParticleSystem::update");
+                if (!parallel || emitters.size() < 2 || get_count() < PARALLEL_THRESHOLD)
+                {
+                    for (auto& emitter : emitters)
+                        emitter->update(dt);
+                    return;
+                }
+
+                jobs::parallel_for(0, emitters.size(), 1, [this, dt](size_t first, size_t last)
+                {
+                    for (size_t i = first; i < last; i++)
+                        emitters[i]->update(dt);
+                });
+            }
+
+            void draw(Surface& target)
+            {
+                draw(target, math::Transform::identity(), 1.0f);
+            }
+
+            void draw(Surface& target, const Camera& camera)
+            {
+                draw(target, camera.get_transform(), camera.get_zoom());
+            }
+
+            void clear()
+            {
+                for (auto& emitter : emitters)
+                    emitter->clear();
+            }
+
+            size_t get_count() const
+            {
+                size_t total = 0;
+                for (const auto& emitter : emitters)
+                    total += emitter->get_count();
+                return total;
+            }
+
+            const Stats& get_stats() const { return stats; }
+
+        private:
+            void reserve()
+            {
+                size_t quads = 0;
+                for (const auto& emitter : emitters)
+                    quads += emitter->get_capacity();
+
+                vertices.resize(quads * 4);
+                while (indices.size() < quads * 6)
+                {
+                    int base = static_cast<int>(indices.size() / 6) * 4;
+                    indices.insert(indices.end(), { base, base + 1, base + 2, base + 2, base + 3, base });
+                }
+                order.reserve(emitters.size());
+            }
+
+            void draw(Surface& target, const math::Transform& toScreen, float sizeScale)
+            {
+                CGAME_PROFILE_ZONE("ParticleSystem::draw");
+                stats = Stats();
+
+                // Emitters sharing a texture end up adjacent and share a draw call. Insertion sort
+                // keeps the order stable without the temporary buffer std::stable_sort allocates.
+                order.clear();
+                for (auto& emitter : emitters)
+                {
+                    if (emitter->get_count() == 0)
+                        continue;
+
+                    order.push_back(emitter.get());
+                    for (size_t i = order.size() - 1; i > 0 && order[i - 1]->get_texture() > order[i]->get_texture(); i--)
+                        std::swap(order[i - 1], order[i]);
+                }
+                if (order.empty())
+                    return;
+
+                SDL_Renderer* renderer = display::get_renderer();
+                batch::flush();
+                SDL_Texture* previousTarget = SDL_GetRenderTarget(renderer);
+                SDL_SetRenderTarget(renderer, target.get_surface());
+
+                size_t runStart = 0;
+                while (runStart < order.size())
+                {
+                    SDL_Texture* texture = order[runStart]->get_texture();
+                    size_t quads = 0;
+                    size_t runEnd = runStart;
+                    for (; runEnd < order.size() && order[runEnd]->get_texture() == texture; runEnd++)
+                    {
+                        Rect bounds = order[runEnd]->write_quads(vertices.data() + quads * 4, toScreen, sizeScale);
+                        target.mark_dirty(bounds);
+                        quads += order[runEnd]->get_count();
+                    }
+
+                    if (texture)
+                        SDL_SetTextureScaleMode(texture, SDL_ScaleModeNearest);
+                    SDL_RenderGeometry(renderer, texture, vertices.data(), static_cast<int>(quads * 4), indices.data(), static_cast<int>(quads * 6));
+                    stats.particles += quads;
+                    stats.drawCalls++;
+                    runStart = runEnd;
+                }
+
+                SDL_SetRenderTarget(renderer, previousTarget);
+            }
+
+            std::vector<std::unique_ptr<Emitter>> emitters;
+            std::vector<Emitter*> order;
+            std::vector<SDL_Vertex> vertices;
+            std::vector<int> indices;
+            Stats stats;
+            bool parallel = false;
+        };
+    }
+
+    namespace collision
+    {
+        class SpatialHash
+        {
+        public:
+            SpatialHash(float _cellSize = 64.0f)
+                : cellSize(_cellSize), invCellSize(1.0f / _cellSize) { }
+
+            int insert(const Rect& rect)
+            {
+                int id;
+                if (!freeIds.empty())
+                {
+                    id = freeIds.back();
+                    freeIds.pop_back();
+                }
+                else
+                {
+                    id = static_cast<int>(items.size());
+                    items.emplace_back();
+                    stamps.push_back(0);
+                }
+
+                Item& item = items[id];
+                item.rect = rect;
+                item.alive = true;
+                cell_range(rect, item.x0, item.y0, item.x1, item.y1);
+                link(id, item.x0, item.y0, item.x1, item.y1);
+                count++;
+                return id;
+            }
+
+            void build(const std::vector<Rect>& rects)
+            {
+                clear();
+                items.reserve(rects.size());
+                stamps.reserve(rects.size());
+                for (const Rect& rect : rects)
+                    insert(rect);
+            }
+
+            void move(int id, const Rect& rect)
+            {
+                if (!contains(id))
+                    return;
+
+                Item& item = items[id];
+                item.rect = rect;
+
+                int x0, y0, x1, y1;
+                cell_range(rect, x0, y0, x1, y1);
+                if (x0 == item.x0 && y0 == item.y0 && x1 == item.x1 && y1 == item.y1)
+                    return;
+
+                unlink(id, item.x0, item.y0, item.x1, item.y1);
+                item.x0 = x0; item.y0 = y0; item.x1 = x1; item.y1 = y1;
+                link(id, x0, y0, x1, y1);
+            }
+
+            void remove(int id)
+            {
+                if (!contains(id))
+                    return;
+
+                Item& item = items[id];
+                unlink(id, item.x0, item.y0, item.x1, item.y1);
+                item.alive = false;
+                freeIds.push_back(id);
+                count--;
+            }
+
+            void clear()
+            {
+                cells.clear();
+                items.clear();
+                stamps.clear();
+                freeIds.clear();
+                count = 0;
+                stamp = 0;
+            }
+
+            bool contains(int id) const { return id >= 0 && id < static_cast<int>(items.size()) && items[id].alive; }
+            const Rect& get_rect(int id) const { return items[id].rect; }
+            size_t size() const { return count; }
+            float get_cell_size() const { return cellSize; }
+
+            void query(const Rect& rect, std::vector<int>& out) const
+            {
+                int x0, y0, x1, y1;
+                cell_range(rect, x0, y0, x1, y1);
+                Uint32 current = next_stamp();
+
+                for (int cy = y0; cy <= y1; cy++)
+                {
+                    for (int cx = x0; cx <= x1; cx++)
+                    {
+                        auto it = cells.find(key(cx, cy));
+                        if (it == cells.end())
+                            continue;
+
+                        for (int id : it->second.ids)
+                        {
+                            if (stamps[id] == current)
+                                continue;
+                            stamps[id] = current;
+
+                            if (items[id].rect.colliderect(rect))
+                                out.push_back(id);
+                        }
+                    }
+                }
+            }
+
+            void query_point(float px, float py, std::vector<int>& out) const
+            {
+                auto it = cells.find(key(cell_coord(px), cell_coord(py)));
+                if (it == cells.end())
+                    return;
+
+                for (int id : it->second.ids)
+                {
+                    if (items[id].rect.collidepoint(px, py))
+                        out.push_back(id);
+                }
+            }
+
+            // Every overlapping pair once, as (lower id, higher id). A pair is reported only from the
+            // first cell both items share, so no dedup set is needed.
+            void query_pairs(std::vector<std::pair<int, int>>& out) const
+            {
+                for (const auto& entry : cells)
+                    cell_pairs(entry.second, out);
+            }
+
+            // Same pairs as query_pairs, in a different order, with the cells split across the job system.
+            void query_pairs_parallel(std::vector<std::pair<int, int>>& out) const
+            {
+                size_t buckets = cells.bucket_count();
+                size_t slices = std::min(buckets, static_cast<size_t>(jobs::get_worker_count() + 1) * 4);
+                partials.resize(slices);
+
+                jobs::parallel_for(0, slices, 1, [&](size_t first, size_t last)
+                {
+                    for (size_t slice = first; slice < last; slice++)
+                    {
+                        std::vector<std::pair<int, int>>& partial = partials[slice];
+                        partial.clear();
+                        for (size_t b = buckets * slice / slices; b < buckets * (slice + 1) / slices; b++)
+                        {
+                            for (auto it = cells.begin(b); it != cells.end(b); ++it)
+                                cell_pairs(it->second, partial);
+                        }
+                    }
+                });
+
+                for (const auto& partial : partials)
+                    out.insert(out.end(), partial.begin(), partial.end());
+            }
+
+            int collidelist(const Rect& rect) const
+            {
+                scratch.clear();
+                query(rect, scratch);
+                return scratch.empty() ? -1 : *std::min_element(scratch.begin(), scratch.end());
+            }
+
+            std::vector<int> collidelistall(const Rect& rect) const
+            {
+                std::vector<int> result;
+                query(rect, result);
+                std::sort(result.begin(), result.end());
+                return result;
+            }
+
+        private:
+            struct Item
+            {
+                Rect rect;
+                int x0 = 0, y0 = 0, x1 = -1, y1 = -1;
+                bool alive = false;
+            };
+
+            struct Cell
+            {
+                int cx, cy;
+                std::vector<int> ids;
+            };
+
+            static Sint64 key(int cx, int cy)
+            {
+                return static_cast<Sint64>((static_cast<Uint64>(static_cast<Uint32>(cx)) << 32) | static_cast<Uint32>(cy));
+            }
+
+            // Each pair is reported only by the first cell both rects share.
+            void cell_pairs(const Cell& cell, std::vector<std::pair<int, int>>& out) const
+            {
+                for (size_t i = 0; i < cell.ids.size(); i++)
+                {
+                    const Item& a = items[cell.ids[i]];
+                    for (size_t j = i + 1; j < cell.ids.size(); j++)
+                    {
+                        const Item& b = items[cell.ids[j]];
+                        if (std::max(a.x0, b.x0) != cell.cx || std::max(a.y0, b.y0) != cell.cy)
+                            continue;
+
+                        if (a.rect.colliderect(b.rect))
+                            out.push_back(std::minmax(cell.ids[i], cell.ids[j]));
+                    }
+                }
+            }
+
+            int cell_coord(float v) const
+            {
+                return static_cast<int>(std::floor(v * invCellSize));
+            }
+
+            void cell_range(const Rect& rect, int& x0, int& y0, int& x1, int& y1) const
+            {
+                x0 = cell_coord(rect.x);
+                y0 = cell_coord(rect.y);
+                x1 = cell_coord(rect.x + rect.w);
+                y1 = cell_coord(rect.y + rect.h);
+            }
+
+            void link(int id, int x0, int y0, int x1, int y1)
+            {
+                for (int cy = y0; cy <= y1; cy++)
+                {
+                    for (int cx = x0; cx <= x1; cx++)
+                    {
+                        Cell& cell = cells[key(cx, cy)];
+                        cell.cx = cx;
+                        cell.cy = cy;
+                        cell.ids.push_back(id);
+                    }
+                }
+            }
+
+            void unlink(int id, int x0, int y0, int x1, int y1)
+            {
+                for (int cy = y0; cy <= y1; cy++)
+                {
+                    for (int cx = x0; cx <= x1; cx++)
+                    {
+                        auto it = cells.find(key(cx, cy));
+                        if (it == cells.end())
+                            continue;
+
+                        std::vector<int>& ids = it->second.ids;
+                        auto pos = std::find(ids.begin(), ids.end(), id);
+                        if (pos != ids.end())
+                        {
+                            *pos = ids.back();
+                            ids.pop_back();
+                        }
+                        if (ids.empty())
+                            cells.erase(it);
+                    }
+                }
+            }
+
+            Uint32 next_stamp() const
+            {
+                if (++stamp == 0)
+                {
+                    std::fill(stamps.begin(), stamps.end(), 0);
+                    stamp = 1;
+                }
+                return stamp;
+            }
+
+            float cellSize, invCellSize;
+            std::unordered_map<Sint64, Cell> cells;
+            std::vector<Item> items;
+            std::vector<int> freeIds;
+            size_t count = 0;
+
+            mutable std::vector<Uint32> stamps;
+            mutable Uint32 stamp = 0;
+            mutable std::vector<int> scratch;
+            mutable std::vector<std::vector<std::pair<int, int>>> partials;
+        };
+    }
+
+    namespace simd
+    {
+        inline int lowest_bit(Uint32 mask)
+        {
+#if defined(_MSC_VER) && !defined(__clang__)
+            unsigned long index;
+            _BitScanForward(&index, mask);
+            return static_cast<int>(index);
+#else
+            return __builtin_ctz(mask);
+#endif
+        }
+
+        template <typename T>
+        class AlignedArray
+        {
+        public:
+            static constexpr size_t ALIGNMENT = 32;
+
+            AlignedArray() = default;
+            ~AlignedArray() { release(); }
+
+            AlignedArray(const AlignedArray&) = delete;
+            AlignedArray& operator=(const AlignedArray&) = delete;
+
+            void reserve(size_t newCapacity)
+            {
+                if (newCapacity <= capacity)
+                    return;
+
+                T* grown = static_cast<T*>(::operator new(newCapacity * sizeof(T), std::align_val_t(ALIGNMENT)));
+                if (data)
+                    std::memcpy(grown, data, count * sizeof(T));
+                release();
+                data = grown;
+                capacity = newCapacity;
+            }
+
+            void resize(size_t newCount)
+            {
+                if (newCount > capacity)
+                    reserve(std::max(newCount, capacity * 2));
+                count = newCount;
+            }
+
+            void clear() { count = 0; }
+            size_t size() const { return count; }
+            T* get() { return data; }
+            const T* get() const { return data; }
+            T& operator[](size_t i) { return data[i]; }
+            const T& operator[](size_t i) const { return data[i]; }
+
+        private:
+            void release()
+            {
+                if (data)
+                    ::operator delete(data, std::align_val_t(ALIGNMENT));
+                data = nullptr;
+            }
+
+            T* data = nullptr;
+            size_t count = 0;
+            size_t capacity = 0;
+        };
+    }
+
+    // Rects stored as separate x/y/w/h arrays so collision tests and bulk moves run 4 or 8 at a time.
+    class RectArray
+    {
+    public:
+        size_t size() const { return xs.size(); }
+        bool empty() const { return xs.size() == 0; }
+
+        void reserve(size_t capacity)
+        {
+            xs.reserve(capacity);
+            ys.reserve(capacity);
+            ws.reserve(capacity);
+            hs.reserve(capacity);
+        }
+
+        void clear()
+        {
+            xs.clear();
+            ys.clear();
+            ws.clear();
+            hs.clear();
+        }
+
+        size_t push_back(const Rect& rect)
+        {
+            size_t i = size();
+            xs.resize(i + 1);
+            ys.resize(i + 1);
+            ws.resize(i + 1);
+            hs.resize(i + 1);
+            set(i, rect);
+            return i;
+        }
+
+        // Swaps the last rect into i, so indices past i are stable but the last one moves.
+        void remove_swap(size_t i)
+        {
+            size_t last = size() - 1;
+            set(i, get(last));
+            xs.resize(last);
+            ys.resize(last);
+            ws.resize(last);
+            hs.resize(last);
+        }
+
+        void set(size_t i, const Rect& rect)
+        {
+            xs[i] = rect.x;
+            ys[i] = rect.y;
+            ws[i] = rect.w;
+            hs[i] = rect.h;
+        }
+
+        Rect get(size_t i) const { return { xs[i], ys[i], ws[i], hs[i] }; }
+
+        float* x() { return xs.get(); }
+        float* y() { return ys.get(); }
+        float* w() { return ws.get(); }
+        float* h() { return hs.get(); }
+
+        // One bit per rect, 32 rects per word.
+        void collide_rect(const Rect& r, std::vector<Uint32>& mask) const
+        {
+            mask.assign((size() + 31) / 32, 0);
+            size_t i = 0;
+#if defined(CGAME_AVX2)
+            const __m256 rx = _mm256_set1_ps(r.x), ry = _mm256_set1_ps(r.y);
+            const __m256 rr = _mm256_set1_ps(r.x + r.w), rb = _mm256_set1_ps(r.y + r.h);
+            for (; i + 8 <= size(); i += 8)
+            {
+                __m256 x = _mm256_load_ps(xs.get() + i), y = _mm256_load_ps(ys.get() + i);
+                __m256 hit = _mm256_and_ps(
+                    _mm256_and_ps(_mm256_cmp_ps(_mm256_add_ps(x, _mm256_load_ps(ws.get() + i)), rx, _CMP_GT_OQ), _mm256_cmp_ps(rr, x, _CMP_GT_OQ)),
+                    _mm256_and_ps(_mm256_cmp_ps(_mm256_add_ps(y, _mm256_load_ps(hs.get() + i)), ry, _CMP_GT_OQ), _mm256_cmp_ps(rb, y, _CMP_GT_OQ)));
+                mask[i / 32] |= static_cast<Uint32>(_mm256_movemask_ps(hit)) << (i % 32);
+            }
+#elif defined(CGAME_SSE2)
+            const __m128 rx = _mm_set1_ps(r.x), ry = _mm_set1_ps(r.y);
+            const __m128 rr = _mm_set1_ps(r.x + r.w), rb = _mm_set1_ps(r.y + r.h);
+            for (; i + 4 <= size(); i += 4)
+            {
+                __m128 x = _mm_load_ps(xs.get() + i), y = _mm_load_ps(ys.get() + i);
+                __m128 hit = _mm_and_ps(
+                    _mm_and_ps(_mm_cmpgt_ps(_mm_add_ps(x, _mm_load_ps(ws.get() + i)), rx), _mm_cmpgt_ps(rr, x)),
+                    _mm_and_ps(_mm_cmpgt_ps(_mm_add_ps(y, _mm_load_ps(hs.get() + i)), ry), _mm_cmpgt_ps(rb, y)));
+                mask[i / 32] |= static_cast<Uint32>(_mm_movemask_ps(hit)) << (i % 32);
+            }
+#endif
+            collide_rect_range(r, i, size(), mask);
+        }
+
+        void collide_rect(const Rect& r, std::vector<int>& indices) const
+        {
+            collide_rect(r, maskScratch);
+            mask_to_indices(maskScratch, indices);
+        }
+
+        void collide_point(float px, float py, std::vector<Uint32>& mask) const
+        {
+            mask.assign((size() + 31) / 32, 0);
+            size_t i = 0;
+#if defined(CGAME_AVX2)
+            const __m256 vx = _mm256_set1_ps(px), vy = _mm256_set1_ps(py);
+            for (; i + 8 <= size(); i += 8)
+            {
+                __m256 x = _mm256_load_ps(xs.get() + i), y = _mm256_load_ps(ys.get() + i);
+                __m256 hit = _mm256_and_ps(
+                    _mm256_and_ps(_mm256_cmp_ps(vx, x, _CMP_GE_OQ), _mm256_cmp_ps(vx, _mm256_add_ps(x, _mm256_load_ps(ws.get() + i)), _CMP_LE_OQ)),
+                    _mm256_and_ps(_mm256_cmp_ps(vy, y, _CMP_GE_OQ), _mm256_cmp_ps(vy, _mm256_add_ps(y, _mm256_load_ps(hs.get() + i)), _CMP_LE_OQ)));
+                mask[i / 32] |= static_cast<Uint32>(_mm256_movemask_ps(hit)) << (i % 32);
+            }
+#elif defined(CGAME_SSE2)
+            const __m128 vx = _mm_set1_ps(px), vy = _mm_set1_ps(py);
+            for (; i + 4 <= size(); i += 4)
+            {
+                __m128 x = _mm_load_ps(xs.get() + i), y = _mm_load_ps(ys.get() + i);
+                __m128 hit = _mm_and_ps(
+                    _mm_and_ps(_mm_cmpge_ps(vx, x), _mm_cmple_ps(vx, _mm_add_ps(x, _mm_load_ps(ws.get() + i)))),
+                    _mm_and_ps(_mm_cmpge_ps(vy, y), _mm_cmple_ps(vy, _mm_add_ps(y, _mm_load_ps(hs.get() + i)))));
+                mask[i / 32] |= static_cast<Uint32>(_mm_movemask_ps(hit)) << (i % 32);
+            }
+#endif
+            collide_point_range(px, py, i, size(), mask);
+        }
+
+        void collide_point(float px, float py, std::vector<int>& indices) const
+        {
+            collide_point(px, py, maskScratch);
+            mask_to_indices(maskScratch, indices);
+        }
+
+        void translate(float dx, float dy)
+        {
+            size_t i = 0;
+#if defined(CGAME_AVX2)
+            const __m256 vdx = _mm256_set1_ps(dx), vdy = _mm256_set1_ps(dy);
+            for (; i + 8 <= size(); i += 8)
+            {
+                _mm256_store_ps(xs.get() + i, _mm256_add_ps(_mm256_load_ps(xs.get() + i), vdx));
+                _mm256_store_ps(ys.get() + i, _mm256_add_ps(_mm256_load_ps(ys.get() + i), vdy));
+            }
+#elif defined(CGAME_SSE2)
+            const __m128 vdx = _mm_set1_ps(dx), vdy = _mm_set1_ps(dy);
+            for (; i + 4 <= size(); i += 4)
+            {
+                _mm_store_ps(xs.get() + i, _mm_add_ps(_mm_load_ps(xs.get() + i), vdx));
+                _mm_store_ps(ys.get() + i, _mm_add_ps(_mm_load_ps(ys.get() + i), vdy));
+            }
+#endif
+            for (; i < size(); i++)
+            {
+                xs[i] += dx;
+                ys[i] += dy;
+            }
+        }
+
+        // Per-rect offsets, e.g. velocity arrays already scaled by dt.
+        void translate(const float* dx, const float* dy)
+        {
+            size_t i = 0;
+#if defined(CGAME_AVX2)
+            for (; i + 8 <= size(); i += 8)
+            {
+                _mm256_store_ps(xs.get() + i, _mm256_add_ps(_mm256_load_ps(xs.get() + i), _mm256_loadu_ps(dx + i)));
+                _mm256_store_ps(ys.get() + i, _mm256_add_ps(_mm256_load_ps(ys.get() + i), _mm256_loadu_ps(dy + i)));
+            }
+#elif defined(CGAME_SSE2)
+            for (; i + 4 <= size(); i += 4)
+            {
+                _mm_store_ps(xs.get() + i, _mm_add_ps(_mm_load_ps(xs.get() + i), _mm_loadu_ps(dx + i)));
+                _mm_store_ps(ys.get() + i, _mm_add_ps(_mm_load_ps(ys.get() + i), _mm_loadu_ps(dy + i)));
+            }
+#endif
+            for (; i < size(); i++)
+            {
+                xs[i] += dx[i];
+                ys[i] += dy[i];
+            }
+        }
+
+        // pygame's Rect.clamp for every rect: moved inside bounds, or centered on an axis where it doesn't fit.
+        void clamp(const Rect& bounds)
+        {
+            size_t i = 0;
+#if defined(CGAME_AVX2)
+            const __m256 bx = _mm256_set1_ps(bounds.x), by = _mm256_set1_ps(bounds.y);
+            const __m256 bw = _mm256_set1_ps(bounds.w), bh = _mm256_set1_ps(bounds.h);
+            const __m256 half = _mm256_set1_ps(0.5f);
+            for (; i + 8 <= size(); i += 8)
+            {
+                __m256 w = _mm256_load_ps(ws.get() + i), h = _mm256_load_ps(hs.get() + i);
+                __m256 x = _mm256_min_ps(_mm256_max_ps(_mm256_load_ps(xs.get() + i), bx), _mm256_sub_ps(_mm256_add_ps(bx, bw), w));
+                __m256 y = _mm256_min_ps(_mm256_max_ps(_mm256_load_ps(ys.get() + i), by), _mm256_sub_ps(_mm256_add_ps(by, bh), h));
+                __m256 cx = _mm256_add_ps(bx, _mm256_mul_ps(_mm256_sub_ps(bw, w), half));
+                __m256 cy = _mm256_add_ps(by, _mm256_mul_ps(_mm256_sub_ps(bh, h), half));
+                _mm256_store_ps(xs.get() + i, _mm256_blendv_ps(x, cx, _mm256_cmp_ps(w, bw, _CMP_GE_OQ)));
+                _mm256_store_ps(ys.get() + i, _mm256_blendv_ps(y, cy, _mm256_cmp_ps(h, bh, _CMP_GE_OQ)));
+            }
+#elif defined(CGAME_SSE2)
+            const __m128 bx = _mm_set1_ps(bounds.x), by = _mm_set1_ps(bounds.y);
+            const __m128 bw = _mm_set1_ps(bounds.w), bh = _mm_set1_ps(bounds.h);
+            const __m128 half = _mm_set1_ps(0.5f);
+            for (; i + 4 <= size(); i += 4)
+            {
+                __m128 w = _mm_load_ps(ws.get() + i), h = _mm_load_ps(hs.get() + i);
+                __m128 x = _mm_min_ps(_mm_max_ps(_mm_load_ps(xs.get() + i), bx), _mm_sub_ps(_mm_add_ps(bx, bw), w));
+                __m128 y = _mm_min_ps(_mm_max_ps(_mm_load_ps(ys.get() + i), by), _mm_sub_ps(_mm_add_ps(by, bh), h));
+                __m128 cx = _mm_add_ps(bx, _mm_mul_ps(_mm_sub_ps(bw, w), half));
+                __m128 cy = _mm_add_ps(by, _mm_mul_ps(_mm_sub_ps(bh, h), half));
+                __m128 fitX = _mm_cmpge_ps(w, bw), fitY = _mm_cmpge_ps(h, bh);
+                _mm_store_ps(xs.get() + i, _mm_or_ps(_mm_and_ps(fitX, cx), _mm_andnot_ps(fitX, x)));
+                _mm_store_ps(ys.get() + i, _mm_or_ps(_mm_and_ps(fitY, cy), _mm_andnot_ps(fitY, y)));
+            }
+#endif
+            clamp_range(bounds, i, size());
+        }
+
+        // Reference implementations, used for the tail of every kernel and for checking the SIMD paths.
+        void collide_rect_scalar(const Rect& r, std::vector<Uint32>& mask) const
+        {
+            mask.assign((size() + 31) / 32, 0);
+            collide_rect_range(r, 0, size(), mask);
+        }
+
+        void collide_point_scalar(float px, float py, std::vector<Uint32>& mask) const
+        {
+            mask.assign((size() + 31) / 32, 0);
+            collide_point_range(px, py, 0, size(), mask);
+        }
+
+        void clamp_scalar(const Rect& bounds)
+        {
+            clamp_range(bounds, 0, size());
+        }
+
+        static void mask_to_indices(const std::vector<Uint32>& mask, std::vector<int>& indices)
+        {
+            indices.clear();
+            for (size_t word = 0; word < mask.size(); word++)
+            {
+                Uint32 bits = mask[word];
+                while (bits)
+                {
+                    indices.push_back(static_cast<int>(word * 32) + simd::lowest_bit(bits));
+                    bits &= bits - 1;
+                }
+            }
+        }
+
+    private:
+        void collide_rect_range(const Rect& r, size_t begin, size_t end, std::vector<Uint32>& mask) const
+        {
+            for (size_t i = begin; i < end; i++)
+            {
+                if (xs[i] + ws[i] > r.x && r.x + r.w > xs[i] && ys[i] + hs[i] > r.y && r.y + r.h > ys[i])
+                    mask[i / 32] |= 1u << (i % 32);
+            }
+        }
+
+        void collide_point_range(float px, float py, size_t begin, size_t end, std::vector<Uint32>& mask) const
+        {
+            for (size_t i = begin; i < end; i++)
+            {
+                if (px >= xs[i] && px <= xs[i] + ws[i] && py >= ys[i] && py <= ys[i] + hs[i])
+                    mask[i / 32] |= 1u << (i % 32);
+            }
+        }
+
+        void clamp_range(const Rect& bounds, size_t begin, size_t end)
+        {
+            for (size_t i = begin; i < end; i++)
+            {
+                if (ws[i] >= bounds.w)
+                    xs[i] = bounds.x + (bounds.w - ws[i]) * 0.5f;
+                else
+                    xs[i] = std::min(std::max(xs[i], bounds.x), bounds.x + bounds.w - ws[i]);
+
+                if (hs[i] >= bounds.h)
+                    ys[i] = bounds.y + (bounds.h - hs[i]) * 0.5f;
+                else
+                    ys[i] = std::min(std::max(ys[i], bounds.y), bounds.y + bounds.h - hs[i]);
+            }
+        }
+
+        simd::AlignedArray<float> xs, ys, ws, hs;
+        mutable std::vector<Uint32> maskScratch;
+    };
+
+    namespace ecs
+    {
+        static constexpr int MAX_COMPONENTS = 64;
+        static constexpr size_t CHUNK_BYTES = 16 * 1024;
+        static constexpr size_t CHUNK_ALIGN = 64;
+
+        using ComponentId = Uint32;
+        using Mask = Uint64;
+
+        struct Entity
+        {
+            Uint32 index = 0;
+            Uint32 generation = 0;   // 0 never names a live entity
+
+            bool is_null() const { return generation == 0; }
+            bool operator==(const Entity& o) const { return index == o.index && generation == o.generation; }
+            bool operator!=(const Entity& o) const { return !(*this == o); }
+        };
+
+        // Type-erased operations for a component type. relocate move-constructs dst from src and
+        // destroys src.
+        struct ComponentInfo
+        {
+            size_t size = 0;
+            size_t align = 0;
+            void (*relocate)(void* dst, void* src) = NULL;
+            void (*destroy)(void* p) = NULL;
+        };
+
+        // inline rather than static: component ids are shared by every translation unit.
+        inline ComponentInfo componentInfos[MAX_COMPONENTS];
+
+        inline ComponentId next_component_id()
+        {
+            static std::atomic<ComponentId> next{ 0 };
+            ComponentId id = next++;
+            if (id >= MAX_COMPONENTS)
+            {
+                std::cerr << "Too many ECS component types (max " << MAX_COMPONENTS << ")" << std::endl;
+                std::abort();
+            }
+            return id;
+        }
+
+        // Ids are handed out on first use, so they differ between runs; don't persist them.
+        template<typename T>
+        ComponentId component_id()
+        {
+            using C = std::remove_cv_t<T>;
+            if constexpr (!std::is_same_v<T, C>)
+            {
+                return component_id<C>();
+            }
+            else
+            {
+                static_assert(alignof(C) <= CHUNK_ALIGN, "component alignment exceeds chunk alignment");
+                static const ComponentId id = []
+                {
+                    ComponentId newId = next_component_id();
+                    ComponentInfo& info = componentInfos[newId];
+                    info.size = sizeof(C);
+                    info.align = alignof(C);
+                    info.relocate = [](void* dst, void* src)
+                    {
+                        new (dst) C(std::move(*static_cast<C*>(src)));
+                        static_cast<C*>(src)->~C();
+                    };
+                    info.destroy = [](void* p) { static_cast<C*>(p)->~C(); };
+                    return newId;
+                }();
+                return id;
+            }
+        }
+
+        template<typename... Ts>
+        Mask mask_of()
+        {
+            return (Mask(0) | ... | (Mask(1) << component_id<Ts>()));
+        }
+
+        // Surfaces own their texture and can't be copied, so entities refer to them instead.
+        using SurfaceRef = std::reference_wrapper<Surface>;
+
+        // Entities with the same component set, stored in fixed-size chunks. Each chunk holds the
+        // entity ids followed by one packed array per component.
+        class Archetype
+        {
+        public:
+            struct Chunk
+            {
+                unsigned char* data = NULL;
+                Uint32 count = 0;
+            };
+
+            Archetype(Mask _mask) : mask(_mask)
+            {
+                std::fill(std::begin(columnOf), std::end(columnOf), -1);
+
+                size_t rowBytes = sizeof(Entity);
+                for (int id = 0; id < MAX_COMPONENTS; id++)
+                {
+                    if (mask & (Mask(1) << id))
+                    {
+                        columnOf[id] = static_cast<int>(ids.size());
+                        ids.push_back(static_cast<ComponentId>(id));
+                        rowBytes += componentInfos[id].size;
+                    }
+                }
+
+                // Alignment padding between arrays can push the estimate over; back off until it fits.
+                capacity = static_cast<Uint32>(std::max<size_t>(CHUNK_BYTES / rowBytes, 1));
+                while (layout(capacity) > CHUNK_BYTES && capacity > 1)
+                    capacity--;
+                chunkBytes = std::max(layout(capacity), CHUNK_BYTES);
+            }
+
+            ~Archetype()
+            {
+                for (size_t c = 0; c < chunks.size(); c++)
+                {
+                    for (Uint32 row = 0; row < chunks[c].count; row++)
+                    {
+                        for (size_t col = 0; col < ids.size(); col++)
+                            componentInfos[ids[col]].destroy(column(c, col, row));
+                    }
+                    ::operator delete(chunks[c].data, std::align_val_t(CHUNK_ALIGN));
+                }
+            }
+
+            Archetype(const Archetype&) = delete;
+            Archetype& operator=(const Archetype&) = delete;
+
+            Mask get_mask() const { return mask; }
+            Uint32 get_capacity() const { return capacity; }
+            size_t get_chunk_count() const { return activeChunks; }
+            const Chunk& get_chunk(size_t c) const { return chunks[c]; }
+            int get_column(ComponentId id) const { return columnOf[id]; }
+            const std::vector<ComponentId>& get_ids() const { return ids; }
+
+            size_t size() const
+            {
+                return activeChunks == 0 ? 0 : (activeChunks - 1) * static_cast<size_t>(capacity) + chunks[activeChunks - 1].count;
+            }
+
+            Entity* entities(size_t c) const { return reinterpret_cast<Entity*>(chunks[c].data); }
+
+            void* column(size_t c, size_t col, Uint32 row) const
+            {
+                return chunks[c].data + offsets[col] + row * componentInfos[ids[col]].size;
+            }
+
+            template<typename T>
+            T* array(size_t c, int col) const
+            {
+                return reinterpret_cast<T*>(chunks[c].data + offsets[col]);
+            }
+
+            // Appends a row for e; its components are left unconstructed for the caller.
+            std::pair<Uint32, Uint32> push(Entity e)
+            {
+                if (activeChunks == 0 || chunks[activeChunks - 1].count == capacity)
+                {
+                    if (activeChunks == chunks.size())
+                        chunks.push_back({ static_cast<unsigned char*>(::operator new(chunkBytes, std::align_val_t(CHUNK_ALIGN))), 0 });
+                    activeChunks++;
+                }
+
+                Uint32 c = static_cast<Uint32>(activeChunks - 1);
+                Uint32 row = chunks[c].count++;
+                entities(c)[row] = e;
+                return { c, row };
+            }
+
+            // Fills the hole at (c, row) with the last row so chunks stay dense, and returns the
+            // entity that moved into it (or a null entity). Components at the hole must already be
+            // destroyed or moved out.
+            Entity erase(Uint32 c, Uint32 row)
+            {
+                Uint32 lastChunk = static_cast<Uint32>(activeChunks - 1);
+                Uint32 lastRow = chunks[lastChunk].count - 1;
+                Entity moved;
+
+                if (c != lastChunk || row != lastRow)
+                {
+                    for (size_t col = 0; col < ids.size(); col++)
+                        componentInfos[ids[col]].relocate(column(c, col, row), column(lastChunk, col, lastRow));
+                    moved = entities(lastChunk)[lastRow];
+                    entities(c)[row] = moved;
+                }
+
+                chunks[lastChunk].count--;
+                if (chunks[lastChunk].count == 0)
+                    activeChunks--;   // memory is kept for reuse
+                return moved;
+            }
+
+            std::unordered_map<ComponentId, Archetype*> addEdges, removeEdges;
+
+        private:
+            size_t layout(Uint32 rows)
+            {
+                offsets.clear();
+                size_t offset = rows * sizeof(Entity);
+                for (ComponentId id : ids)
+                {
+                    size_t align = componentInfos[id].align;
+                    offset = (offset + align - 1) / align * align;
+                    offsets.push_back(offset);
+                    offset += rows * componentInfos[id].size;
+                }
+                return offset;
+            }
+
+            Mask mask;
+            std::vector<ComponentId> ids;
+            std::vector<size_t> offsets;
+            int columnOf[MAX_COMPONENTS];
+            Uint32 capacity = 1;
+            size_t chunkBytes = CHUNK_BYTES;
+            std::vector<Chunk> chunks;
+            size_t activeChunks = 0;
+        };
+
+        // Entities are ids with a generation; destroying one bumps the generation so stale ids stop
+        // resolving. Adding or removing components moves the entity to another archetype, which
+        // invalidates component references -- don't change structure inside each().
+        class World
+        {
+        public:
+            World()
             {
-                if (!sound)
+                root = get_archetype(0);
+            }
+
+            World(const World&) = delete;
+            World& operator=(const World&) = delete;
+
+            Entity create()
+            {
+                Entity e;
+                if (!freeIndices.empty())
+                {
+                    e.index = freeIndices.back();
+                    freeIndices.pop_back();
+                }
+                else
+                {
+                    e.index = static_cast<Uint32>(records.size());
+                    records.push_back({});
+                }
+
+                Record& record = records[e.index];
+                e.generation = record.generation;
+                std::pair<Uint32, Uint32> slot = root->push(e);
+                record.archetype = root;
+                record.chunk = slot.first;
+                record.row = slot.second;
+                alive++;
+                return e;
+            }
+
+            template<typename... Ts>
+            Entity create(Ts&&... components)
+            {
+                Entity e = create();
+                (add(e, std::forward<Ts>(components)), ...);
+                return e;
+            }
+
+            void destroy(Entity e)
+            {
+                if (!is_alive(e))
                     return;
 
-                if (volume < 0.0f) volume = 0.0f;
-                if (volume > 1.0f) volume = 1.0f;
+                Record& record = records[e.index];
+                Archetype* archetype = record.archetype;
+                for (size_t col = 0; col < archetype->get_ids().size(); col++)
+                    componentInfos[archetype->get_ids()[col]].destroy(archetype->column(record.chunk, col, record.row));
+                fix_moved(archetype->erase(record.chunk, record.row), record.chunk, record.row);
 
-                int vol = static_cast<int>(volume * static_cast<float>(MIX_MAX_VOLUME) + 0.5f);
-                Mix_VolumeChunk(sound, vol);
+                record.archetype = NULL;
+                record.generation = record.generation == 0xFFFFFFFFu ? 1 : record.generation + 1;
+                freeIndices.push_back(e.index);
+                alive--;
+            }
+
+            bool is_alive(Entity e) const
+            {
+                return e.index < records.size() && records[e.index].generation == e.generation && records[e.index].archetype != NULL;
+            }
+
+            // Adds or replaces a component. Returns NULL for dead entities.
+            template<typename T>
+            std::decay_t<T>* add(Entity e, T&& value)
+            {
+                using C = std::decay_t<T>;
+                ComponentId id = component_id<C>();
+                if (!is_alive(e))
+                {
+                    std::cerr << "ecs::World::add on a destroyed entity" << std::endl;
+                    return NULL;
+                }
+                if (C* existing = get<C>(e))
+                {
+                    *existing = std::forward<T>(value);
+                    return existing;
+                }
+
+                Record& record = records[e.index];
+                Archetype* target = edge(record.archetype, id, true);
+                move_entity(e, target, id);
+                C* slot = static_cast<C*>(target->column(record.chunk, target->get_column(id), record.row));
+                new (slot) C(std::forward<T>(value));
+                return slot;
+            }
+
+            template<typename T>
+            void remove(Entity e)
+            {
+                ComponentId id = component_id<T>();
+                if (!has<T>(e))
+                    return;
+
+                Record& record = records[e.index];
+                componentInfos[id].destroy(record.archetype->column(record.chunk, record.archetype->get_column(id), record.row));
+                move_entity(e, edge(record.archetype, id, false), id);
+            }
+
+            template<typename T>
+            bool has(Entity e) const
+            {
+                return is_alive(e) && (records[e.index].archetype->get_mask() & (Mask(1) << component_id<T>())) != 0;
+            }
+
+            template<typename T>
+            T* get(Entity e)
+            {
+                if (!has<T>(e))
+                    return NULL;
+
+                const Record& record = records[e.index];
+                return static_cast<T*>(record.archetype->column(record.chunk, record.archetype->get_column(component_id<T>()), record.row));
+            }
+
+            // Calls fn(Ts&...) or fn(Entity, Ts&...) for every entity that has all of Ts.
+            template<typename... Ts, typename Fn>
+            void each(Fn&& fn)
+            {
+                each_chunk<Ts...>([&](size_t count, const Entity* entities, Ts*... arrays)
+                {
+                    for (size_t i = 0; i < count; i++)
+                    {
+                        if constexpr (std::is_invocable_v<Fn&, Entity, Ts&...>)
+                            fn(entities[i], arrays[i]...);
+                        else
+                            fn(arrays[i]...);
+                    }
+                });
+            }
+
+            // Calls fn(count, entities, Ts*...) once per chunk with the packed component arrays,
+            // for loops that want to vectorize.
+            template<typename... Ts, typename Fn>
+            void each_chunk(Fn&& fn)
+            {
+                Mask mask = mask_of<Ts...>();
+                for (const auto& archetype : archetypeList)
+                {
+                    if ((archetype->get_mask() & mask) != mask)
+                        continue;
+
+                    for (size_t c = 0; c < archetype->get_chunk_count(); c++)
+                    {
+                        fn(static_cast<size_t>(archetype->get_chunk(c).count), archetype->entities(c),
+                           archetype->template array<std::remove_cv_t<Ts>>(c, archetype->get_column(component_id<Ts>()))...);
+                    }
+                }
+            }
+
+            template<typename... Ts>
+            size_t count()
+            {
+                Mask mask = mask_of<Ts...>();
+                size_t total = 0;
+                for (const auto& archetype : archetypeList)
+                {
+                    if ((archetype->get_mask() & mask) == mask)
+                        total += archetype->size();
+                }
+                return total;
+            }
+
+            size_t size() const { return alive; }
+            size_t get_archetype_count() const { return archetypeList.size(); }
+
+        private:
+            struct Record
+            {
+                Uint32 generation = 1;
+                Archetype* archetype = NULL;
+                Uint32 chunk = 0;
+                Uint32 row = 0;
+            };
+
+            Archetype* get_archetype(Mask mask)
+            {
+                auto it = archetypes.find(mask);
+                if (it != archetypes.end())
+                    return it->second;
+
+                archetypeList.push_back(std::make_unique<Archetype>(mask));
+                archetypes[mask] = archetypeList.back().get();
+                return archetypeList.back().get();
+            }
+
+            Archetype* edge(Archetype* from, ComponentId id, bool adding)
+            {
+                auto& edges = adding ? from->addEdges : from->removeEdges;
+                auto it = edges.find(id);
+                if (it != edges.end())
+                    return it->second;
+
+                Mask bit = Mask(1) << id;
+                Archetype* to = get_archetype(adding ? (from->get_mask() | bit) : (from->get_mask() & ~bit));
+                edges[id] = to;
+                return to;
+            }
+
+            // Moves e's row into target, carrying over shared components. The component that
+            // differs has already been destroyed (remove) or is constructed by the caller (add).
+            void move_entity(Entity e, Archetype* target, ComponentId changed)
+            {
+                Record& record = records[e.index];
+                Archetype* source = record.archetype;
+                Uint32 oldChunk = record.chunk, oldRow = record.row;
+
+                std::pair<Uint32, Uint32> slot = target->push(e);
+                for (size_t col = 0; col < source->get_ids().size(); col++)
+                {
+                    ComponentId id = source->get_ids()[col];
+                    if (id == changed)
+                        continue;
+                    componentInfos[id].relocate(target->column(slot.first, target->get_column(id), slot.second),
+                                                source->column(oldChunk, col, oldRow));
+                }
+
+                fix_moved(source->erase(oldChunk, oldRow), oldChunk, oldRow);
+                record.archetype = target;
+                record.chunk = slot.first;
+                record.row = slot.second;
+            }
+
+            void fix_moved(Entity moved, Uint32 chunk, Uint32 row)
+            {
+                if (moved.is_null())
+                    return;
+                records[moved.index].chunk = chunk;
+                records[moved.index].row = row;
+            }
+
+            std::vector<Record> records;
+            std::vector<Uint32> freeIndices;
+            std::unordered_map<Mask, Archetype*> archetypes;
+            std::vector<std::unique_ptr<Archetype>> archetypeList;
+            Archetype* root = NULL;
+            size_t alive = 0;
+        };
+
+        // The components a system reads and writes. Structural systems (create, destroy, add,
+        // remove) must say so and then run alone.
+        struct Access
+        {
+            Mask reads = 0;
+            Mask writes = 0;
+            bool structural = false;
+
+            template<typename... Ts>
+            Access& read()
+            {
+                reads |= mask_of<Ts...>();
+                return *this;
+            }
+
+            template<typename... Ts>
+            Access& write()
+            {
+                writes |= mask_of<Ts...>();
+                return *this;
+            }
+
+            Access& structure()
+            {
+                structural = true;
+                return *this;
+            }
+
+            bool conflicts(const Access& o) const
+            {
+                return structural || o.structural || (writes & (o.reads | o.writes)) != 0 || (o.writes & reads) != 0;
+            }
+        };
+
+        // Runs systems in stages: a system goes into the first stage after every earlier system it
+        // conflicts with, so registration order is kept wherever it matters. Systems in a stage run
+        // in parallel on the job system.
+        class Scheduler
+        {
+        public:
+            using SystemFn = std::function<void(World&, float)>;
+
+            void add(const std::string& name, const Access& access, SystemFn fn)
+            {
+                int stage = 0;
+                for (const System& other : systems)
+                {
+                    if (access.conflicts(other.access))
+                        stage = std::max(stage, other.stage + 1);
+                }
+                systems.push_back({ name, access, std::move(fn), stage });
+                stageCount = std::max(stageCount, stage + 1);
+            }
+
+            void run(World& world, float dt)
+            {
+                CGAME_PROFILE_ZONE("ecs::Scheduler::run");
+                for (int stage = 0; stage < stageCount; stage++)
+                {
+                    stageSystems.clear();
+                    for (System& system : systems)
+                    {
+                        if (system.stage == stage)
+                            stageSystems.push_back(&system);
+                    }
+
+                    jobs::Counter counter;
+                    for (size_t i = 1; i < stageSystems.size(); i++)
+                    {
+                        System* system = stageSystems[i];
+                        jobs::run([system, &world, dt] { system->fn(world, dt); }, &counter);
+                    }
+                    if (!stageSystems.empty())
+                        stageSystems[0]->fn(world, dt);
+                    jobs::wait(counter);
+                }
+            }
+
+            int get_stage_count() const { return stageCount; }
+
+            int get_stage(const std::string& name) const
+            {
+                for (const System& system : systems)
+                {
+                    if (system.name == name)
+                        return system.stage;
+                }
+                return -1;
+            }
+
+        private:
+            struct System
+            {
+                std::string name;
+                Access access;
+                SystemFn fn;
+                int stage;
+            };
+
+            std::vector<System> systems;
+            std::vector<System*> stageSystems;
+            int stageCount = 0;
+        };
+    }
+
+    namespace time
+    {
+        inline Uint64 now()
+        {
+            return SDL_GetPerformanceCounter();
+        }
+
+        inline double to_seconds(Uint64 ticks)
+        {
+            return static_cast<double>(ticks) / static_cast<double>(SDL_GetPerformanceFrequency());
+        }
+
+        inline Uint64 from_seconds(double seconds)
+        {
+            return static_cast<Uint64>(seconds * static_cast<double>(SDL_GetPerformanceFrequency()));
+        }
+
+        inline void cpu_relax()
+        {
+#if defined(CGAME_AVX2) || defined(CGAME_SSE2)
+            _mm_pause();
+#endif
+        }
+
+        // SDL_Delay can overshoot by a millisecond or more, so sleep until spinMargin before the
+        // deadline and busy-wait the rest. The margin grows if a sleep is seen overshooting it.
+        static double spinMargin = 0.002;
+
+        inline void wait_until(Uint64 deadline)
+        {
+            while (true)
+            {
+                Uint64 current = now();
+                if (current >= deadline)
+                    return;
+
+                double remaining = to_seconds(deadline - current);
+                if (remaining <= spinMargin)
+                    break;
+
+                Uint32 sleepMs = static_cast<Uint32>((remaining - spinMargin) * 1000.0);
+                if (sleepMs == 0)
+                    break;
+
+                Uint64 before = now();
+                SDL_Delay(sleepMs);
+                double overshoot = to_seconds(now() - before) - sleepMs / 1000.0;
+                if (overshoot > spinMargin)
+                    spinMargin = std::min(overshoot * 1.25, 0.016);
+            }
+
+            while (now() < deadline)
+                cpu_relax();
+        }
+
+        inline void wait(double seconds)
+        {
+            wait_until(now() + from_seconds(seconds));
+        }
+    }
+
+    class Clock {
+    public:
+        Clock() {
+            lastTick = time::now();
+        }
+
+        float tick(int fps = 0) {
+            if (fps > 0)
+                time::wait_until(lastTick + SDL_GetPerformanceFrequency() / fps);
+
+            Uint64 now = time::now();
+            float delta = static_cast<float>(time::to_seconds(now - lastTick));
+
+            lastTick = now;
+            currentFPS = (delta > 0) ? (1.0f / delta) : 0.0f;
+            return delta;
+        }
+
+        float get_fps() const { return currentFPS; }
+
+    private:
+        Uint64 lastTick;
+        float currentFPS = 0.0f;
+    };
+
+    struct FrameStats
+    {
+        float mean = 0.0f;
+        float p50 = 0.0f;
+        float p99 = 0.0f;
+        float min = 0.0f;
+        float max = 0.0f;
+        float fps = 0.0f;
+        int frames = 0;
+    };
+
+    // Fixed-timestep loop driver:
+    //
+    //     scheduler.begin_frame();
+    //     while (scheduler.step()) update(scheduler.get_step());
+    //     render(scheduler.get_alpha());
+    //     scheduler.end_frame();
+    class FrameScheduler
+    {
+    public:
+        static constexpr size_t HISTORY = 240;
+
+        FrameScheduler(int _targetFps = 60, int updateRate = 60, int _maxSteps = 5)
+        {
+            set_target_fps(_targetFps);
+            set_update_rate(updateRate);
+            set_max_steps(_maxSteps);
+            lastBegin = time::now();
+            deadline = lastBegin;
+        }
+
+        void set_target_fps(int fps)
+        {
+            period = fps > 0 ? SDL_GetPerformanceFrequency() / fps : 0;
+        }
+
+        void set_update_rate(int rate)
+        {
+            stepSeconds = 1.0 / std::max(rate, 1);
+        }
+
+        void set_max_steps(int steps) { maxSteps = std::max(steps, 1); }
+
+        float begin_frame()
+        {
+            return advance(measure());
+        }
+
+        // For replays: frame stats still measure wall time, but the simulation advances by the
+        // recorded delta so it takes exactly the steps the original run took.
+        float begin_frame(float simulatedDelta)
+        {
+            measure();
+            return advance(simulatedDelta);
+        }
+
+        bool step()
+        {
+            if (accumulator < stepSeconds)
+                return false;
+
+            if (stepsThisFrame >= maxSteps)
+            {
+                accumulator = std::fmod(accumulator, stepSeconds);
+                return false;
             }
 
-        private:
-            Mix_Chunk* sound = NULL;
-        };
+            accumulator -= stepSeconds;
+            stepsThisFrame++;
+            totalSteps++;
+            return true;
+        }
+
+        void end_frame()
+        {
+            if (period == 0)
+                return;
+
+            deadline += period;
+            Uint64 current = time::now();
+            if (current > deadline + period)
+                deadline = current;
+
+            time::wait_until(deadline);
+        }
+
+        float get_step() const { return static_cast<float>(stepSeconds); }
+        float get_alpha() const { return static_cast<float>(accumulator / stepSeconds); }
+        float get_delta() const { return frameDelta; }
+        int get_steps_this_frame() const { return stepsThisFrame; }
+        Uint64 get_total_steps() const { return totalSteps; }
+
+        // Frame times in milliseconds over the last HISTORY frames.
+        FrameStats get_stats() const
+        {
+            FrameStats stats;
+            if (historyCount == 0)
+                return stats;
+
+            std::vector<float> sorted(history, history + historyCount);
+            std::sort(sorted.begin(), sorted.end());
+
+            double sum = 0.0;
+            for (float ms : sorted)
+                sum += ms;
+
+            stats.frames = static_cast<int>(historyCount);
+            stats.mean = static_cast<float>(sum / historyCount);
+            stats.min = sorted.front();
+            stats.max = sorted.back();
+            stats.p50 = sorted[(historyCount - 1) / 2];
+            stats.p99 = sorted[std::min(historyCount - 1, static_cast<size_t>(std::ceil(historyCount * 0.99)) - 1)];
+            stats.fps = stats.mean > 0.0f ? 1000.0f / stats.mean : 0.0f;
+            return stats;
+        }
+
+        void reset_stats()
+        {
+            historyCount = 0;
+            historyNext = 0;
+        }
+
+    private:
+        float measure()
+        {
+            Uint64 current = time::now();
+            double delta = time::to_seconds(current - lastBegin);
+            lastBegin = current;
+
+            if (started)
+                record(static_cast<float>(delta * 1000.0));
+            started = true;
+            return static_cast<float>(delta);
+        }
+
+        float advance(float delta)
+        {
+            // A frame longer than maxSteps updates only advances the simulation by that much;
+            // the rest of the stall is dropped instead of snowballing into more catch-up work.
+            accumulator += std::min(static_cast<double>(delta), stepSeconds * maxSteps);
+            stepsThisFrame = 0;
+            frameDelta = delta;
+            return frameDelta;
+        }
+
+        void record(float ms)
+        {
+            history[historyNext] = ms;
+            historyNext = (historyNext + 1) % HISTORY;
+            historyCount = std::min(historyCount + 1, HISTORY);
+        }
+
+        Uint64 period = 0;
+        Uint64 lastBegin = 0;
+        Uint64 deadline = 0;
+        bool started = false;
+
+        double stepSeconds = 1.0 / 60.0;
+        double accumulator = 0.0;
+        int maxSteps;
+        int stepsThisFrame = 0;
+        Uint64 totalSteps = 0;
+        float frameDelta = 0.0f;
+
+        float history[HISTORY] = {};
+        size_t historyCount = 0;
+        size_t historyNext = 0;
+    };
+
+    enum EventType
+    {
+        QUIT,
+        KEYDOWN,
+        KEYUP,
+        MOUSEDOWN,
+        MOUSEUP,
+        MOUSEMOTION,
+        MOUSEWHEEL,
+        TEXTINPUT
+    };
+
+    struct Event
+    {
+        EventType type;
+        SDL_Keycode key;
+        int mouseX, mouseY;
+        Uint8 mouseButton;
+        SDL_Scancode scancode;
+        bool repeat;
+        int relX, relY;
+        float wheelX, wheelY;
+        char text[SDL_TEXTINPUTEVENT_TEXT_SIZE];
+    };
+
+    namespace input
+    {
+        static constexpr int MOUSE_BUTTONS = 5;
 
-        class Music
+        // Drains SDL's queue once per update() into a reusable buffer and keeps keyboard and mouse
+        // snapshots for this frame and the last. Just-pressed/released also come from the drained
+        // events, so a tap shorter than a frame is still seen.
+        class InputState
         {
         public:
-            Music(const std::string& filename)
-            {
-                music = Mix_LoadMUS(filename.c_str());
-                if (!music)
-                {
-                    std::cerr << "Failed to load music: " << filename << " Error: " << Mix_GetError() << std::endl;
-                }
-            }
+            static constexpr int EVENT_CHUNK = 256;
 
-            ~Music()
+            InputState()
             {
-                if (music)
-                    Mix_FreeMusic(music);
+                events.reserve(EVENT_CHUNK);
+                std::fill(std::begin(current), std::end(current), 0);
+                std::fill(std::begin(previous), std::end(previous), 0);
+                std::fill(std::begin(downFrame), std::end(downFrame), 0);
+                std::fill(std::begin(upFrame), std::end(upFrame), 0);
+                std::fill(std::begin(buttonDownFrame), std::end(buttonDownFrame), 0);
+                std::fill(std::begin(buttonUpFrame), std::end(buttonUpFrame), 0);
             }
 
-            void play(LoopMode loop = LOOP_NONE)
+            void update()
             {
-                if (music)
+                buffering = true;
+                frame++;
+                cursor = 0;
+                text.clear();
+                mouseDelta = { 0, 0 };
+                wheel = { 0, 0 };
+                quitRequested = false;
+
+                SDL_PumpEvents();
+                events.clear();
+                while (true)
                 {
-                    if (Mix_PlayMusic(music, static_cast<int>(loop)) == -1)
-                    {
-                        std::cerr << "Failed to play music: " << Mix_GetError() << std::endl;
-                    }
+                    size_t offset = events.size();
+                    events.resize(offset + EVENT_CHUNK);
+                    int count = SDL_PeepEvents(events.data() + offset, EVENT_CHUNK, SDL_GETEVENT, SDL_FIRSTEVENT, SDL_LASTEVENT);
+                    events.resize(offset + std::max(count, 0));
+                    if (count < EVENT_CHUNK)
+                        break;
                 }
-            }
 
-            void pause()
-            {
-                Mix_PauseMusic();
+                std::copy(std::begin(current), std::end(current), std::begin(previous));
+                previousButtons = buttons;
+
+                for (const SDL_Event& e : events)
+                    apply(e);
+
+                if (synthetic)
+                    return;
+
+                int keyCount = 0;
+                const Uint8* keys = SDL_GetKeyboardState(&keyCount);
+                std::copy(keys, keys + std::min(keyCount, static_cast<int>(SDL_NUM_SCANCODES)), std::begin(current));
+
+                int mx = 0, my = 0;
+                buttons = SDL_GetMouseState(&mx, &my);
+                mousePos = { static_cast<float>(mx), static_cast<float>(my) };
             }
 
-            void resume()
+            // Events pushed with SDL_PushEvent never reach SDL's keyboard and mouse state, so a
+            // replay rebuilds both from the drained events instead of reading SDL's snapshots.
+            void set_synthetic(bool enabled, Vec2 startMouse = {}, const std::vector<SDL_Scancode>& held = {})
             {
-                Mix_ResumeMusic();
+                synthetic = enabled;
+                std::fill(std::begin(current), std::end(current), 0);
+                for (SDL_Scancode sc : held)
+                {
+                    if (valid(sc))
+                        current[sc] = 1;
+                }
+                buttons = 0;
+                mousePos = startMouse;
             }
 
-            void stop()
+            bool is_synthetic() const { return synthetic; }
+
+            bool next_event(SDL_Event& out)
             {
-                Mix_HaltMusic();
+                if (cursor >= events.size())
+                    return false;
+                out = events[cursor++];
+                return true;
             }
 
-            void set_volume(float volume)
-            {
-                if (volume < 0.0f) volume = 0.0f;
-                if (volume > 1.0f) volume = 1.0f;
+            bool is_buffering() const { return buffering; }
+            const std::vector<SDL_Event>& get_events() const { return events; }
 
-                int vol = static_cast<int>(volume * static_cast<float>(MIX_MAX_VOLUME) + 0.5f);
-                Mix_VolumeMusic(vol);
-            }
+            bool is_pressed(SDL_Scancode sc) const { return valid(sc) && current[sc]; }
+            bool is_just_pressed(SDL_Scancode sc) const { return valid(sc) && (downFrame[sc] == frame || (current[sc] && !previous[sc])); }
+            bool is_just_released(SDL_Scancode sc) const { return valid(sc) && (upFrame[sc] == frame || (!current[sc] && previous[sc])); }
 
-            float get_volume() const
+            bool is_pressed(SDL_Keycode key) const { return is_pressed(to_scancode(key)); }
+            bool is_just_pressed(SDL_Keycode key) const { return is_just_pressed(to_scancode(key)); }
+            bool is_just_released(SDL_Keycode key) const { return is_just_released(to_scancode(key)); }
+
+            bool is_mouse_pressed(int button) const { return valid_button(button) && (buttons & SDL_BUTTON(button)) != 0; }
+            bool is_mouse_just_pressed(int button) const
             {
-                int vol = Mix_VolumeMusic(-1);
-                return static_cast<float>(vol) / static_cast<float>(MIX_MAX_VOLUME);
+                return valid_button(button) && (buttonDownFrame[button - 1] == frame || ((buttons & ~previousButtons) & SDL_BUTTON(button)) != 0);
             }
-
-            bool is_playing() const
+            bool is_mouse_just_released(int button) const
             {
-                return Mix_PlayingMusic() != 0;
+                return valid_button(button) && (buttonUpFrame[button - 1] == frame || ((previousButtons & ~buttons) & SDL_BUTTON(button)) != 0);
             }
+
+            Vec2 get_mouse_pos() const { return mousePos; }
+            Vec2 get_mouse_delta() const { return mouseDelta; }
+            Vec2 get_wheel() const { return wheel; }
+            const std::string& get_text() const { return text; }
+            bool is_quit_requested() const { return quitRequested; }
+
         private:
-            Mix_Music* music = NULL;
-        };
-    }
+            static bool valid(SDL_Scancode sc) { return sc > SDL_SCANCODE_UNKNOWN && sc < SDL_NUM_SCANCODES; }
+            static bool valid_button(int button) { return button >= 1 && button <= MOUSE_BUTTONS; }
 
-    namespace random
-    {
-        static std::mt19937 rng(std::random_device{}());
+            // SDL_GetScancodeFromKey walks the whole keymap, so lookups are cached until the layout changes.
+            SDL_Scancode to_scancode(SDL_Keycode key) const
+            {
+                if (key >= 0 && key < 128)
+                {
+                    if (asciiScancodes[key] == 0)
+                        asciiScancodes[key] = SDL_GetScancodeFromKey(key) + 1;
+                    return static_cast<SDL_Scancode>(asciiScancodes[key] - 1);
+                }
 
-        inline void seed(unsigned int s)
-        {
-            rng.seed(s);
-        }
+                auto it = scancodes.find(key);
+                if (it == scancodes.end())
+                    it = scancodes.emplace(key, SDL_GetScancodeFromKey(key)).first;
+                return it->second;
+            }
 
-        inline float random() 
-        {
-            std::uniform_real_distribution<float> dist(0.0f, 1.0f);
-            return dist(rng);
-        }
+            void apply(const SDL_Event& e)
+            {
+                switch (e.type)
+                {
+                case SDL_QUIT:
+                    quitRequested = true;
+                    break;
+                case SDL_KEYDOWN:
+                    if (!valid(e.key.keysym.scancode))
+                        break;
+                    if (!e.key.repeat)
+                        downFrame[e.key.keysym.scancode] = frame;
+                    if (synthetic)
+                        current[e.key.keysym.scancode] = 1;
+                    break;
+                case SDL_KEYUP:
+                    if (!valid(e.key.keysym.scancode))
+                        break;
+                    upFrame[e.key.keysym.scancode] = frame;
+                    if (synthetic)
+                        current[e.key.keysym.scancode] = 0;
+                    break;
+                case SDL_MOUSEBUTTONDOWN:
+                    if (!valid_button(e.button.button))
+                        break;
+                    buttonDownFrame[e.button.button - 1] = frame;
+                    if (synthetic)
+                    {
+                        buttons |= SDL_BUTTON(e.button.button);
+                        mousePos = { static_cast<float>(e.button.x), static_cast<float>(e.button.y) };
+                    }
+                    break;
+                case SDL_MOUSEBUTTONUP:
+                    if (!valid_button(e.button.button))
+                        break;
+                    buttonUpFrame[e.button.button - 1] = frame;
+                    if (synthetic)
+                    {
+                        buttons &= ~SDL_BUTTON(e.button.button);
+                        mousePos = { static_cast<float>(e.button.x), static_cast<float>(e.button.y) };
+                    }
+                    break;
+                case SDL_MOUSEMOTION:
+                    mouseDelta.x += static_cast<float>(e.motion.xrel);
+                    mouseDelta.y += static_cast<float>(e.motion.yrel);
+                    if (synthetic)
+                        mousePos = { static_cast<float>(e.motion.x), static_cast<float>(e.motion.y) };
+                    break;
+                case SDL_MOUSEWHEEL:
+                    wheel.x += e.wheel.preciseX;
+                    wheel.y += e.wheel.preciseY;
+                    break;
+                case SDL_TEXTINPUT:
+                    text += e.text.text;
+                    break;
+                case SDL_KEYMAPCHANGED:
+                    std::fill(std::begin(asciiScancodes), std::end(asciiScancodes), 0);
+                    scancodes.clear();
+                    break;
+                }
+            }
 
-        inline float uniform(float a, float b)
-        {
-            std::uniform_real_distribution<float> dist(a, b);
-            return dist(rng);
-        }
+            bool buffering = false;
+            std::vector<SDL_Event> events;
+            size_t cursor = 0;
+            // Starts past the zero-filled *Frame arrays, so nothing reads as just pressed before the first update().
+            Uint32 frame = 1;
 
-        inline int randint(int a, int b)
-        {
-            std::uniform_int_distribution<int> dist(a, b);
-            return dist(rng);
-        }
-    }
+            Uint8 current[SDL_NUM_SCANCODES];
+            Uint8 previous[SDL_NUM_SCANCODES];
+            Uint32 downFrame[SDL_NUM_SCANCODES];
+            Uint32 upFrame[SDL_NUM_SCANCODES];
 
-    class Clock {
-    public:
-        Clock() {
-            lastTick = SDL_GetTicks();
-        }
+            Uint32 buttons = 0;
+            Uint32 previousButtons = 0;
+            Uint32 buttonDownFrame[MOUSE_BUTTONS];
+            Uint32 buttonUpFrame[MOUSE_BUTTONS];
+            Vec2 mousePos;
+            Vec2 mouseDelta;
+            Vec2 wheel;
 
-        float tick(int fps = 0) {
-            Uint32 now = SDL_GetTicks();
-            float delta = (now - lastTick) / 1000.0f;
+            std::string text;
+            bool quitRequested = false;
+            bool synthetic = false;
 
-            if (fps > 0) {
-                Uint32 frameDelay = 1000 / fps;
-                Uint32 frameTime = SDL_GetTicks() - lastTick;
-                if (frameDelay > frameTime)
-                    SDL_Delay(frameDelay - frameTime);
+            mutable int asciiScancodes[128] = {};
+            mutable std::unordered_map<SDL_Keycode, SDL_Scancode> scancodes;
+        };
 
-                now = SDL_GetTicks();
-                delta = (now - lastTick) / 1000.0f;
-            }
+        static InputState state;
 
-            lastTick = now;
-            currentFPS = (delta > 0) ? (1.0f / delta) : 0.0f;
-            return delta;
+        inline void update()
+        {
+            state.update();
         }
 
-        float get_fps() const { return currentFPS; }
+        inline bool is_pressed(SDL_Keycode key) { return state.is_pressed(key); }
+        inline bool is_just_pressed(SDL_Keycode key) { return state.is_just_pressed(key); }
+        inline bool is_just_released(SDL_Keycode key) { return state.is_just_released(key); }
+        inline bool is_pressed(SDL_Scancode sc) { return state.is_pressed(sc); }
+        inline bool is_just_pressed(SDL_Scancode sc) { return state.is_just_pressed(sc); }
+        inline bool is_just_released(SDL_Scancode sc) { return state.is_just_released(sc); }
 
-    private:
-        Uint32 lastTick;
-        float currentFPS = 0.0f;
-    };
+        inline bool is_mouse_pressed(int button) { return state.is_mouse_pressed(button); }
+        inline bool is_mouse_just_pressed(int button) { return state.is_mouse_just_pressed(button); }
+        inline bool is_mouse_just_released(int button) { return state.is_mouse_just_released(button); }
+        inline Vec2 get_mouse_pos() { return state.get_mouse_pos(); }
+        inline Vec2 get_mouse_delta() { return state.get_mouse_delta(); }
+        inline Vec2 get_wheel() { return state.get_wheel(); }
 
-    enum EventType
-    {
-        QUIT,
-        KEYDOWN,
-        KEYUP,
-        MOUSEDOWN,
-        MOUSEUP
-    };
+        inline const std::string& get_text() { return state.get_text(); }
+        inline void start_text_input() { SDL_StartTextInput(); }
+        inline void stop_text_input() { SDL_StopTextInput(); }
 
-    struct Event
+        inline bool is_quit_requested() { return state.is_quit_requested(); }
+    }
+
+    inline bool from_sdl_event(const SDL_Event& sdlEvent, Event& e)
     {
-        EventType type;
-        SDL_Keycode key;
-        int mouseX, mouseY;
-        Uint8 mouseButton;
-    };
+        switch (sdlEvent.type)
+        {
+        case SDL_QUIT:
+            e.type = QUIT;
+            return true;
+        case SDL_KEYDOWN:
+            e.type = KEYDOWN;
+            e.key = sdlEvent.key.keysym.sym;
+            e.scancode = sdlEvent.key.keysym.scancode;
+            e.repeat = sdlEvent.key.repeat != 0;
+            return true;
+        case SDL_KEYUP:
+            e.type = KEYUP;
+            e.key = sdlEvent.key.keysym.sym;
+            e.scancode = sdlEvent.key.keysym.scancode;
+            e.repeat = false;
+            return true;
+        case SDL_MOUSEBUTTONDOWN:
+            e.type = MOUSEDOWN;
+            e.mouseX = sdlEvent.button.x;
+            e.mouseY = sdlEvent.button.y;
+            e.mouseButton = sdlEvent.button.button;
+            return true;
+        case SDL_MOUSEBUTTONUP:
+            e.type = MOUSEUP;
+            e.mouseX = sdlEvent.button.x;
+            e.mouseY = sdlEvent.button.y;
+            e.mouseButton = sdlEvent.button.button;
+            return true;
+        case SDL_MOUSEMOTION:
+            e.type = MOUSEMOTION;
+            e.mouseX = sdlEvent.motion.x;
+            e.mouseY = sdlEvent.motion.y;
+            e.relX = sdlEvent.motion.xrel;
+            e.relY = sdlEvent.motion.yrel;
+            return true;
+        case SDL_MOUSEWHEEL:
+            e.type = MOUSEWHEEL;
+            e.wheelX = sdlEvent.wheel.preciseX;
+            e.wheelY = sdlEvent.wheel.preciseY;
+            return true;
+        case SDL_TEXTINPUT:
+            e.type = TEXTINPUT;
+            std::memcpy(e.text, sdlEvent.text.text, sizeof(e.text));
+            e.text[sizeof(e.text) - 1] = '\0';
+            return true;
+        }
+        return false;
+    }
 
+    // After the first input::update() this walks the events that update() drained; before that it
+    // polls SDL directly. Unmapped SDL events are skipped.
     inline bool get_events(Event& e)
     {
+        CGAME_PROFILE_ZONE("get_events");
         SDL_Event sdlEvent;
-        if (SDL_PollEvent(&sdlEvent))
+        if (input::state.is_buffering())
         {
-            switch (sdlEvent.type)
+            while (input::state.next_event(sdlEvent))
             {
-            case SDL_QUIT:
-                e.type = QUIT;
-                return true;
-            case SDL_KEYDOWN:
-                e.type = KEYDOWN;
-                e.key = sdlEvent.key.keysym.sym;
-                return true;
-            case SDL_KEYUP:
-                e.type = KEYUP;
-                e.key = sdlEvent.key.keysym.sym;
-                return true;
-            case SDL_MOUSEBUTTONDOWN:
-                e.type = MOUSEDOWN;
-                e.mouseX = sdlEvent.button.x;
-                e.mouseY = sdlEvent.button.y;
-                e.mouseButton = sdlEvent.button.button;
-                return true;
-            case SDL_MOUSEBUTTONUP:
-                e.type = MOUSEUP;
-                e.mouseX = sdlEvent.button.x;
-                e.mouseY = sdlEvent.button.y;
-                e.mouseButton = sdlEvent.button.button;
-                return true;
+                if (from_sdl_event(sdlEvent, e))
+                    return true;
             }
+            return false;
+        }
+
+        while (SDL_PollEvent(&sdlEvent))
+        {
+            if (from_sdl_event(sdlEvent, e))
+                return true;
         }
         return false;
     }
@@ -669,18 +9418,24 @@ namespace cgame
         case KEYDOWN:
             sdlEvent.type = SDL_KEYDOWN;
             sdlEvent.key.type = SDL_KEYDOWN;
+            sdlEvent.key.state = SDL_PRESSED;
+            sdlEvent.key.repeat = e.repeat ? 1 : 0;
             sdlEvent.key.keysym.sym = e.key;
+            sdlEvent.key.keysym.scancode = e.scancode;
             break;
 
         case KEYUP:
             sdlEvent.type = SDL_KEYUP;
             sdlEvent.key.type = SDL_KEYUP;
+            sdlEvent.key.state = SDL_RELEASED;
             sdlEvent.key.keysym.sym = e.key;
+            sdlEvent.key.keysym.scancode = e.scancode;
             break;
 
         case MOUSEDOWN:
             sdlEvent.type = SDL_MOUSEBUTTONDOWN;
             sdlEvent.button.type = SDL_MOUSEBUTTONDOWN;
+            sdlEvent.button.state = SDL_PRESSED;
             sdlEvent.button.x = e.mouseX;
             sdlEvent.button.y = e.mouseY;
             sdlEvent.button.button = e.mouseButton;
@@ -689,10 +9444,35 @@ namespace cgame
         case MOUSEUP:
             sdlEvent.type = SDL_MOUSEBUTTONUP;
             sdlEvent.button.type = SDL_MOUSEBUTTONUP;
+            sdlEvent.button.state = SDL_RELEASED;
             sdlEvent.button.x = e.mouseX;
             sdlEvent.button.y = e.mouseY;
             sdlEvent.button.button = e.mouseButton;
             break;
+
+        case MOUSEMOTION:
+            sdlEvent.type = SDL_MOUSEMOTION;
+            sdlEvent.motion.type = SDL_MOUSEMOTION;
+            sdlEvent.motion.x = e.mouseX;
+            sdlEvent.motion.y = e.mouseY;
+            sdlEvent.motion.xrel = e.relX;
+            sdlEvent.motion.yrel = e.relY;
+            break;
+
+        case MOUSEWHEEL:
+            sdlEvent.type = SDL_MOUSEWHEEL;
+            sdlEvent.wheel.type = SDL_MOUSEWHEEL;
+            sdlEvent.wheel.x = static_cast<Sint32>(e.wheelX);
+            sdlEvent.wheel.y = static_cast<Sint32>(e.wheelY);
+            sdlEvent.wheel.preciseX = e.wheelX;
+            sdlEvent.wheel.preciseY = e.wheelY;
+            break;
+
+        case TEXTINPUT:
+            sdlEvent.type = SDL_TEXTINPUT;
+            sdlEvent.text.type = SDL_TEXTINPUT;
+            std::memcpy(sdlEvent.text.text, e.text, sizeof(sdlEvent.text.text));
+            break;
         }
         return sdlEvent;
     }
@@ -707,8 +9487,370 @@ namespace cgame
         }
     }
 
+    // Input recording and playback. A recording holds the random seed, the input state when it
+    // started, and per frame the delta plus every event input::update() drained:
+    //
+    //     header: "CGRP", u32 version, u32 seed, u32 frames, f32 mouse x/y, u32 held, u16 scancode[held]
+    //     frame:  f32 delta, u32 events, then per event a u8 type and that type's fields
+    //
+    // Values are stored in host byte order.
+    namespace replay
+    {
+        static constexpr Uint32 VERSION = 1;
+        static constexpr char MAGIC[4] = { 'C', 'G', 'R', 'P' };
+        static constexpr long FRAME_COUNT_OFFSET = 12;
+
+        class Recorder
+        {
+        public:
+            Recorder() = default;
+            ~Recorder() { close(); }
+
+            Recorder(const Recorder&) = delete;
+            Recorder& operator=(const Recorder&) = delete;
+
+            bool open(const std::string& filePath)
+            {
+                return open(filePath, std::random_device{}());
+            }
+
+            // Reseeds random:: so the recorded session can be reproduced from the seed.
+            bool open(const std::string& filePath, unsigned int seed)
+            {
+                close();
+                file = std::fopen(filePath.c_str(), "wb");
+                if (!file)
+                {
+                    std::cerr << "Failed to open replay file " << filePath << std::endl;
+                    return false;
+                }
+
+                random::seed(seed);
+                frames = 0;
+
+                buffer.clear();
+                put_bytes(MAGIC, sizeof(MAGIC));
+                put(VERSION);
+                put(static_cast<Uint32>(seed));
+                put(frames);
+
+                Vec2 mouse = input::get_mouse_pos();
+                put(mouse.x);
+                put(mouse.y);
+
+                std::vector<Uint16> held;
+                for (int sc = 0; sc < SDL_NUM_SCANCODES; sc++)
+                {
+                    if (input::is_pressed(static_cast<SDL_Scancode>(sc)))
+                        held.push_back(static_cast<Uint16>(sc));
+                }
+                put(static_cast<Uint32>(held.size()));
+                for (Uint16 sc : held)
+                    put(sc);
+
+                return write_buffer();
+            }
+
+            // Call once per frame after input::update(), with the delta the scheduler advanced by.
+            void frame(float delta)
+            {
+                if (!file)
+                    return;
+
+                if (!input::state.is_buffering())
+                    std::cerr << "replay::Recorder::frame called without input::update()" << std::endl;
+
+                buffer.clear();
+                put(delta);
+                size_t countAt = buffer.size();
+                put(static_cast<Uint32>(0));
+
+                Uint32 count = 0;
+                Event e{};
+                for (const SDL_Event& sdlEvent : input::state.get_events())
+                {
+                    if (!from_sdl_event(sdlEvent, e))
+                        continue;
+                    put_event(e);
+                    count++;
+                }
+                std::memcpy(buffer.data() + countAt, &count, sizeof(count));
+
+                if (write_buffer())
+                    frames++;
+            }
+
+            void close()
+            {
+                if (!file)
+                    return;
+
+                std::fseek(file, FRAME_COUNT_OFFSET, SEEK_SET);
+                std::fwrite(&frames, sizeof(frames), 1, file);
+                std::fclose(file);
+                file = nullptr;
+            }
+
+            bool is_open() const { return file != nullptr; }
+            Uint32 get_frame_count() const { return frames; }
+
+        private:
+            template <typename T>
+            void put(T value)
+            {
+                put_bytes(&value, sizeof(T));
+            }
+
+            void put_bytes(const void* data, size_t size)
+            {
+                const Uint8* bytes = static_cast<const Uint8*>(data);
+                buffer.insert(buffer.end(), bytes, bytes + size);
+            }
+
+            void put_event(const Event& e)
+            {
+                put(static_cast<Uint8>(e.type));
+                switch (e.type)
+                {
+                case QUIT:
+                    break;
+                case KEYDOWN:
+                case KEYUP:
+                    put(static_cast<Sint32>(e.key));
+                    put(static_cast<Uint16>(e.scancode));
+                    put(static_cast<Uint8>(e.repeat));
+                    break;
+                case MOUSEDOWN:
+                case MOUSEUP:
+                    put(static_cast<Sint32>(e.mouseX));
+                    put(static_cast<Sint32>(e.mouseY));
+                    put(e.mouseButton);
+                    break;
+                case MOUSEMOTION:
+                    put(static_cast<Sint32>(e.mouseX));
+                    put(static_cast<Sint32>(e.mouseY));
+                    put(static_cast<Sint32>(e.relX));
+                    put(static_cast<Sint32>(e.relY));
+                    break;
+                case MOUSEWHEEL:
+                    put(e.wheelX);
+                    put(e.wheelY);
+                    break;
+                case TEXTINPUT:
+                {
+                    const char* end = static_cast<const char*>(std::memchr(e.text, '\0', sizeof(e.text)));
+                    Uint8 length = static_cast<Uint8>(end ? end - e.text : sizeof(e.text) - 1);
+                    put(length);
+                    put_bytes(e.text, length);
+                    break;
+                }
+                }
+            }
+
+            bool write_buffer()
+            {
+                if (std::fwrite(buffer.data(), 1, buffer.size(), file) == buffer.size())
+                    return true;
+
+                std::cerr << "Failed to write replay frame" << std::endl;
+                return false;
+            }
+
+            FILE* file = nullptr;
+            Uint32 frames = 0;
+            std::vector<Uint8> buffer;
+        };
+
+        // Plays a recording back: each next_frame() pushes that frame's events onto SDL's queue for
+        // input::update() / get_events() to pick up, and get_delta() is what to pass to
+        // FrameScheduler::begin_frame(float). Input queries are rebuilt from the events while open.
+        class Player
+        {
+        public:
+            Player() = default;
+            ~Player() { close(); }
+
+            Player(const Player&) = delete;
+            Player& operator=(const Player&) = delete;
+
+            bool open(const std::string& filePath)
+            {
+                close();
+
+                SDL_RWops* rw = SDL_RWFromFile(filePath.c_str(), "rb");
+                if (!rw)
+                {
+                    std::cerr << "Failed to open replay file " << filePath << ": " << SDL_GetError() << std::endl;
+                    return false;
+                }
+                Sint64 size = SDL_RWsize(rw);
+                data.resize(size > 0 ? static_cast<size_t>(size) : 0);
+                size_t got = data.empty() ? 0 : SDL_RWread(rw, data.data(), 1, data.size());
+                SDL_RWclose(rw);
+
+                cursor = 0;
+                char magic[sizeof(MAGIC)];
+                Uint32 version = 0;
+                Vec2 mouse;
+                Uint32 heldCount = 0;
+                if (got != data.size() || !get_bytes(magic, sizeof(magic)) || std::memcmp(magic, MAGIC, sizeof(MAGIC)) != 0
+                    || !get(version) || version != VERSION || !get(seed) || !get(frameCount)
+                    || !get(mouse.x) || !get(mouse.y) || !get(heldCount))
+                {
+                    std::cerr << "Not a replay file (or unsupported version): " << filePath << std::endl;
+                    data.clear();
+                    return false;
+                }
+
+                std::vector<SDL_Scancode> held;
+                for (Uint32 i = 0; i < heldCount; i++)
+                {
+                    Uint16 sc;
+                    if (!get(sc))
+                    {
+                        std::cerr << "Truncated replay file " << filePath << std::endl;
+                        data.clear();
+                        return false;
+                    }
+                    held.push_back(static_cast<SDL_Scancode>(sc));
+                }
+
+                random::seed(seed);
+                input::state.set_synthetic(true, mouse, held);
+                frame = 0;
+                delta = 0.0f;
+                return true;
+            }
+
+            // Returns false once every recorded frame has been played.
+            bool next_frame()
+            {
+                if (data.empty() || frame >= frameCount)
+                    return false;
+
+                Uint32 count = 0;
+                if (!get(delta) || !get(count))
+                    return truncated();
+
+                for (Uint32 i = 0; i < count; i++)
+                {
+                    Event e{};
+                    if (!get_event(e))
+                        return truncated();
+                    SDL_Event sdlEvent = to_sdl_event(e);
+                    SDL_PushEvent(&sdlEvent);
+                }
+
+                frame++;
+                return true;
+            }
+
+            void close()
+            {
+                if (data.empty())
+                    return;
+
+                data.clear();
+                input::state.set_synthetic(false);
+            }
+
+            bool is_open() const { return !data.empty(); }
+            float get_delta() const { return delta; }
+            Uint32 get_frame() const { return frame; }
+            Uint32 get_frame_count() const { return frameCount; }
+            unsigned int get_seed() const { return seed; }
+
+        private:
+            template <typename T>
+            bool get(T& value)
+            {
+                return get_bytes(&value, sizeof(T));
+            }
+
+            bool get_bytes(void* out, size_t size)
+            {
+                if (data.size() - cursor < size)
+                    return false;
+                std::memcpy(out, data.data() + cursor, size);
+                cursor += size;
+                return true;
+            }
+
+            bool get_event(Event& e)
+            {
+                Uint8 type;
+                if (!get(type) || type > TEXTINPUT)
+                    return false;
+                e.type = static_cast<EventType>(type);
+
+                Sint32 a, b, c, d;
+                switch (e.type)
+                {
+                case QUIT:
+                    return true;
+                case KEYDOWN:
+                case KEYUP:
+                {
+                    Uint16 sc;
+                    Uint8 repeat;
+                    if (!get(a) || !get(sc) || !get(repeat))
+                        return false;
+                    e.key = a;
+                    e.scancode = static_cast<SDL_Scancode>(sc);
+                    e.repeat = repeat != 0;
+                    return true;
+                }
+                case MOUSEDOWN:
+                case MOUSEUP:
+                    if (!get(a) || !get(b) || !get(e.mouseButton))
+                        return false;
+                    e.mouseX = a;
+                    e.mouseY = b;
+                    return true;
+                case MOUSEMOTION:
+                    if (!get(a) || !get(b) || !get(c) || !get(d))
+                        return false;
+                    e.mouseX = a;
+                    e.mouseY = b;
+                    e.relX = c;
+                    e.relY = d;
+                    return true;
+                case MOUSEWHEEL:
+                    return get(e.wheelX) && get(e.wheelY);
+                case TEXTINPUT:
+                {
+                    Uint8 length;
+                    if (!get(length) || length >= sizeof(e.text) || !get_bytes(e.text, length))
+                        return false;
+                    e.text[length] = '\0';
+                    return true;
+                }
+                }
+                return false;
+            }
+
+            bool truncated()
+            {
+                std::cerr << "Truncated replay at frame " << frame << std::endl;
+                frame = frameCount;
+                return false;
+            }
+
+            std::vector<Uint8> data;
+            size_t cursor = 0;
+            unsigned int seed = 0;
+            Uint32 frameCount = 0;
+            Uint32 frame = 0;
+            float delta = 0.0f;
+        };
+    }
+
     inline void quit()
     {
+        assets::clear();
+        mixer::stop_engine();
+        jobs::stop();
+
         IMG_Quit();
         TTF_Quit();
         Mix_CloseAudio();
@@ -9,11 +9,30 @@ static const float RENDER_SCALE = 2.0f;
 
 int main(int argc, char* argv[]) 
 {
+    // --record <file> captures the session; --replay <file> reruns it headless and uncapped.
+    std::string recordPath, replayPath;
+    for (int i = 1; i + 1 < argc; i++)
+    {
+        if (std::string(argv[i]) == "--record")
+            recordPath = argv[++i];
+        else if (std::string(argv[i]) == "--replay")
+            replayPath = argv[++i];
+    }
+
+    if (!replayPath.empty())
+    {
+        SDL_setenv("SDL_VIDEODRIVER", "dummy", 0);
+        SDL_setenv("SDL_AUDIODRIVER", "dummy", 0);
+        SDL_setenv("SDL_RENDER_DRIVER", "software", 0);
+    }
+
     cgame::init();
 
     {
         cgame::Window& screen = cgame::display::set_mode(1280, 720);
-        cgame::Clock clock;
+        cgame::FrameScheduler scheduler(replayPath.empty() ? 60 : 0);
+
+        cgame::batch::begin(screen.get_renderer());
 
         cgame::Surface display(screen.get_renderer(), screen.get_width() / 2, screen.get_height() / 2);
         
@@ -31,6 +50,7 @@ int main(int argc, char* argv[])
         cgame::mixer::Sound deathSound = cgame::mixer::Sound("assets/sfx/death.wav");
         cgame::mixer::Sound hurtSound = cgame::mixer::Sound("assets/sfx/hurt.wav");
         hurtSound.set_volume(0.3f);
+        hurtSound.set_max_instances(4);
 
         cgame::mixer::Music music = cgame::mixer::Music("assets/music/rosalia.mp3");
         music.play();
@@ -44,47 +64,37 @@ int main(int argc, char* argv[])
         std::cout << "random range: " << randomFloatRange << std::endl;
 
         float x = 50;
-        int movement[4] = { false, false, false, false };
         float rot = 0.0f;
 
         bool running = true;
+
+        cgame::replay::Recorder recorder;
+        cgame::replay::Player player;
+        if (!recordPath.empty() && !recorder.open(recordPath))
+            running = false;
+        if (!replayPath.empty() && !player.open(replayPath))
+            running = false;
         
         while (running)
         {
-            cgame::Event e;
-            while (cgame::get_events(e))
+            if (player.is_open())
             {
-                if (e.type == cgame::QUIT)
-                {
-                    running = false;
-                }
-                if (e.type == cgame::KEYDOWN)
-                {
-                    if (e.key == SDLK_ESCAPE)
-                        running = false;
-                    if (e.key == SDLK_a)
-                        movement[0] = true;
-                    if (e.key == SDLK_d)
-                        movement[1] = true;
-                    if (e.key == SDLK_w)
-                        movement[2] = true;
-                    if (e.key == SDLK_s)
-                        movement[3] = true;
-                    if (e.key == SDLK_SPACE)
-                        hurtSound.play();
-                }
-                if (e.type == cgame::KEYUP)
-                {
-                    if (e.key == SDLK_a)
-                        movement[0] = false;
-                    if (e.key == SDLK_d)
-                        movement[1] = false;
-                    if (e.key == SDLK_w)
-                        movement[2] = false;
-                    if (e.key == SDLK_s)
-                        movement[3] = false;
-                }
+                if (!player.next_frame())
+                    break;
+                scheduler.begin_frame(player.get_delta());
             }
+            else
+            {
+                scheduler.begin_frame();
+            }
+
+            cgame::input::update();
+            recorder.frame(scheduler.get_delta());
+
+            if (cgame::input::is_quit_requested() || cgame::input::is_just_pressed(SDLK_ESCAPE))
+                running = false;
+            if (cgame::input::is_just_pressed(SDLK_SPACE))
+                hurtSound.play();
 
             screen.begin_frame();
 
@@ -95,37 +105,46 @@ int main(int argc, char* argv[])
                 std::cout << "collision is happening!" << std::endl;
             }
 
-            cgame::Vec2 mp = cgame::mouse::get_pos();
+            cgame::Vec2 mp = cgame::input::get_mouse_pos();
             if (blueBoxRect.collidepoint(mp.x / 2, mp.y / 2))
             {
                 std::cout << "point collision is happening!" << std::endl;
             }
 
-            playerRect.set_left(playerRect.left() + (movement[1] - movement[0]) * 3);
-            playerRect.set_top(playerRect.top() + (movement[3] - movement[2]) * 3);
+            while (scheduler.step())
+            {
+                playerRect.set_left(playerRect.left() + (cgame::input::is_pressed(SDLK_d) - cgame::input::is_pressed(SDLK_a)) * 3);
+                playerRect.set_top(playerRect.top() + (cgame::input::is_pressed(SDLK_s) - cgame::input::is_pressed(SDLK_w)) * 3);
+                rot++;
+            }
 
             cgame::draw::rect(display, playerRect, { 255, 0, 0 });
 
-            cgame::Surface text = testFont.render("Hello World!", { 255, 255, 255 });
-            cgame::Surface centeredText = testFont.render("Centered Text", { 255, 0, 0 });
+            cgame::Vec2 centeredTextSize = testFont.get_text_size("Centered Text");
 
             playerImage.set_alpha(std::max(0.0f, 100.0f + playerRect.x));
 
-            rot++;
             display.blit(cgame::transform::rotate(cgame::transform::flip(playerImage, true), rot), playerRect);
             display.blit(blueBox, blueBoxRect);
-            display.blit(text, 50, 50);
-            display.blit(centeredText, (display.get_width() / 2 - centeredText.get_width()) / RENDER_SCALE, (display.get_height() / 2 - centeredText.get_height()) / RENDER_SCALE);
+            testFont.draw(display, "Hello World!", 50, 50, { 255, 255, 255 });
+            testFont.draw(display, "Centered Text", (display.get_width() / 2 - centeredTextSize.x) / RENDER_SCALE, (display.get_height() / 2 - centeredTextSize.y) / RENDER_SCALE, { 255, 0, 0 });
             
             screen.blit(cgame::transform::scale(display, screen.get_width(), screen.get_height()), 0, 0);
 
             screen.end_frame();
 
             std::ostringstream ss;
-            ss << std::fixed << std::setprecision(0) << clock.get_fps();
+            ss << std::fixed << std::setprecision(0) << scheduler.get_stats().fps;
             screen.set_title(("CGame but fast | FPS: " + ss.str()).c_str());
 
-            float dt = clock.tick(60);
+            scheduler.end_frame();
+        }
+
+        if (player.is_open())
+        {
+            cgame::FrameStats stats = scheduler.get_stats();
+            std::cout << "replay: " << player.get_frame() << " frames, player at " << playerRect.x << "," << playerRect.y
+                      << ", frame ms mean " << stats.mean << " p50 " << stats.p50 << " p99 " << stats.p99 << " max " << stats.max << std::endl;
         }
     }
 
@@ -0,0 +1,76 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <filesystem>
+
+#include "../include/cgame.hpp"
+
+// Packs files and directories into one archive for cgame::assets::mount(). Entries are named by
+// the path given here, so pack from the directory the game runs in:
+//
+//     pack [--store] <archive> <file or directory>...
+
+int main(int argc, char* argv[])
+{
+    bool compress = true;
+    std::string outPath;
+    std::vector<std::string> inputs;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg == "--store")
+            compress = false;
+        else if (outPath.empty())
+            outPath = arg;
+        else
+            inputs.push_back(arg);
+    }
+
+    if (outPath.empty() || inputs.empty())
+    {
+        std::cerr << "usage: " << argv[0] << " [--store] <archive> <file or directory>..." << std::endl;
+        return 1;
+    }
+
+    std::vector<std::string> files;
+    for (const std::string& input : inputs)
+    {
+        std::error_code error;
+        if (std::filesystem::is_directory(input, error))
+        {
+            for (const auto& entry : std::filesystem::recursive_directory_iterator(input, error))
+            {
+                if (entry.is_regular_file())
+                    files.push_back(entry.path().generic_string());
+            }
+        }
+        else if (std::filesystem::is_regular_file(input, error))
+        {
+            files.push_back(std::filesystem::path(input).generic_string());
+        }
+        else
+        {
+            std::cerr << "No such file or directory: " << input << std::endl;
+            return 1;
+        }
+    }
+
+    // Sorted so the same inputs always produce the same archive.
+    std::sort(files.begin(), files.end());
+    files.erase(std::unique(files.begin(), files.end()), files.end());
+
+    cgame::archive::Writer writer;
+    for (const std::string& file : files)
+    {
+        if (!writer.add_file(file, compress))
+            return 1;
+    }
+
+    if (!writer.save(outPath))
+        return 1;
+
+    std::cerr << outPath << ": " << writer.get_count() << " entries, " << writer.get_raw_bytes() << " bytes packed into "
+              << writer.get_packed_bytes() << std::endl;
+    return 0;
+}